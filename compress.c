@@ -0,0 +1,186 @@
+/*
+ * This file is part of RedisRaft.
+ *
+ * Copyright (c) 2020 Redis Labs
+ *
+ * RedisRaft is dual licensed under the GNU Affero General Public License version 3
+ * (AGPLv3) or the Redis Source Available License (RSAL).
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "redisraft.h"
+
+/* LZF compression of Raft log entries.
+ *
+ * This uses the LZF format, which is also used by Redis to compress RDB
+ * strings. It doesn't compress as well as general purpose compressors, but it
+ * is fast and needs no state beyond a small hash table, which is enough for
+ * the repetitive command payloads kept in the log.
+ *
+ * The compressed data is a sequence of:
+ *   000LLLLL <L+1 literal bytes>
+ *   LLLooooo oooooooo               back reference, length L+2 (L < 7)
+ *   111ooooo LLLLLLLL oooooooo      back reference, length L+9
+ * where the offset o+1 is the distance back into the decompressed data.
+ */
+
+#define LZF_HASH_LOG        13
+#define LZF_HASH_SIZE       (1 << LZF_HASH_LOG)
+#define LZF_MAX_LITERAL     32
+#define LZF_MAX_OFFSET      (1 << 13)
+#define LZF_MAX_REF         (255 + 7 + 2)
+
+static inline uint32_t lzfHash(const uint8_t *p)
+{
+    uint32_t v = (p[0] << 16) | (p[1] << 8) | p[2];
+    return (v * 2654435761U) >> (32 - LZF_HASH_LOG);
+}
+
+/* Writes literal runs, returns false if out of space */
+static bool lzfEmitLiterals(uint8_t **op, uint8_t *out_end, const uint8_t *lit, size_t len)
+{
+    while (len > 0) {
+        size_t n = len < LZF_MAX_LITERAL ? len : LZF_MAX_LITERAL;
+
+        if (*op + n + 1 > out_end) {
+            return false;
+        }
+
+        *(*op)++ = n - 1;
+        memcpy(*op, lit, n);
+        *op += n;
+        lit += n;
+        len -= n;
+    }
+
+    return true;
+}
+
+/* Compresses in_len bytes into out, which holds out_len bytes.
+ *
+ * Returns the compressed size, or 0 if the data does not fit in out (i.e. it
+ * does not compress well enough).
+ */
+size_t LZFCompress(const void *in, size_t in_len, void *out, size_t out_len)
+{
+    const uint8_t *ip = in;
+    const uint8_t *in_end = ip + in_len;
+    const uint8_t *lit = ip;
+    uint8_t *op = out;
+    uint8_t *out_end = op + out_len;
+    const uint8_t *htab[LZF_HASH_SIZE] = { 0 };
+
+    while (ip + 2 < in_end) {
+        uint32_t h = lzfHash(ip);
+        const uint8_t *ref = htab[h];
+        htab[h] = ip;
+
+        if (!ref || ip - ref > LZF_MAX_OFFSET ||
+            ref[0] != ip[0] || ref[1] != ip[1] || ref[2] != ip[2]) {
+            ip++;
+            continue;
+        }
+
+        if (!lzfEmitLiterals(&op, out_end, lit, ip - lit)) {
+            return 0;
+        }
+
+        size_t max_len = in_end - ip;
+        if (max_len > LZF_MAX_REF) {
+            max_len = LZF_MAX_REF;
+        }
+
+        size_t len = 3;
+        while (len < max_len && ref[len] == ip[len]) {
+            len++;
+        }
+
+        size_t off = ip - ref - 1;
+        size_t l = len - 2;
+
+        if (op + (l < 7 ? 2 : 3) > out_end) {
+            return 0;
+        }
+        if (l < 7) {
+            *op++ = (off >> 8) | (l << 5);
+        } else {
+            *op++ = (off >> 8) | (7 << 5);
+            *op++ = l - 7;
+        }
+        *op++ = off & 0xff;
+
+        /* Positions within the match may be referenced later */
+        const uint8_t *end = ip + len;
+        for (ip++; ip < end && ip + 2 < in_end; ip++) {
+            htab[lzfHash(ip)] = ip;
+        }
+
+        ip = end;
+        lit = ip;
+    }
+
+    if (!lzfEmitLiterals(&op, out_end, lit, in_end - lit)) {
+        return 0;
+    }
+
+    return op - (uint8_t *) out;
+}
+
+/* Decompresses in_len bytes into out, which holds out_len bytes.
+ *
+ * Returns the decompressed size, or 0 if the data is invalid or does not fit.
+ */
+size_t LZFDecompress(const void *in, size_t in_len, void *out, size_t out_len)
+{
+    const uint8_t *ip = in;
+    const uint8_t *in_end = ip + in_len;
+    uint8_t *op = out;
+    uint8_t *out_end = op + out_len;
+
+    while (ip < in_end) {
+        unsigned int ctrl = *ip++;
+
+        if (ctrl < (1 << 5)) {
+            /* Literal run */
+            ctrl++;
+            if (op + ctrl > out_end || ip + ctrl > in_end) {
+                return 0;
+            }
+
+            memcpy(op, ip, ctrl);
+            op += ctrl;
+            ip += ctrl;
+        } else {
+            /* Back reference */
+            unsigned int len = ctrl >> 5;
+
+            if (len == 7) {
+                if (ip >= in_end) {
+                    return 0;
+                }
+                len += *ip++;
+            }
+            if (ip >= in_end) {
+                return 0;
+            }
+
+            size_t off = ((ctrl & 0x1f) << 8) + *ip++ + 1;
+            len += 2;
+
+            if (op + len > out_end || off > (size_t) (op - (uint8_t *) out)) {
+                return 0;
+            }
+
+            /* May overlap, so copy byte by byte */
+            const uint8_t *ref = op - off;
+            while (len--) {
+                *op++ = *ref++;
+            }
+        }
+    }
+
+    return op - (uint8_t *) out;
+}
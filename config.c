@@ -114,6 +114,37 @@ static RRStatus processConfigParam(const char *keyword, const char *value,
             return RR_ERROR;
         }
         target->raft_response_timeout = val;
+    } else if (!strcmp(keyword, "raft-ae-pipeline-depth")) {
+        char *errptr;
+        unsigned long val = strtoul(value, &errptr, 10);
+        if (*errptr != '\0' || val <= 0) {
+            snprintf(errbuf, errbuflen-1, "invalid 'raft-ae-pipeline-depth' value");
+            return RR_ERROR;
+        }
+        target->raft_ae_pipeline_depth = val;
+    } else if (!strcmp(keyword, "raft-snapshot-chunk-size")) {
+        unsigned long val;
+        if (parseMemorySize(value, &val) != RR_OK || !val) {
+            snprintf(errbuf, errbuflen-1, "invalid 'raft-snapshot-chunk-size' value");
+            return RR_ERROR;
+        }
+        target->raft_snapshot_chunk_size = val;
+    } else if (!strcmp(keyword, "raft-snapshot-diskless")) {
+        bool val;
+        if (parseBool(value, &val) != RR_OK) {
+            snprintf(errbuf, errbuflen-1, "invalid 'raft-snapshot-diskless' value");
+            return RR_ERROR;
+        }
+        target->raft_snapshot_diskless = val;
+    } else if (!strcmp(keyword, "raft-snapshot-diskless-dir")) {
+        if (!*value) {
+            snprintf(errbuf, errbuflen-1, "invalid 'raft-snapshot-diskless-dir' value");
+            return RR_ERROR;
+        }
+        if (target->raft_snapshot_diskless_dir) {
+            RedisModule_Free(target->raft_snapshot_diskless_dir);
+        }
+        target->raft_snapshot_diskless_dir = RedisModule_Strdup(value);
     } else if (!strcmp(keyword, "proxy-response-timeout")) {
         char *errptr;
         unsigned long val = strtoul(value, &errptr, 10);
@@ -144,6 +175,28 @@ static RRStatus processConfigParam(const char *keyword, const char *value,
             return RR_ERROR;
         }
         target->raft_log_max_file_size = val;
+    } else if (!strcmp(keyword, "raft-log-segment-size")) {
+        unsigned long val;
+        if (parseMemorySize(value, &val) != RR_OK || !val) {
+            snprintf(errbuf, errbuflen-1, "invalid 'raft-log-segment-size' value");
+            return RR_ERROR;
+        }
+        target->raft_log_segment_size = val;
+    } else if (!strcmp(keyword, "raft-log-load-threads")) {
+        char *errptr;
+        unsigned long val = strtoul(value, &errptr, 10);
+        if (*errptr != '\0' || val <= 0) {
+            snprintf(errbuf, errbuflen-1, "invalid 'raft-log-load-threads' value");
+            return RR_ERROR;
+        }
+        target->raft_log_load_threads = val;
+    } else if (!strcmp(keyword, "raft-entry-compress-threshold")) {
+        unsigned long val;
+        if (parseMemorySize(value, &val) != RR_OK) {
+            snprintf(errbuf, errbuflen-1, "invalid 'raft-entry-compress-threshold' value");
+            return RR_ERROR;
+        }
+        target->raft_entry_compress_threshold = val;
     } else if (!strcmp(keyword, "raft-log-fsync")) {
         bool val;
         if (parseBool(value, &val) != RR_OK) {
@@ -151,6 +204,27 @@ static RRStatus processConfigParam(const char *keyword, const char *value,
             return RR_ERROR;
         }
         target->raft_log_fsync = val;
+    } else if (!strcmp(keyword, "raft-log-group-commit")) {
+        bool val;
+        if (parseBool(value, &val) != RR_OK) {
+            snprintf(errbuf, errbuflen-1, "invalid 'raft-log-group-commit' value");
+            return RR_ERROR;
+        }
+        target->raft_log_group_commit = val;
+    } else if (!strcmp(keyword, "raft-log-async-fsync")) {
+        bool val;
+        if (parseBool(value, &val) != RR_OK) {
+            snprintf(errbuf, errbuflen-1, "invalid 'raft-log-async-fsync' value");
+            return RR_ERROR;
+        }
+        target->raft_log_async_fsync = val;
+    } else if (!strcmp(keyword, "raft-write-batching")) {
+        bool val;
+        if (parseBool(value, &val) != RR_OK) {
+            snprintf(errbuf, errbuflen-1, "invalid 'raft-write-batching' value");
+            return RR_ERROR;
+        }
+        target->raft_write_batching = val;
     } else if (!strcmp(keyword, "follower-proxy")) {
         bool val;
         if (parseBool(value, &val) != RR_OK) {
@@ -158,6 +232,13 @@ static RRStatus processConfigParam(const char *keyword, const char *value,
             return RR_ERROR;
         }
         target->follower_proxy = val;
+    } else if (!strcmp(keyword, "follower-reads")) {
+        bool val;
+        if (parseBool(value, &val) != RR_OK) {
+            snprintf(errbuf, errbuflen-1, "invalid 'follower-reads' value");
+            return RR_ERROR;
+        }
+        target->follower_reads = val;
     } else if (!strcmp(keyword, "quorum-reads")) {
         bool val;
         if (parseBool(value, &val) != RR_OK) {
@@ -165,6 +246,13 @@ static RRStatus processConfigParam(const char *keyword, const char *value,
             return RR_ERROR;
         }
         target->quorum_reads = val;
+    } else if (!strcmp(keyword, "lease-reads")) {
+        bool val;
+        if (parseBool(value, &val) != RR_OK) {
+            snprintf(errbuf, errbuflen-1, "invalid 'lease-reads' value");
+            return RR_ERROR;
+        }
+        target->lease_reads = val;
     } else if (!strcmp(keyword, "raftize-all-commands")) {
         bool val;
         if (parseBool(value, &val) != RR_OK) {
@@ -172,6 +260,13 @@ static RRStatus processConfigParam(const char *keyword, const char *value,
             return RR_ERROR;
         }
         target->raftize_all_commands = val;
+    } else if (!strcmp(keyword, "async-logging")) {
+        bool val;
+        if (parseBool(value, &val) != RR_OK) {
+            snprintf(errbuf, errbuflen-1, "invalid 'async-logging' value");
+            return RR_ERROR;
+        }
+        target->async_logging = val;
     } else if (!strcmp(keyword, "loglevel")) {
         int loglevel = parseLogLevel(value);
         if (loglevel < 0) {
@@ -216,6 +311,18 @@ void handleConfigSet(RedisRaftCtx *rr, RedisModuleCtx *ctx, RedisModuleString **
             }
         }
 
+        if (old_config.async_logging != rr->config->async_logging) {
+            if (rr->config->async_logging) {
+                if (LoggerStart() != RR_OK) {
+                    RedisModule_ReplyWithError(ctx, "ERR failed to start logging thread");
+                    rr->config->async_logging = false;
+                    return;
+                }
+            } else {
+                LoggerStop();
+            }
+        }
+
         RedisModule_ReplyWithSimpleString(ctx, "OK");
     } else {
         RedisModule_ReplyWithError(ctx, errbuf);
@@ -283,6 +390,22 @@ void handleConfigGet(RedisModuleCtx *ctx, RedisRaftConfig *config, RedisModuleSt
         len++;
         replyConfigInt(ctx, "raft-response-timeout", config->raft_response_timeout);
     }
+    if (stringmatch(pattern, "raft-ae-pipeline-depth", 1)) {
+        len++;
+        replyConfigInt(ctx, "raft-ae-pipeline-depth", config->raft_ae_pipeline_depth);
+    }
+    if (stringmatch(pattern, "raft-snapshot-chunk-size", 1)) {
+        len++;
+        replyConfigMemSize(ctx, "raft-snapshot-chunk-size", config->raft_snapshot_chunk_size);
+    }
+    if (stringmatch(pattern, "raft-snapshot-diskless", 1)) {
+        len++;
+        replyConfigBool(ctx, "raft-snapshot-diskless", config->raft_snapshot_diskless);
+    }
+    if (stringmatch(pattern, "raft-snapshot-diskless-dir", 1)) {
+        len++;
+        replyConfigStr(ctx, "raft-snapshot-diskless-dir", config->raft_snapshot_diskless_dir);
+    }
     if (stringmatch(pattern, "proxy-response-timeout", 1)) {
         len++;
         replyConfigInt(ctx, "proxy-response-timeout", config->proxy_response_timeout);
@@ -299,22 +422,58 @@ void handleConfigGet(RedisModuleCtx *ctx, RedisRaftConfig *config, RedisModuleSt
         len++;
         replyConfigMemSize(ctx, "raft-log-max-file-size", config->raft_log_max_file_size);
     }
+    if (stringmatch(pattern, "raft-log-segment-size", 1)) {
+        len++;
+        replyConfigMemSize(ctx, "raft-log-segment-size", config->raft_log_segment_size);
+    }
+    if (stringmatch(pattern, "raft-log-load-threads", 1)) {
+        len++;
+        replyConfigInt(ctx, "raft-log-load-threads", config->raft_log_load_threads);
+    }
+    if (stringmatch(pattern, "raft-entry-compress-threshold", 1)) {
+        len++;
+        replyConfigMemSize(ctx, "raft-entry-compress-threshold", config->raft_entry_compress_threshold);
+    }
     if (stringmatch(pattern, "raft-log-fsync", 1)) {
         len++;
         replyConfigBool(ctx, "raft-log-fsync", config->raft_log_fsync);
     }
+    if (stringmatch(pattern, "raft-log-group-commit", 1)) {
+        len++;
+        replyConfigBool(ctx, "raft-log-group-commit", config->raft_log_group_commit);
+    }
+    if (stringmatch(pattern, "raft-log-async-fsync", 1)) {
+        len++;
+        replyConfigBool(ctx, "raft-log-async-fsync", config->raft_log_async_fsync);
+    }
+    if (stringmatch(pattern, "raft-write-batching", 1)) {
+        len++;
+        replyConfigBool(ctx, "raft-write-batching", config->raft_write_batching);
+    }
     if (stringmatch(pattern, "follower-proxy", 1)) {
         len++;
         replyConfigBool(ctx, "follower-proxy", config->follower_proxy);
     }
+    if (stringmatch(pattern, "follower-reads", 1)) {
+        len++;
+        replyConfigBool(ctx, "follower-reads", config->follower_reads);
+    }
     if (stringmatch(pattern, "quorum-reads", 1)) {
         len++;
         replyConfigBool(ctx, "quorum-reads", config->quorum_reads);
     }
+    if (stringmatch(pattern, "lease-reads", 1)) {
+        len++;
+        replyConfigBool(ctx, "lease-reads", config->lease_reads);
+    }
     if (stringmatch(pattern, "raftize-all-commands", 1)) {
         len++;
         replyConfigBool(ctx, "raftize-all-commands", config->raftize_all_commands);
     }
+    if (stringmatch(pattern, "async-logging", 1)) {
+        len++;
+        replyConfigBool(ctx, "async-logging", config->async_logging);
+    }
     if (stringmatch(pattern, "addr", 1)) {
         len++;
         char buf[300];
@@ -338,12 +497,25 @@ void ConfigInit(RedisModuleCtx *ctx, RedisRaftConfig *config)
     config->election_timeout = REDIS_RAFT_DEFAULT_ELECTION_TIMEOUT;
     config->reconnect_interval = REDIS_RAFT_DEFAULT_RECONNECT_INTERVAL;
     config->raft_response_timeout = REDIS_RAFT_DEFAULT_RAFT_RESPONSE_TIMEOUT;
+    config->raft_ae_pipeline_depth = REDIS_RAFT_DEFAULT_AE_PIPELINE_DEPTH;
+    config->raft_snapshot_chunk_size = REDIS_RAFT_DEFAULT_SNAPSHOT_CHUNK_SIZE;
+    config->raft_snapshot_diskless = false;
+    config->raft_snapshot_diskless_dir = RedisModule_Strdup(REDIS_RAFT_DEFAULT_SNAPSHOT_DISKLESS_DIR);
     config->proxy_response_timeout = REDIS_RAFT_DEFAULT_PROXY_RESPONSE_TIMEOUT;
     config->raft_log_max_cache_size = REDIS_RAFT_DEFAULT_LOG_MAX_CACHE_SIZE;
     config->raft_log_max_file_size = REDIS_RAFT_DEFAULT_LOG_MAX_FILE_SIZE;
+    config->raft_log_segment_size = REDIS_RAFT_DEFAULT_LOG_SEGMENT_SIZE;
+    config->raft_log_load_threads = REDIS_RAFT_DEFAULT_LOG_LOAD_THREADS;
+    config->raft_entry_compress_threshold = REDIS_RAFT_DEFAULT_ENTRY_COMPRESS_THRESHOLD;
     config->raft_log_fsync = true;
+    config->raft_log_group_commit = false;
+    config->raft_log_async_fsync = false;
+    config->raft_write_batching = false;
     config->quorum_reads = true;
+    config->lease_reads = false;
+    config->follower_reads = false;
     config->raftize_all_commands = true;
+    config->async_logging = false;
 }
 static RRStatus setRedisConfig(RedisModuleCtx *ctx, const char *param, const char *value)
 {
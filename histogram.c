@@ -0,0 +1,105 @@
+/*
+ * This file is part of RedisRaft.
+ *
+ * Copyright (c) 2020 Redis Labs
+ *
+ * RedisRaft is dual licensed under the GNU Affero General Public License version 3
+ * (AGPLv3) or the Redis Source Available License (RSAL).
+ */
+
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "redisraft.h"
+
+/* Latency histograms.
+ *
+ * Values are counted in buckets of logarithmic size, similar to HDR
+ * histograms: every power of two range is split into HISTOGRAM_SUB_BUCKETS
+ * linear buckets, so any recorded value is reported with a relative error of
+ * no more than 1/HISTOGRAM_SUB_BUCKETS, using a fixed amount of memory and a
+ * few instructions per value.
+ *
+ * Values below HISTOGRAM_SUB_BUCKETS have a bucket of their own, and values
+ * of HISTOGRAM_MAX_BITS bits or more are counted in the last bucket.
+ */
+
+static int bucketIndex(uint64_t value)
+{
+    if (value < HISTOGRAM_SUB_BUCKETS) {
+        return value;
+    }
+    if (value >> HISTOGRAM_MAX_BITS) {
+        return HISTOGRAM_BUCKETS - 1;
+    }
+
+    int msb = 63 - __builtin_clzll(value);
+    int shift = msb - HISTOGRAM_SUB_BUCKET_BITS;
+
+    return (shift + 1) * HISTOGRAM_SUB_BUCKETS +
+        (value >> shift) - HISTOGRAM_SUB_BUCKETS;
+}
+
+/* Returns the highest value counted in a bucket */
+static uint64_t bucketHighValue(int idx)
+{
+    if (idx < HISTOGRAM_SUB_BUCKETS) {
+        return idx;
+    }
+
+    int shift = idx / HISTOGRAM_SUB_BUCKETS - 1;
+    uint64_t low = (uint64_t) (HISTOGRAM_SUB_BUCKETS + idx % HISTOGRAM_SUB_BUCKETS) << shift;
+
+    return low + ((uint64_t) 1 << shift) - 1;
+}
+
+void HistogramReset(Histogram *h)
+{
+    memset(h, 0, sizeof(*h));
+}
+
+void HistogramRecord(Histogram *h, uint64_t value)
+{
+    if (!h->count || value < h->min) {
+        h->min = value;
+    }
+    if (value > h->max) {
+        h->max = value;
+    }
+
+    h->count++;
+    h->sum += value;
+    h->buckets[bucketIndex(value)]++;
+}
+
+/* Returns the value below which the given percentage of recorded values
+ * fall, or 0 if the histogram is empty.
+ */
+uint64_t HistogramPercentile(Histogram *h, double percentile)
+{
+    if (!h->count) {
+        return 0;
+    }
+
+    unsigned long long target = ceil(h->count * percentile / 100.0);
+    if (target < 1) {
+        target = 1;
+    }
+
+    unsigned long long total = 0;
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        total += h->buckets[i];
+        if (total >= target && i < HISTOGRAM_BUCKETS - 1) {
+            uint64_t value = bucketHighValue(i);
+            return value < h->max ? value : h->max;
+        }
+    }
+
+    return h->max;
+}
+
+uint64_t HistogramMean(Histogram *h)
+{
+    return h->count ? h->sum / h->count : 0;
+}
@@ -8,16 +8,22 @@
  */
 
 #include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
 #include <string.h>
 #include <strings.h>
 #include <stdlib.h>
 #include <sys/uio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include <assert.h>
 
 #include "redisraft.h"
 
 #define ENTRY_CACHE_INIT_SIZE 512
+#define INDEX_MAP_INIT_LEN    4096
+#define LOG_FILE_BUFFER_SIZE  (64 * 1024)
 
 #ifdef RAFT_LOG_TRACE
 #  define TRACE_LOG_OP(fmt, ...) LOG_DEBUG("Log>>" fmt, ##__VA_ARGS__)
@@ -54,6 +60,24 @@ void EntryCacheFree(EntryCache *cache)
     RedisModule_Free(cache);
 }
 
+/* Enlarge cache if necessary */
+static void growEntryCache(EntryCache *cache)
+{
+    if (cache->len < cache->size) {
+        return;
+    }
+
+    unsigned long int new_size = cache->size * 2;
+    cache->ptrs = RedisModule_Realloc(cache->ptrs, new_size * sizeof(raft_entry_t *));
+
+    if (cache->start > 0) {
+        memmove(&cache->ptrs[cache->size], &cache->ptrs[0], cache->start * sizeof(raft_entry_t *));
+        memset(&cache->ptrs[0], 0, cache->start * sizeof(raft_entry_t *));
+    }
+
+    cache->size = new_size;
+}
+
 void EntryCacheAppend(EntryCache *cache, raft_entry_t *ety, raft_index_t idx)
 {
     if (!cache->start_idx) {
@@ -62,20 +86,31 @@ void EntryCacheAppend(EntryCache *cache, raft_entry_t *ety, raft_index_t idx)
 
     assert(cache->start_idx + cache->len == idx);
 
-    /* Enlrage cache if necessary */
-    if (cache->len == cache->size) {
-        unsigned long int new_size = cache->size * 2;
-        cache->ptrs = RedisModule_Realloc(cache->ptrs, new_size * sizeof(raft_entry_t *));
+    growEntryCache(cache);
 
-        if (cache->start > 0) {
-            memmove(&cache->ptrs[cache->size], &cache->ptrs[0], cache->start * sizeof(raft_entry_t *));
-            memset(&cache->ptrs[0], 0, cache->start * sizeof(raft_entry_t *));
-        }
+    cache->ptrs[(cache->start + cache->len) % cache->size] = ety;
+    cache->len++;
+    cache->entries_memsize += sizeof(raft_entry_t) + ety->data_len;
+    raft_entry_hold(ety);
+}
 
-        cache->size = new_size;
+/* Inserts an entry that precedes the first entry in the cache, e.g. one that
+ * was read from the log file.
+ */
+void EntryCachePrepend(EntryCache *cache, raft_entry_t *ety, raft_index_t idx)
+{
+    if (!cache->len) {
+        EntryCacheAppend(cache, ety, idx);
+        return;
     }
 
-    cache->ptrs[(cache->start + cache->len) % cache->size] = ety;
+    assert(cache->start_idx == idx + 1);
+
+    growEntryCache(cache);
+
+    cache->start = cache->start ? cache->start - 1 : cache->size - 1;
+    cache->ptrs[cache->start] = ety;
+    cache->start_idx = idx;
     cache->len++;
     cache->entries_memsize += sizeof(raft_entry_t) + ety->data_len;
     raft_entry_hold(ety);
@@ -166,12 +201,29 @@ long EntryCacheDeleteTail(EntryCache *cache, raft_index_t index)
     return deleted;
 }
 
-long EntryCacheCompact(EntryCache *cache, size_t max_memory)
+/* Evicts entries from the head of the cache until it uses no more than
+ * max_memory bytes.
+ *
+ * keep_idx is the lowest index that is still needed, e.g. by a follower that
+ * has not received it yet. It is recorded so entries from that index on that
+ * are read from the log file can be cached again (see getEntries()), and
+ * evicting such entries is accounted for in the cache stats.
+ *
+ * Returns the number of entries removed.
+ */
+long EntryCacheCompact(EntryCache *cache, size_t max_memory, raft_index_t keep_idx)
 {
     long deleted = 0;
 
+    cache->keep_idx = keep_idx;
+
     while (cache->len > 0 && cache->entries_memsize > max_memory) {
         raft_entry_t *ety = cache->ptrs[cache->start];
+
+        if (cache->start_idx >= keep_idx) {
+            cache->needed_evictions++;
+        }
+
         cache->entries_memsize -= sizeof(raft_entry_t) + ety->data_len;
         raft_entry_release(ety);
 
@@ -192,19 +244,6 @@ long EntryCacheCompact(EntryCache *cache, size_t max_memory)
     return deleted;
 }
 
-void RaftLogClose(RaftLog *log)
-{
-    if (log->file) {
-        fclose(log->file);
-        log->file = NULL;
-    }
-    if (log->idxfile) {
-        fclose(log->idxfile);
-        log->idxfile = NULL;
-    }
-    RedisModule_Free(log);
-}
-
 /*
  * Raw reading/writing of Raft log.
  */
@@ -298,12 +337,30 @@ typedef struct RawLogEntry {
     RawElement elements[];
 } RawLogEntry;
 
-static int readEncodedLength(RaftLog *log, char type, unsigned long *length)
+/* Version 2 log entries are stored as a fixed size binary header, followed
+ * by the entry data.  The CRC covers all header fields that precede it and
+ * the data.
+ */
+typedef struct EntryHeader {
+    uint64_t term;
+    int32_t id;
+    int32_t type;
+    uint32_t data_len;
+    uint32_t crc;
+} EntryHeader;
+
+static uint32_t calcEntryCRC(EntryHeader *hdr, const void *data)
+{
+    uint32_t crc = crc32c(0, hdr, offsetof(EntryHeader, crc));
+    return crc32c(crc, data, hdr->data_len);
+}
+
+static int readEncodedLength(FILE *file, char type, unsigned long *length)
 {
     char buf[128];
     char *eptr;
 
-    if (!fgets(buf, sizeof(buf), log->file)) {
+    if (!fgets(buf, sizeof(buf), file)) {
         return -1;
     }
 
@@ -337,12 +394,12 @@ static void freeRawLogEntry(RawLogEntry *entry)
     RedisModule_Free(entry);
 }
 
-static int readRawLogEntry(RaftLog *log, RawLogEntry **entry)
+static int readRawLogEntry(FILE *file, RawLogEntry **entry)
 {
     unsigned long num_elements;
     int i;
 
-    if (readEncodedLength(log, '*', &num_elements) < 0) {
+    if (readEncodedLength(file, '*', &num_elements) < 0) {
         return -1;
     }
 
@@ -352,14 +409,14 @@ static int readRawLogEntry(RaftLog *log, RawLogEntry **entry)
         unsigned long len;
         char *ptr;
 
-        if (readEncodedLength(log, '$', &len) < 0) {
+        if (readEncodedLength(file, '$', &len) < 0) {
             goto error;
         }
         (*entry)->elements[i].len = len;
         (*entry)->elements[i].ptr = ptr = RedisModule_Alloc(len + 2);
 
         /* Read extra CRLF */
-        if (fread(ptr, 1, len + 2, log->file) != len + 2) {
+        if (fread(ptr, 1, len + 2, file) != len + 2) {
             goto error;
         }
         ptr[len] = '\0';
@@ -374,18 +431,97 @@ error:
     return -1;
 }
 
-static int updateIndex(RaftLog *log, raft_index_t index, off_t offset)
+/* The log is stored in segment files. Every segment holds consecutive
+ * entries, starting at the index that is part of its file name, and once the
+ * last segment reaches log->segment_size a new one is started.
+ *
+ * The log file itself (log->filename) holds a fixed size header with the log
+ * state, followed by a SEGMENT record for every segment. It is small, and
+ * rewritten (to a temporary file which is then renamed) whenever segments are
+ * added or removed. This way, log compaction following a snapshot only has to
+ * remove the segments that hold no entries following the snapshot.
+ *
+ * Logs created by older versions (version 1 and 2) have no segments. Their
+ * entries follow the header, and they are converted to a segmented log when
+ * the entries are loaded.
+ */
+
+/* The index file of a segment is an array of entry offsets, indexed by the
+ * entry's index relative to the first index of the segment.  It is memory
+ * mapped, so lookups and updates do not involve any I/O calls.
+ *
+ * The index is not synced explicitly; it is always rebuilt when entries are
+ * loaded, unless it was written by the same process (RAFTLOG_KEEP_INDEX).
+ */
+
+static void unmapIndex(RaftLogSegment *seg)
+{
+    if (seg->idxmap) {
+        munmap(seg->idxmap, seg->idxmap_len * sizeof(off_t));
+        seg->idxmap = NULL;
+        seg->idxmap_len = 0;
+    }
+}
+
+/* Maps the index file so that it holds at least the specified number of
+ * offsets, growing it if necessary.
+ */
+static int mapIndex(RaftLogSegment *seg, size_t len)
+{
+    int fd = fileno(seg->idxfile);
+    size_t new_len = seg->idxmap_len ? seg->idxmap_len : INDEX_MAP_INIT_LEN;
+    struct stat st;
+
+    while (new_len < len) {
+        new_len *= 2;
+    }
+
+    if (fstat(fd, &st) < 0) {
+        return -1;
+    }
+    if (st.st_size < new_len * sizeof(off_t) &&
+        ftruncate(fd, new_len * sizeof(off_t)) < 0) {
+        return -1;
+    }
+
+    unmapIndex(seg);
+
+    void *map = mmap(NULL, new_len * sizeof(off_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        LOG_ERROR("Raft Log: failed to map index: %s\n", strerror(errno));
+        return -1;
+    }
+
+    seg->idxmap = map;
+    seg->idxmap_len = new_len;
+
+    return 0;
+}
+
+static int updateIndex(RaftLogSegment *seg, raft_index_t index, off_t offset)
 {
-    long relidx = index - log->snapshot_last_idx;
+    unsigned long relidx = index - seg->first_idx;
 
-    if (fseek(log->idxfile, sizeof(off_t) * relidx, SEEK_SET) < 0 ||
-            fwrite(&offset, sizeof(off_t), 1, log->idxfile) != 1) {
+    if (relidx >= seg->idxmap_len && mapIndex(seg, relidx + 1) < 0) {
         return -1;
     }
 
+    seg->idxmap[relidx] = offset;
     return 0;
 }
 
+/* Returns the offset of an entry in the segment, or -1 on error. */
+static off_t lookupIndex(RaftLogSegment *seg, raft_index_t index)
+{
+    unsigned long relidx = index - seg->first_idx;
+
+    if (relidx >= seg->idxmap_len && mapIndex(seg, relidx + 1) < 0) {
+        return -1;
+    }
+
+    return seg->idxmap[relidx];
+}
+
 static char *getIndexFilename(const char *filename)
 {
     int idx_filename_len = strlen(filename) + 10;
@@ -394,46 +530,192 @@ static char *getIndexFilename(const char *filename)
     return idx_filename;
 }
 
-static RaftLog *prepareLog(const char *filename, RedisRaftConfig *config, int flags)
+static char *getSegmentFilename(const char *filename, raft_index_t first_idx)
 {
-    FILE *file = fopen(filename, "a+");
-    if (!file) {
+    int seg_filename_len = strlen(filename) + 30;
+    char *seg_filename = RedisModule_Alloc(seg_filename_len);
+    snprintf(seg_filename, seg_filename_len - 1, "%s.%020lu", filename, (unsigned long) first_idx);
+    return seg_filename;
+}
+
+static void removeSegmentFiles(const char *filename, raft_index_t first_idx)
+{
+    char *seg_filename = getSegmentFilename(filename, first_idx);
+    char *idx_filename = getIndexFilename(seg_filename);
+
+    unlink(seg_filename);
+    unlink(idx_filename);
+
+    RedisModule_Free(idx_filename);
+    RedisModule_Free(seg_filename);
+}
+
+/* Opens the files of a segment and adds it after the last segment of the log.
+ * If create is true, the segment files are created or truncated.
+ */
+static RaftLogSegment *addSegment(RaftLog *log, raft_index_t first_idx, bool create, int flags)
+{
+    char *filename = getSegmentFilename(log->filename, first_idx);
+    char *idx_filename = getIndexFilename(filename);
+    FILE *file = NULL;
+    FILE *idxfile = NULL;
+    struct stat st;
+
+    /* Entries are always appended, even if the file was read from */
+    int fd = open(filename, O_RDWR | O_APPEND | (create ? O_CREAT | O_TRUNC : 0), 0644);
+    if (fd < 0 || !(file = fdopen(fd, "a+"))) {
         LOG_ERROR("Raft Log: %s: %s\n", filename, strerror(errno));
-        return NULL;
+        if (fd >= 0) {
+            close(fd);
+        }
+        goto error;
     }
+    /* Large buffer for sequential reads */
+    setvbuf(file, NULL, _IOFBF, LOG_FILE_BUFFER_SIZE);
 
-    /* Index file */
-    char *idx_filename = getIndexFilename(filename);
-    FILE *idxfile = fopen(idx_filename, (flags & RAFTLOG_KEEP_INDEX) ? "r+" : "w+");
+    idxfile = fopen(idx_filename, (!create && (flags & RAFTLOG_KEEP_INDEX)) ? "r+" : "w+");
     if (!idxfile) {
         LOG_ERROR("Raft Log: %s: %s\n", idx_filename, strerror(errno));
-        RedisModule_Free(idx_filename);
+        goto error;
+    }
+
+    if (fstat(fd, &st) < 0) {
+        LOG_ERROR("Raft Log: %s: %s\n", filename, strerror(errno));
+        goto error;
+    }
+
+    RedisModule_Free(idx_filename);
+
+    log->segments = RedisModule_Realloc(log->segments,
+            sizeof(RaftLogSegment) * (log->num_segments + 1));
+    RaftLogSegment *seg = &log->segments[log->num_segments++];
+    memset(seg, 0, sizeof(*seg));
+
+    seg->first_idx = first_idx;
+    seg->file_size = st.st_size;
+    seg->filename = filename;
+    seg->file = file;
+    seg->idxfile = idxfile;
+
+    return seg;
+
+error:
+    if (idxfile) {
+        fclose(idxfile);
+    }
+    if (file) {
         fclose(file);
-        return NULL;
     }
     RedisModule_Free(idx_filename);
+    RedisModule_Free(filename);
+    return NULL;
+}
 
-    /* Initialize struct */
-    RaftLog *log = RedisModule_Calloc(1, sizeof(RaftLog));
-    log->file = file;
-    log->idxfile = idxfile;
-    log->filename = filename;
+static void closeSegment(RaftLogSegment *seg, bool remove)
+{
+    if (seg->file) {
+        fclose(seg->file);
+        seg->file = NULL;
+    }
+    if (seg->idxfile) {
+        unmapIndex(seg);
+        fclose(seg->idxfile);
+        seg->idxfile = NULL;
+    }
+    if (remove) {
+        char *idx_filename = getIndexFilename(seg->filename);
+        unlink(seg->filename);
+        unlink(idx_filename);
+        RedisModule_Free(idx_filename);
+    }
 
-    /* Config */
-    if (config) {
-        log->fsync = config->raft_log_fsync;
-    } else {
-        log->fsync = true;
+    RedisModule_Free(seg->filename);
+    seg->filename = NULL;
+}
+
+/* Closes and removes num segments, starting with the one at position first. */
+static void dropSegments(RaftLog *log, int first, int num)
+{
+    int i;
+
+    for (i = first; i < first + num; i++) {
+        closeSegment(&log->segments[i], true);
     }
 
-    return log;
+    memmove(&log->segments[first], &log->segments[first + num],
+            sizeof(RaftLogSegment) * (log->num_segments - first - num));
+    log->num_segments -= num;
+}
+
+static RaftLogSegment *lastSegment(RaftLog *log)
+{
+    return log->num_segments ? &log->segments[log->num_segments - 1] : NULL;
+}
+
+/* Returns the position of the segment that holds the specified index, which is
+ * the last one that begins at or before it.
+ */
+static int findSegment(RaftLog *log, raft_index_t idx)
+{
+    int lo = 0;
+    int hi = log->num_segments - 1;
+
+    while (lo < hi) {
+        int mid = (lo + hi + 1) / 2;
+        if (log->segments[mid].first_idx <= idx) {
+            lo = mid;
+        } else {
+            hi = mid - 1;
+        }
+    }
+
+    return lo;
+}
+
+/* Returns the index of the last entry of a segment */
+static raft_index_t segmentLastIdx(RaftLog *log, RaftLogSegment *seg)
+{
+    if (seg == lastSegment(log)) {
+        return log->index;
+    }
+
+    return seg[1].first_idx - 1;
+}
+
+/* Returns the size of all entries that follow the snapshot.  Entries included
+ * in the snapshot may still exist in the first segments.
+ */
+static size_t calcFileSize(RaftLog *log)
+{
+    size_t size = 0;
+    int i;
+
+    for (i = 0; i < log->num_segments; i++) {
+        size += log->segments[i].file_size;
+    }
+
+    if (!log->num_segments || log->snapshot_last_idx < log->segments[0].first_idx) {
+        return size;
+    }
+
+    raft_index_t idx = log->snapshot_last_idx + 1;
+    int pos = findSegment(log, idx);
+    for (i = 0; i < pos; i++) {
+        size -= log->segments[i].file_size;
+    }
+
+    RaftLogSegment *seg = &log->segments[pos];
+    off_t offset = idx <= log->index ? lookupIndex(seg, idx) : -1;
+    size -= offset >= 0 ? offset : seg->file_size;
+
+    return size;
 }
 
 int writeLogHeader(FILE *logfile, RaftLog *log)
 {
     if (writeBegin(logfile, 8) < 0 ||
         writeBuffer(logfile, "RAFTLOG", 7) < 0 ||
-        writeUnsignedInteger(logfile, RAFTLOG_VERSION, 4) < 0 ||
+        writeUnsignedInteger(logfile, log->version, 4) < 0 ||
         writeBuffer(logfile, log->dbid, strlen(log->dbid)) < 0 ||
         writeUnsignedInteger(logfile, log->node_id, 20) < 0 ||
         writeUnsignedInteger(logfile, log->snapshot_last_term, 20) < 0 ||
@@ -447,14 +729,18 @@ int writeLogHeader(FILE *logfile, RaftLog *log)
     return 0;
 }
 
+/* Updates the header in place. The header has a fixed size, so the segments
+ * list that follows it is not affected.
+ *
+ * Unlike entries, the header is synced right away and not in the background:
+ * the Raft library replies to RequestVote and AppendEntries right after
+ * changing the term or vote, so they must be durable by then.  They only
+ * change on elections, so this does not slow down replication.
+ */
 int updateLogHeader(RaftLog *log)
 {
     int ret;
 
-    /* Avoid same file open twice */
-    fclose(log->file);
-    log->file = NULL;
-
     FILE *file = fopen(log->filename, "r+");
     if (!file) {
         PANIC("Failed to update log header: %s: %s",
@@ -464,25 +750,151 @@ int updateLogHeader(RaftLog *log)
     ret = writeLogHeader(file, log);
     fclose(file);
 
-    /* Reopen */
-    log->file = fopen(log->filename, "a+");
-    if (!log->file) {
-        PANIC("Failed to reopen log file: %s: %s",
-                log->filename, strerror(errno));
+    return ret;
+}
+
+/* Writes the log header and the specified segments to the log file.  A
+ * temporary file is renamed, so the previous list remains intact on failure.
+ */
+static int writeLogFile(RaftLog *log, int first_segment, int num_segments)
+{
+    char tmp_filename[strlen(log->filename) + 10];
+    int i;
+
+    snprintf(tmp_filename, sizeof(tmp_filename) - 1, "%s.tmp", log->filename);
+
+    FILE *file = fopen(tmp_filename, "w");
+    if (!file) {
+        LOG_ERROR("Raft Log: %s: %s\n", tmp_filename, strerror(errno));
+        return -1;
+    }
+
+    if (writeLogHeader(file, log) < 0) {
+        goto error;
+    }
+
+    for (i = first_segment; i < first_segment + num_segments; i++) {
+        if (writeBegin(file, 2) < 0 ||
+            writeBuffer(file, "SEGMENT", 7) < 0 ||
+            writeUnsignedInteger(file, log->segments[i].first_idx, 20) < 0) {
+            goto error;
+        }
+    }
+
+    if (writeEnd(file, log->fsync) < 0) {
+        goto error;
+    }
+
+    fclose(file);
+
+    if (rename(tmp_filename, log->filename) < 0) {
+        LOG_ERROR("Raft Log: failed to rename %s to %s: %s\n",
+                tmp_filename, log->filename, strerror(errno));
+        unlink(tmp_filename);
+        return -1;
+    }
+
+    return 0;
+
+error:
+    LOG_ERROR("Raft Log: failed to write %s: %s\n", tmp_filename, strerror(errno));
+    fclose(file);
+    unlink(tmp_filename);
+    return -1;
+}
+
+/* Reads a SEGMENT record of the log file.
+ *
+ * Returns 1 if a record was read, 0 at the end of the file or -1 if the
+ * record is invalid.
+ */
+static int readSegmentRecord(FILE *file, raft_index_t *first_idx)
+{
+    RawLogEntry *re;
+    int ret = -1;
+
+    int c = fgetc(file);
+    if (c == EOF) {
+        return 0;
+    }
+    ungetc(c, file);
+
+    if (readRawLogEntry(file, &re) < 0) {
+        return -1;
+    }
+
+    if (re->num_elements == 2 && !strcmp(re->elements[0].ptr, "SEGMENT")) {
+        char *eptr;
+        *first_idx = strtoul(re->elements[1].ptr, &eptr, 10);
+        if (*eptr == '\0') {
+            ret = 1;
+        }
     }
 
+    freeRawLogEntry(re);
     return ret;
 }
 
+/* An asynchronous sync in progress, see RaftLogSyncAsync() */
+typedef struct LogSyncReq {
+    uv_fs_t req;
+    RaftLog *log;               /* NULL if the log was closed meanwhile */
+    uv_file fd;
+    raft_index_t idx;           /* Last entry covered by the sync */
+    unsigned long epoch;        /* log->sync_epoch when started */
+    uint64_t start_time;
+} LogSyncReq;
+
+static RaftLog *prepareLog(const char *filename, RedisRaftConfig *config)
+{
+    RaftLog *log = RedisModule_Calloc(1, sizeof(RaftLog));
+    log->filename = filename;
+
+    /* Config */
+    if (config) {
+        log->fsync = config->raft_log_fsync;
+        log->segment_size = config->raft_log_segment_size;
+        log->load_threads = config->raft_log_load_threads;
+    } else {
+        log->fsync = true;
+        log->segment_size = REDIS_RAFT_DEFAULT_LOG_SEGMENT_SIZE;
+        log->load_threads = REDIS_RAFT_DEFAULT_LOG_LOAD_THREADS;
+    }
+
+    return log;
+}
+
+void RaftLogClose(RaftLog *log)
+{
+    int i;
+
+    if (log->unsynced_entries || log->sealed_sync) {
+        RaftLogSync(log);
+    }
+
+    if (log->sync_req) {
+        log->sync_req->log = NULL;
+    }
+
+    for (i = 0; i < log->num_segments; i++) {
+        closeSegment(&log->segments[i], false);
+    }
+
+    RedisModule_Free(log->segments);
+    RedisModule_Free(log);
+}
+
 RaftLog *RaftLogCreate(const char *filename, const char *dbid, raft_term_t snapshot_term,
         raft_index_t snapshot_index, raft_term_t current_term, raft_node_id_t last_vote, RedisRaftConfig *config)
 {
-    RaftLog *log = prepareLog(filename, config, 0);
-    if (!log) {
-        return NULL;
-    }
+    /* Remove the segments of an existing log */
+    RaftLogRemoveFiles(filename);
+
+    RaftLog *log = prepareLog(filename, config);
 
+    log->version = RAFTLOG_VERSION;
     log->index = log->snapshot_last_idx = snapshot_index;
+    log->synced_idx = snapshot_index;
     log->snapshot_last_term = snapshot_term;
     log->term = current_term;
     log->vote = last_vote;
@@ -491,17 +903,15 @@ RaftLog *RaftLogCreate(const char *filename, const char *dbid, raft_term_t snaps
     log->dbid[RAFT_DBID_LEN] = '\0';
     log->node_id = config->id;
 
-    /* Truncate */
-    ftruncate(fileno(log->file), 0);
-    ftruncate(fileno(log->idxfile), 0);
-
     /* Write log start */
-    if (writeLogHeader(log->file, log) < 0) {
+    if (!addSegment(log, snapshot_index + 1, true, 0) ||
+        writeLogFile(log, 0, log->num_segments) < 0) {
         LOG_ERROR("Failed to create Raft log: %s: %s\n", filename, strerror(errno));
         RaftLogClose(log);
-        log = NULL;
+        return NULL;
     }
 
+    log->file_size = 0;
     return log;
 }
 
@@ -550,10 +960,11 @@ static int handleHeader(RaftLog *log, RawLogEntry *re)
 
     char *eptr;
     unsigned long ver = strtoul(re->elements[1].ptr, &eptr, 10);
-    if (*eptr != '\0' || ver != RAFTLOG_VERSION) {
+    if (*eptr != '\0' || ver < 1 || ver > RAFTLOG_VERSION) {
         LOG_ERROR("Invalid Raft header version: %lu\n", ver);
         return -1;
     }
+    log->version = ver;
 
     if (strlen(re->elements[2].ptr) > RAFT_DBID_LEN) {
         LOG_ERROR("Invalid Raft log dbid: %s\n", re->elements[2].ptr);
@@ -594,26 +1005,101 @@ static int handleHeader(RaftLog *log, RawLogEntry *re)
     return 0;
 }
 
-RaftLog *RaftLogOpen(const char *filename, RedisRaftConfig *config, int flags)
+/* Reads a version 1 (RESP) entry from the current file position.
+ */
+static int readEntryV1(FILE *file, raft_entry_t **entry)
 {
-    RaftLog *log = prepareLog(filename, config, flags);
-    RawLogEntry *e = NULL;
+    RawLogEntry *re;
 
-    if (!log) {
-        return NULL;
+    if (readRawLogEntry(file, &re) < 0) {
+        return 0;
     }
 
-    /* Gracefully skip an empty file */
-    fseek(log->file, 0L, SEEK_END);
-    if (!ftell(log->file)) {
-        goto error;
+    if (!re->num_elements || strcasecmp(re->elements[0].ptr, "ENTRY")) {
+        LOG_ERROR("Invalid log entry: %s\n",
+                re->num_elements ? (char *) re->elements[0].ptr : "");
+        freeRawLogEntry(re);
+        return -1;
     }
 
-    /* Read start */
-    fseek(log->file, 0L, SEEK_SET);
+    *entry = parseRaftLogEntry(re);
+    freeRawLogEntry(re);
 
-    if (readRawLogEntry(log, &e) < 0) {
-        LOG_ERROR("Failed to read Raft log: %s\n", errno ? strerror(errno) : "invalid data");
+    return *entry ? 1 : -1;
+}
+
+/* Reads a version 2 (binary) entry from the current file position.  This is
+ * also the format of entries in segments.
+ */
+static int readEntryV2(FILE *file, size_t file_size, raft_entry_t **entry)
+{
+    EntryHeader hdr;
+
+    if (fread(&hdr, sizeof(hdr), 1, file) != 1) {
+        return 0;
+    }
+
+    /* A bogus length would otherwise make us allocate and read garbage */
+    if (hdr.data_len > file_size) {
+        LOG_ERROR("Invalid log entry: bad length %u\n", hdr.data_len);
+        return -1;
+    }
+
+    raft_entry_t *e = raft_entry_new(hdr.data_len);
+    if (fread(e->data, 1, hdr.data_len, file) != hdr.data_len) {
+        raft_entry_release(e);
+        return 0;
+    }
+
+    if (calcEntryCRC(&hdr, e->data) != hdr.crc) {
+        LOG_ERROR("Invalid log entry: CRC mismatch\n");
+        raft_entry_release(e);
+        return -1;
+    }
+
+    e->term = hdr.term;
+    e->id = hdr.id;
+    e->type = hdr.type;
+
+    *entry = e;
+    return 1;
+}
+
+/* Reads an entry from the current position of a segment.
+ *
+ * Returns 1 if an entry was read, 0 if the end of the segment was reached
+ * (even if in the middle of an entry) or -1 if the entry is invalid.
+ */
+static int readSegmentEntry(RaftLogSegment *seg, raft_entry_t **entry)
+{
+    return readEntryV2(seg->file, seg->file_size, entry);
+}
+
+RaftLog *RaftLogOpen(const char *filename, RedisRaftConfig *config, int flags)
+{
+    RaftLog *log = NULL;
+    RawLogEntry *e = NULL;
+
+    FILE *file = fopen(filename, "r");
+    if (!file) {
+        if (errno != ENOENT) {
+            LOG_ERROR("Raft Log: %s: %s\n", filename, strerror(errno));
+        }
+        return NULL;
+    }
+
+    /* Gracefully skip an empty file */
+    fseek(file, 0L, SEEK_END);
+    if (!ftell(file)) {
+        goto error;
+    }
+
+    /* Read start */
+    fseek(file, 0L, SEEK_SET);
+
+    log = prepareLog(filename, config);
+    if (readRawLogEntry(file, &e) < 0) {
+        LOG_ERROR("Failed to read Raft log: %s\n", errno ? strerror(errno) : "invalid data");
         goto error;
     }
 
@@ -621,19 +1107,44 @@ RaftLog *RaftLogOpen(const char *filename, RedisRaftConfig *config, int flags)
         goto error;
     }
 
+    /* Older logs have no segments, entries follow the header */
+    if (log->version >= RAFTLOG_SEGMENTS_VERSION) {
+        raft_index_t first_idx;
+        int ret;
+
+        while ((ret = readSegmentRecord(file, &first_idx)) > 0) {
+            if (!addSegment(log, first_idx, false, flags)) {
+                goto error;
+            }
+        }
+
+        if (ret < 0 || !log->num_segments) {
+            LOG_ERROR("Failed to read Raft log: %s: invalid segments list\n", filename);
+            goto error;
+        }
+
+        log->file_size = calcFileSize(log);
+    }
+
     freeRawLogEntry(e);
+    fclose(file);
     return log;
 
 error:
     if (e != NULL) {
         freeRawLogEntry(e);
     }
-    RaftLogClose(log);
+    if (log != NULL) {
+        RaftLogClose(log);
+    }
+    fclose(file);
     return NULL;
 }
 
 RRStatus RaftLogReset(RaftLog *log, raft_index_t index, raft_term_t term)
 {
+    int i;
+
     log->index = log->snapshot_last_idx = index;
     log->snapshot_last_term = term;
     if (log->term > term) {
@@ -641,137 +1152,509 @@ RRStatus RaftLogReset(RaftLog *log, raft_index_t index, raft_term_t term)
         log->vote = -1;
     }
 
-    if (ftruncate(fileno(log->file), 0) < 0 ||
-        ftruncate(fileno(log->idxfile), 0) < 0 ||
-        writeLogHeader(log->file, log) < 0) {
+    log->unsynced_entries = 0;
+    log->num_entries = 0;
+    log->file_size = 0;
+
+    /* Entries are removed, see RaftLogSyncAsync() */
+    log->synced_idx = index;
+    log->sync_epoch++;
+
+    /* The log is rewritten from scratch, so it's safe to upgrade its format */
+    log->version = RAFTLOG_VERSION;
+
+    /* Old segments are only removed once the log file no longer lists them.
+     * A segment that begins at the same index is simply truncated.
+     */
+    int num_old = log->num_segments;
+    raft_index_t old_first_idx[num_old > 0 ? num_old : 1];
+
+    for (i = 0; i < num_old; i++) {
+        old_first_idx[i] = log->segments[i].first_idx;
+        closeSegment(&log->segments[i], false);
+    }
+    log->num_segments = 0;
+
+    if (!addSegment(log, index + 1, true, 0) ||
+        writeLogFile(log, 0, log->num_segments) < 0) {
 
         return RR_ERROR;
     }
 
+    for (i = 0; i < num_old; i++) {
+        if (old_first_idx[i] != index + 1) {
+            removeSegmentFiles(log->filename, old_first_idx[i]);
+        }
+    }
+
     return RR_OK;
 }
 
-int RaftLogLoadEntries(RaftLog *log, int (*callback)(void *, raft_entry_t *, raft_index_t), void *callback_arg)
+/* Writes an entry to a segment using a single writev() call.  The segment file
+ * is opened for appending, so data always goes to the end of the file and
+ * seg->file_size tracks it.
+ */
+static RRStatus writeSegmentEntry(RaftLog *log, RaftLogSegment *seg, raft_entry_t *entry)
+{
+    EntryHeader hdr = {
+        .term = entry->term,
+        .id = entry->id,
+        .type = entry->type,
+        .data_len = entry->data_len
+    };
+    hdr.crc = calcEntryCRC(&hdr, entry->data);
+
+    struct iovec iov[2] = {
+        { .iov_base = &hdr, .iov_len = sizeof(hdr) },
+        { .iov_base = entry->data, .iov_len = entry->data_len }
+    };
+
+    /* Drop buffered data, so following reads see the new entry */
+    if (fflush(seg->file) < 0) {
+        return RR_ERROR;
+    }
+
+    off_t offset = seg->file_size;
+    ssize_t len = sizeof(hdr) + entry->data_len;
+    ssize_t n = writev(fileno(seg->file), iov, 2);
+    if (n != len) {
+        /* Don't leave a partial entry behind */
+        if (n > 0) {
+            ftruncate(fileno(seg->file), seg->file_size);
+        }
+        return RR_ERROR;
+    }
+
+    seg->file_size += len;
+    log->file_size += len;
+    log->index++;
+    if (updateIndex(seg, log->index, offset) < 0) {
+        return RR_ERROR;
+    }
+
+    return RR_OK;
+}
+
+/* Entries are written to segments directly and not through stdio, so there
+ * is nothing to flush.
+ */
+static int syncSegment(RaftLog *log, RaftLogSegment *seg)
+{
+    if (log->fsync && fsync(fileno(seg->file)) < 0) {
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Loads the entries of a log created by an older version, which follow the
+ * header in the log file, and converts it to a segmented log.
+ */
+static int loadLegacyEntries(RaftLog *log, int (*callback)(void *, raft_entry_t *, raft_index_t), void *callback_arg)
 {
     int ret = 0;
 
-    if (fseek(log->file, 0, SEEK_SET) < 0) {
+    FILE *file = fopen(log->filename, "r");
+    if (!file) {
+        LOG_ERROR("Raft Log: %s: %s\n", log->filename, strerror(errno));
         return -1;
     }
+    setvbuf(file, NULL, _IOFBF, LOG_FILE_BUFFER_SIZE);
 
-    log->term = 1;
-    log->index = 0;
+    fseek(file, 0, SEEK_END);
+    size_t file_size = ftell(file);
+    fseek(file, 0, SEEK_SET);
 
     /* Read Header */
     RawLogEntry *re = NULL;
-    if (readRawLogEntry(log, &re) < 0 || handleHeader(log, re) < 0)  {
+    if (readRawLogEntry(file, &re) < 0 || handleHeader(log, re) < 0)  {
         freeRawLogEntry(re);
+        fclose(file);
         LOG_INFO("Failed to read Raft log header");
         return -1;
     }
     freeRawLogEntry(re);
 
-    /* Read Entries */
+    RaftLogSegment *seg = addSegment(log, log->snapshot_last_idx + 1, true, 0);
+    if (!seg) {
+        fclose(file);
+        return -1;
+    }
+
+    /* Read Entries.  An entry that was only partially written before a crash
+     * is discarded.
+     */
     do {
         raft_entry_t *e = NULL;
 
-        long offset = ftell(log->file);
-        if (readRawLogEntry(log, &re) < 0 || !re->num_elements) {
+        int n = log->version >= 2 ? readEntryV2(file, file_size, &e) : readEntryV1(file, &e);
+        if (n < 0) {
+            ret = -1;
+            break;
+        } else if (!n) {
             break;
         }
 
-        if (!strcasecmp(re->elements[0].ptr, "ENTRY")) {
-            e = parseRaftLogEntry(re);
-            if (!e) {
-                freeRawLogEntry(re);
-                ret = -1;
-                break;
-            }
-            log->index++;
-            ret++;
-
-            updateIndex(log, log->index, offset);
-        } else {
-            LOG_ERROR("Invalid log entry: %s\n", (char *) re->elements[0].ptr);
-            freeRawLogEntry(re);
-
+        if (writeSegmentEntry(log, seg, e) != RR_OK) {
+            LOG_ERROR("Failed to convert Raft log: %s\n", strerror(errno));
+            raft_entry_release(e);
             ret = -1;
             break;
         }
 
-        int cb_ret = 0;
+        ret++;
+
         if (callback) {
             callback(callback_arg, e, log->index);
         }
 
-        freeRawLogEntry(re);
         raft_entry_release(e);
+    } while(1);
+
+    fclose(file);
+
+    log->version = RAFTLOG_VERSION;
+    if (ret < 0 ||
+        syncSegment(log, seg) < 0 ||
+        writeLogFile(log, 0, log->num_segments) < 0) {
+
+        dropSegments(log, 0, log->num_segments);
+        return -1;
+    }
+
+    char *idx_filename = getIndexFilename(log->filename);
+    unlink(idx_filename);
+    RedisModule_Free(idx_filename);
+
+    LOG_INFO("Raft log: converted %s to log version %d\n", log->filename, RAFTLOG_VERSION);
+
+    log->num_entries = ret;
+    return ret;
+}
 
-        if (cb_ret < 0) {
-            ret = cb_ret;
+/* Segments are parsed (read, CRC verified and decoded) by worker threads,
+ * while entries are passed to the callback in order by the calling thread.
+ * Up to log->load_threads segments are parsed at the same time, which also
+ * bounds the memory held by decoded entries that were not passed on yet.
+ */
+typedef struct SegmentLoad {
+    RaftLog *log;
+    RaftLogSegment *seg;
+    uv_thread_t thread;
+    bool running;               /* Thread was started and not joined yet */
+    int status;                 /* 0 on success, -1 on invalid entry */
+    raft_index_t count;         /* Entries in segment */
+    long end_offset;            /* Offset following the last complete entry */
+    raft_index_t first_idx;     /* Index of first entry in entries[] */
+    int num_entries;            /* Entries that follow the snapshot */
+    int entries_size;
+    raft_entry_t **entries;
+} SegmentLoad;
+
+/* Reads all entries of a segment and rebuilds its index.  Entries included in
+ * the snapshot are skipped, others are kept for releaseSegmentEntries().
+ *
+ * Every segment has its own file and index, so segments can be parsed
+ * concurrently.
+ */
+static void parseSegment(void *arg)
+{
+    SegmentLoad *load = arg;
+    RaftLogSegment *seg = load->seg;
+    raft_index_t idx = seg->first_idx;
+    long offset;
+
+    load->first_idx = load->log->snapshot_last_idx + 1;
+    if (load->first_idx < seg->first_idx) {
+        load->first_idx = seg->first_idx;
+    }
+
+    if (fseek(seg->file, 0, SEEK_SET) < 0) {
+        load->status = -1;
+        return;
+    }
+
+    do {
+        raft_entry_t *e = NULL;
+
+        offset = ftell(seg->file);
+
+        int n = readSegmentEntry(seg, &e);
+        if (n < 0) {
+            load->status = -1;
+            break;
+        } else if (!n) {
             break;
         }
+
+        updateIndex(seg, idx, offset);
+
+        if (idx < load->first_idx) {
+            raft_entry_release(e);
+        } else {
+            if (load->num_entries == load->entries_size) {
+                load->entries_size = load->entries_size ? load->entries_size * 2 : 64;
+                load->entries = RedisModule_Realloc(load->entries,
+                        sizeof(raft_entry_t *) * load->entries_size);
+            }
+            load->entries[load->num_entries++] = e;
+        }
+
+        idx++;
     } while(1);
 
-    if (ret > 0) {
-        log->num_entries = ret;
+    load->count = idx - seg->first_idx;
+    load->end_offset = offset;
+}
+
+static void startSegmentLoad(SegmentLoad *load, bool use_thread)
+{
+    if (use_thread && !uv_thread_create(&load->thread, parseSegment, load)) {
+        load->running = true;
+        return;
     }
-    return ret;
+
+    parseSegment(load);
 }
 
-RRStatus RaftLogWriteEntry(RaftLog *log, raft_entry_t *entry)
+static void finishSegmentLoad(SegmentLoad *load)
 {
-    size_t written = 0;
-    int n;
+    if (load->running) {
+        uv_thread_join(&load->thread);
+        load->running = false;
+    }
+}
 
-    if ((n = writeBegin(log->file, 5)) < 0) {
-        return RR_ERROR;
+/* Passes the parsed entries of a segment to the callback, in order. */
+static void releaseSegmentEntries(RaftLog *log, SegmentLoad *load,
+                                  int (*callback)(void *, raft_entry_t *, raft_index_t), void *callback_arg)
+{
+    for (int i = 0; i < load->num_entries; i++) {
+        raft_entry_t *e = load->entries[i];
+
+        log->index = load->first_idx + i;
+        log->num_entries++;
+
+        if (callback) {
+            callback(callback_arg, e, log->index);
+        }
+
+        raft_entry_release(e);
     }
-    written += n;
-    if ((n = writeBuffer(log->file, "ENTRY", 5)) < 0) {
-        return RR_ERROR;
+
+    RedisModule_Free(load->entries);
+    load->entries = NULL;
+    load->num_entries = 0;
+}
+
+/* Validates a parsed segment and discards an incomplete entry at its end.
+ *
+ * Returns 0 on success, or -1 on error.
+ */
+static int checkSegmentLoad(RaftLogSegment *seg, SegmentLoad *load, bool last)
+{
+    if (load->status < 0) {
+        return -1;
     }
-    written += n;
-    if ((n = writeUnsignedInteger(log->file, entry->term, 0)) < 0) {
-        return RR_ERROR;
+
+    /* An entry that was only partially written before a crash is discarded,
+     * so new entries are appended right after the last complete one.  This
+     * may only happen in the last segment, as others are synced before a new
+     * segment is started.
+     */
+    if (load->end_offset < seg->file_size) {
+        if (!last) {
+            LOG_ERROR("Raft log: incomplete entry in segment %s\n", seg->filename);
+            return -1;
+        }
+
+        LOG_INFO("Raft log: discarding incomplete entry at offset %ld\n", load->end_offset);
+        if (ftruncate(fileno(seg->file), load->end_offset) < 0) {
+            LOG_ERROR("Failed to truncate Raft log: %s\n", strerror(errno));
+            return -1;
+        }
+        seg->file_size = load->end_offset;
     }
-    written += n;
-    if ((n = writeUnsignedInteger(log->file, entry->id, 0)) < 0) {
-        return RR_ERROR;
+
+    return 0;
+}
+
+int RaftLogLoadEntries(RaftLog *log, int (*callback)(void *, raft_entry_t *, raft_index_t), void *callback_arg)
+{
+    int ret = 0;
+    int i;
+
+    if (log->version < RAFTLOG_SEGMENTS_VERSION) {
+        ret = loadLegacyEntries(log, callback, callback_arg);
+        log->synced_idx = log->index;
+        return ret;
     }
-    written += n;
-    if ((n = writeUnsignedInteger(log->file, entry->type, 0)) < 0) {
-        return RR_ERROR;
+
+    log->index = log->snapshot_last_idx;
+    log->num_entries = 0;
+
+    /* The first segment may begin before the snapshot, and every segment must
+     * follow the previous one.
+     */
+    raft_index_t next_idx = log->segments[0].first_idx;
+    if (next_idx > log->snapshot_last_idx + 1) {
+        LOG_ERROR("Raft log: first segment %s does not follow snapshot index %ld\n",
+                log->segments[0].filename, log->snapshot_last_idx);
+        return -1;
     }
-    written += n;
-    if ((n = writeBuffer(log->file, entry->data, entry->data_len)) < 0) {
-        return RR_ERROR;
+
+    int num_loads = log->num_segments;
+    int window = log->load_threads < num_loads ? log->load_threads : num_loads;
+    bool use_threads = window > 1;
+    if (window < 1) {
+        window = 1;
     }
-    written += n;
 
-    /* Update index */
-    log->file_size = ftell(log->file);
-    off_t offset = log->file_size - written;
-    log->index++;
-    if (updateIndex(log, log->index, offset) < 0) {
+    SegmentLoad *loads = RedisModule_Calloc(num_loads, sizeof(SegmentLoad));
+    int started = 0;
+
+    for (i = 0; i < num_loads; i++) {
+        loads[i].log = log;
+        loads[i].seg = &log->segments[i];
+    }
+
+    while (started < window) {
+        startSegmentLoad(&loads[started++], use_threads);
+    }
+
+    for (i = 0; i < num_loads; i++) {
+        RaftLogSegment *seg = &log->segments[i];
+        SegmentLoad *load = &loads[i];
+
+        finishSegmentLoad(load);
+
+        /* Keep the workers busy while entries are passed on */
+        if (started < num_loads) {
+            startSegmentLoad(&loads[started++], use_threads);
+        }
+
+        if (seg->first_idx != next_idx) {
+            LOG_ERROR("Raft log: segment %s does not follow index %ld\n",
+                    seg->filename, next_idx - 1);
+            ret = -1;
+            break;
+        }
+
+        if (checkSegmentLoad(seg, load, i == num_loads - 1) < 0) {
+            ret = -1;
+            break;
+        }
+
+        releaseSegmentEntries(log, load, callback, callback_arg);
+        next_idx += load->count;
+    }
+
+    /* Discard segments that were still being parsed on error */
+    for (i = 0; i < started; i++) {
+        finishSegmentLoad(&loads[i]);
+        for (int j = 0; j < loads[i].num_entries; j++) {
+            raft_entry_release(loads[i].entries[j]);
+        }
+        RedisModule_Free(loads[i].entries);
+    }
+    RedisModule_Free(loads);
+
+    if (ret < 0) {
+        return -1;
+    }
+
+    log->file_size = calcFileSize(log);
+    log->synced_idx = log->index;
+    return log->num_entries;
+}
+
+static bool sealSegmentAsync(RaftLog *log);
+
+/* Seals the last segment and starts a new one, that begins after the last
+ * entry.
+ *
+ * Entries of older segments are never synced later, so the last segment is
+ * synced first: in the background if asynchronous syncs are used (see
+ * sealSegmentAsync()), and otherwise right away.  The log file holding the
+ * new segments list is always written and synced right away, as the entries
+ * of the new segment are only found through it.  This happens once per
+ * raft-log-segment-size bytes of entries.
+ */
+static RaftLogSegment *startSegment(RaftLog *log)
+{
+    if (!sealSegmentAsync(log)) {
+        if (syncSegment(log, lastSegment(log)) < 0) {
+            return NULL;
+        }
+        log->unsynced_entries = 0;
+        log->synced_idx = log->index;
+    }
+
+    if (!addSegment(log, log->index + 1, true, 0)) {
+        return NULL;
+    }
+
+    if (writeLogFile(log, 0, log->num_segments) < 0) {
+        dropSegments(log, log->num_segments - 1, 1);
+        return NULL;
+    }
+
+    return lastSegment(log);
+}
+
+RRStatus RaftLogWriteEntry(RaftLog *log, raft_entry_t *entry)
+{
+    RaftLogSegment *seg = lastSegment(log);
+
+    /* Entries of an older log must be loaded first */
+    if (!seg) {
         return RR_ERROR;
     }
 
-    return RR_OK;
+    if (seg->file_size >= log->segment_size && log->index >= seg->first_idx) {
+        if (!(seg = startSegment(log))) {
+            return RR_ERROR;
+        }
+    }
+
+    return writeSegmentEntry(log, seg, entry);
 }
 
 RRStatus RaftLogSync(RaftLog *log)
 {
-    if (writeEnd(log->file, log->fsync) < 0) {
+    RaftLogSegment *seg = lastSegment(log);
+
+    /* A sealed segment waiting to be synced in the background */
+    if (log->sealed_sync) {
+        LogSyncReq *sr = log->sealed_sync;
+        int ret = fsync(sr->fd);
+
+        log->sealed_sync = NULL;
+        close(sr->fd);
+        RedisModule_Free(sr);
+        if (ret < 0) {
+            return RR_ERROR;
+        }
+    }
+
+    if (seg && syncSegment(log, seg) < 0) {
         return RR_ERROR;
     }
+
+    log->synced_idx = log->index;
     return RR_OK;
 }
 
 RRStatus RaftLogAppend(RaftLog *log, raft_entry_t *entry)
 {
-    if (RaftLogWriteEntry(log, entry) != RR_OK ||
-            writeEnd(log->file, log->fsync) < 0) {
+    if (RaftLogWriteEntry(log, entry) != RR_OK) {
+        return RR_ERROR;
+    }
+
+    /* If a batch is open, syncing is deferred to RaftLogSyncBatch() */
+    if (log->batch) {
+        log->unsynced_entries++;
+    } else if (RaftLogSync(log) != RR_OK) {
         return RR_ERROR;
     }
 
@@ -779,55 +1662,295 @@ RRStatus RaftLogAppend(RaftLog *log, raft_entry_t *entry)
     return RR_OK;
 }
 
-static off_t seekEntry(RaftLog *log, raft_index_t idx)
+/* Group commit.
+ *
+ * While a batch is open, RaftLogAppend() only writes entries and the caller is
+ * responsible to call RaftLogSyncBatch() before relying on their durability.
+ * This way many entries appended in a row are made durable by a single sync.
+ */
+void RaftLogBeginBatch(RaftLog *log)
+{
+    log->batch = true;
+}
+
+RRStatus RaftLogSyncBatch(RaftLog *log)
+{
+    if (!log->unsynced_entries) {
+        return RR_OK;
+    }
+
+    if (RaftLogSync(log) != RR_OK) {
+        return RR_ERROR;
+    }
+
+    log->unsynced_entries = 0;
+    return RR_OK;
+}
+
+RRStatus RaftLogEndBatch(RaftLog *log)
+{
+    log->batch = false;
+    return RaftLogSyncBatch(log);
+}
+
+/* Asynchronous sync.
+ *
+ * RaftLogSyncAsync() syncs the entries appended so far on the libuv thread
+ * pool (or using io_uring, with libuv versions that support it), so the
+ * calling thread does not block on the disk.  Once they are durable,
+ * log->synced_idx is updated and the callback is called on the loop thread.
+ *
+ * A single sync is in progress at a time.  Entries appended meanwhile are
+ * synced by another one that follows it, which covers all of them.
+ *
+ * The sync uses a duplicate of the segment's file descriptor, so it remains
+ * valid if the segment is closed meanwhile.  If entries are removed from the
+ * log while a sync is in progress, it may no longer cover the entries that
+ * replaced them so its result is discarded (see sync_epoch).
+ *
+ * When a segment is sealed (see startSegment()), its remaining entries are
+ * synced the same way: a sync of the sealed segment is queued as
+ * log->sealed_sync and runs before the next sync of the last segment.
+ */
+
+static void startLogSync(RaftLog *log);
+
+static LogSyncReq *newLogSyncReq(RaftLog *log, RaftLogSegment *seg)
+{
+    LogSyncReq *sr = RedisModule_Calloc(1, sizeof(LogSyncReq));
+
+    sr->log = log;
+    sr->idx = log->index;
+    sr->epoch = log->sync_epoch;
+    if ((sr->fd = dup(fileno(seg->file))) < 0) {
+        PANIC("Failed to sync Raft log: %s", strerror(errno));
+    }
+
+    return sr;
+}
+
+/* Queues a sync of the last segment's entries before it is sealed, if
+ * asynchronous syncs are used.  Returns false if the segment has to be synced
+ * right away instead, which is also the case if a previously sealed segment
+ * is still waiting to be synced.
+ */
+static bool sealSegmentAsync(RaftLog *log)
+{
+    if (!log->sync_loop || !log->fsync || log->sealed_sync) {
+        return false;
+    }
+
+    if (log->synced_idx < log->index) {
+        log->sealed_sync = newLogSyncReq(log, lastSegment(log));
+        if (!log->sync_req) {
+            startLogSync(log);
+        }
+    }
+
+    return true;
+}
+
+static void handleLogSyncDone(uv_fs_t *req)
+{
+    LogSyncReq *sr = uv_req_get_data((uv_req_t *) req);
+    RaftLog *log = sr->log;
+    ssize_t result = req->result;
+
+    uv_fs_req_cleanup(req);
+    close(sr->fd);
+
+    if (!log) {
+        RedisModule_Free(sr);
+        return;
+    }
+
+    if (result < 0) {
+        PANIC("Failed to sync Raft log: %s", uv_strerror(result));
+    }
+
+    log->sync_req = NULL;
+
+    /* Discarded if entries were removed meanwhile */
+    if (sr->epoch == log->sync_epoch && sr->idx > log->synced_idx) {
+        log->synced_idx = sr->idx;
+    }
+
+    uint64_t usec = (uv_hrtime() - sr->start_time) / 1000;
+    RedisModule_Free(sr);
+
+    /* Entries appended meanwhile, or replacing removed ones */
+    if (log->synced_idx < log->index) {
+        startLogSync(log);
+    }
+
+    log->sync_cb(log->sync_cb_arg, usec);
+}
+
+static void startLogSync(RaftLog *log)
+{
+    LogSyncReq *sr = log->sealed_sync;
+
+    /* A sealed segment is synced first, then the last one */
+    if (sr) {
+        log->sealed_sync = NULL;
+    } else {
+        sr = newLogSyncReq(log, lastSegment(log));
+    }
+
+    sr->start_time = uv_hrtime();
+
+    uv_req_set_data((uv_req_t *) &sr->req, sr);
+    int ret = uv_fs_fsync(log->sync_loop, &sr->req, sr->fd, handleLogSyncDone);
+    if (ret < 0) {
+        PANIC("Failed to sync Raft log: %s", uv_strerror(ret));
+    }
+
+    log->sync_req = sr;
+    log->unsynced_entries = 0;
+}
+
+/* Starts syncing all entries appended so far.
+ *
+ * Returns true if a sync is in progress, in which case cb is called when it
+ * completes, or false if all entries are already durable.
+ */
+bool RaftLogSyncAsync(RaftLog *log, uv_loop_t *loop, RaftLogSyncCallback cb, void *arg)
+{
+    log->sync_loop = loop;
+    log->sync_cb = cb;
+    log->sync_cb_arg = arg;
+
+    /* Entries appended meanwhile are synced once it completes */
+    if (log->sync_req) {
+        return true;
+    }
+
+    if (log->synced_idx >= log->index || !log->fsync || !lastSegment(log)) {
+        log->synced_idx = log->index;
+        log->unsynced_entries = 0;
+        return false;
+    }
+
+    startLogSync(log);
+    return true;
+}
+
+/* Seeks to the specified entry, and returns the segment that holds it or NULL
+ * if it does not exist.
+ */
+static RaftLogSegment *seekEntry(RaftLog *log, raft_index_t idx)
 {
     /* Bounds check */
     if (idx <= log->snapshot_last_idx) {
-        return 0;
+        return NULL;
     }
 
     if (idx > log->snapshot_last_idx + log->num_entries) {
-        return 0;
+        return NULL;
     }
 
-    raft_index_t relidx = idx - log->snapshot_last_idx;
-    off_t offset;
-    if (fseek(log->idxfile, sizeof(off_t) * relidx, SEEK_SET) < 0 ||
-            fread(&offset, sizeof(offset), 1, log->idxfile) != 1) {
-        return 0;
+    if (!log->num_segments) {
+        return NULL;
     }
 
-    if (fseek(log->file, offset, SEEK_SET) < 0) {
-        return 0;
+    RaftLogSegment *seg = &log->segments[findSegment(log, idx)];
+    off_t offset = lookupIndex(seg, idx);
+    if (offset < 0 || fseek(seg->file, offset, SEEK_SET) < 0) {
+        return NULL;
     }
 
-    return offset;
+    return seg;
 }
 
 raft_entry_t *RaftLogGet(RaftLog *log, raft_index_t idx)
 {
-    if (seekEntry(log, idx) <= 0) {
+    RaftLogSegment *seg = seekEntry(log, idx);
+    if (!seg) {
         return NULL;
     }
 
-    RawLogEntry *re;
-    if (readRawLogEntry(log, &re) != RR_OK) {
+    raft_entry_t *e;
+    if (readSegmentEntry(seg, &e) <= 0) {
         return NULL;
     }
 
-    raft_entry_t *e = parseRaftLogEntry(re);
-    freeRawLogEntry(re);
+    return e;
+}
 
-    if (!e) {
-        return NULL;
+/* Reads up to entries_n consecutive entries, starting at idx.  Every segment
+ * is only seeked once, and entries are then read sequentially.
+ *
+ * Returns the number of entries read.
+ */
+int RaftLogGetBatch(RaftLog *log, raft_index_t idx, int entries_n, raft_entry_t **entries)
+{
+    int n = 0;
+
+    RaftLogSegment *seg = seekEntry(log, idx);
+    if (!seg) {
+        return 0;
     }
 
-    return e;
+    if (entries_n > log->index - idx + 1) {
+        entries_n = log->index - idx + 1;
+    }
+
+    while (n < entries_n) {
+        /* Continue to the next segment */
+        if (idx + n > segmentLastIdx(log, seg) && !(seg = seekEntry(log, idx + n))) {
+            break;
+        }
+
+        if (readSegmentEntry(seg, &entries[n]) <= 0) {
+            break;
+        }
+        n++;
+    }
+
+    return n;
+}
+
+/* Removes entries that follow (and include) idx from the segment files.
+ * Segments that begin after idx are removed, and the one that holds idx is
+ * truncated.
+ */
+static RRStatus truncateSegments(RaftLog *log, raft_index_t idx)
+{
+    int pos = findSegment(log, idx);
+    RaftLogSegment *seg = &log->segments[pos];
+
+    off_t offset = lookupIndex(seg, idx);
+    if (offset < 0) {
+        return RR_ERROR;
+    }
+
+    /* Dropping segments rewrites the segments list, which is synced right
+     * away like in startSegment().
+     */
+    if (pos < log->num_segments - 1) {
+        if (writeLogFile(log, 0, pos + 1) < 0) {
+            return RR_ERROR;
+        }
+        dropSegments(log, pos + 1, log->num_segments - pos - 1);
+        seg = &log->segments[pos];
+    }
+
+    /* The truncation itself is not synced.  Entries are only removed when
+     * conflicting ones replace them, and syncing those syncs the new file
+     * size as well.  Until then, the removed entries are not acknowledged to
+     * anyone, so recovering them after a crash is harmless.
+     */
+    if (fflush(seg->file) < 0 || ftruncate(fileno(seg->file), offset) < 0) {
+        return RR_ERROR;
+    }
+    seg->file_size = offset;
+
+    log->file_size = calcFileSize(log);
+    return RR_OK;
 }
 
 RRStatus RaftLogDelete(RaftLog *log, raft_index_t from_idx, func_entry_notify_f cb, void *cb_arg)
 {
-    off_t offset;
     RRStatus ret = RR_OK;
     unsigned long removed = 0;
 
@@ -836,38 +1959,41 @@ RRStatus RaftLogDelete(RaftLog *log, raft_index_t from_idx, func_entry_notify_f
     }
 
     while (log->index >= from_idx) {
-        if (!(offset = seekEntry(log, log->index))) {
-            return RR_ERROR;
+        RaftLogSegment *seg = seekEntry(log, log->index);
+        if (!seg) {
+            ret = RR_ERROR;
+            break;
         }
 
-        RawLogEntry *re;
         raft_entry_t *e;
 
-        if (readRawLogEntry(log, &re) < 0) {
+        if (readSegmentEntry(seg, &e) <= 0) {
             ret = RR_ERROR;
             break;
         }
 
-        if (!strcasecmp(re->elements[0].ptr, "ENTRY")) {
-            if ((e = parseRaftLogEntry(re)) == NULL) {
-                freeRawLogEntry(re);
-                ret = RR_ERROR;
-                break;
-            }
-            if (cb) {
-                cb(cb_arg, e, log->index);
-            }
+        if (cb) {
+            cb(cb_arg, e, log->index);
+        }
 
-            removed++;
-            log->index--;
-            log->num_entries--;
+        removed++;
+        log->index--;
+        log->num_entries--;
 
-            raft_entry_release(e);
+        raft_entry_release(e);
+    }
 
-            ftruncate(fileno(log->file), offset);
-        }
+    /* Truncate once, following the last entry that remains */
+    if (removed && truncateSegments(log, log->index + 1) != RR_OK) {
+        ret = RR_ERROR;
+    }
 
-        freeRawLogEntry(re);
+    /* Entries are removed, see RaftLogSyncAsync() */
+    if (removed) {
+        if (log->synced_idx > log->index) {
+            log->synced_idx = log->index;
+        }
+        log->sync_epoch++;
     }
 
     return ret;
@@ -909,75 +2035,131 @@ raft_index_t RaftLogCount(RaftLog *log)
     return log->num_entries;
 }
 
-/*
- * Log compaction.
+/* Accounts for entries read from the log file, and puts them back in the
+ * cache if they immediately precede it, are still needed and fit in the
+ * cache memory budget. This way a lagging follower does not result with
+ * repeated reads of the same entries from disk.
  */
+static void cacheEntriesRead(RedisRaftCtx *rr, raft_index_t idx, int n, raft_entry_t **entries)
+{
+    EntryCache *cache = rr->logcache;
+    size_t max_memory = rr->config->raft_log_max_cache_size;
+    int i;
+
+    for (i = 0; i < n; i++) {
+        cache->misses++;
+        cache->miss_bytes += entries[i]->data_len;
+    }
+
+    if (!cache->len || idx + n != cache->start_idx) {
+        return;
+    }
+
+    for (i = n - 1; i >= 0; i--) {
+        raft_entry_t *ety = entries[i];
+
+        if (idx + i < cache->keep_idx ||
+            (max_memory && cache->entries_memsize + sizeof(raft_entry_t) + ety->data_len > max_memory)) {
+            break;
+        }
 
+        EntryCachePrepend(cache, ety, idx + i);
+    }
+}
 
-/* Rewrite the current log state into a new file:
- * 1. Latest snapshot info
- * 2. All entries
- * 3. Current term and vote
+/* Fetches consecutive entries, from the cache if available and otherwise
+ * from the log file.  Entries preceding the cache are read from the log file
+ * in a single batch.
  */
-long long int RaftLogRewrite(RedisRaftCtx *rr, const char *filename, raft_index_t last_idx, raft_term_t last_term)
+static int getEntries(RedisRaftCtx *rr, raft_index_t idx, int entries_n, raft_entry_t **entries)
 {
-    RaftLog *log = RaftLogCreate(filename, rr->snapshot_info.dbid,
-            last_term, last_idx,
-            raft_get_current_term(rr->raft),
-            raft_get_voted_for(rr->raft),
-            rr->config);
-    long long int num_entries = 0;
+    EntryCache *cache = rr->logcache;
+    raft_index_t i = idx;
+    int n = 0;
 
-    raft_index_t i;
-    for (i = last_idx + 1; i <= RaftLogCurrentIdx(rr->log); i++) {
-        num_entries++;
-        raft_entry_t *ety = raft_get_entry_from_idx(rr->raft, i);
-        if (RaftLogWriteEntry(log, ety) != RR_OK) {
-            RaftLogClose(log);
-            return -1;
+    while (n < entries_n) {
+        raft_entry_t *e = cache ? EntryCacheGet(cache, i) : NULL;
+        if (e) {
+            entries[n++] = e;
+            i++;
+            cache->hits++;
+            continue;
         }
-        raft_entry_release(ety);
-    }
 
-    if (RaftLogSync(log) != RR_OK) {
-        RaftLogClose(log);
-        return -1;
+        int batch_n = entries_n - n;
+        if (cache && cache->len && i < cache->start_idx &&
+            cache->start_idx - i < batch_n) {
+            batch_n = cache->start_idx - i;
+        }
+
+        int ret = RaftLogGetBatch(rr->log, i, batch_n, &entries[n]);
+        if (!ret) {
+            break;
+        }
+
+        if (cache) {
+            cacheEntriesRead(rr, i, ret, &entries[n]);
+        }
+
+        n += ret;
+        i += ret;
     }
 
-    RaftLogClose(log);
-    return num_entries;
+    return n;
 }
 
-/* Append to the specified Raft log entries from the in-memory log, starting from
- * a specific index.
+/*
+ * Log compaction.
+ */
+
+/* Removes entries up to (and including) idx from the log, after a snapshot
+ * that includes them was created.
+ *
+ * Segments that hold no entries following idx are removed, and their entries
+ * are never read.  The first remaining segment may still hold some entries
+ * that are part of the snapshot, which are skipped when the log is loaded.
  */
-long long int RaftLogRewriteAppend(RedisRaftCtx *rr, RaftLog *target_log, raft_index_t from_idx)
+RRStatus RaftLogCompact(RaftLog *log, raft_index_t idx, raft_term_t term)
 {
-    long long int num_entries = 0;
+    if (idx <= log->snapshot_last_idx) {
+        return RR_OK;
+    }
 
-    raft_index_t i;
-    for (i = from_idx; i <= RaftLogCurrentIdx(rr->log); i++) {
-        num_entries++;
-        raft_entry_t *ety = raft_get_entry_from_idx(rr->raft, i);
-        if (RaftLogWriteEntry(target_log, ety) != RR_OK) {
-            num_entries = -1;
-            goto exit;
-        }
-        raft_entry_release(ety);
+    if (idx > log->index) {
+        LOG_ERROR("Log compaction: index %ld is beyond the last entry %ld\n",
+                idx, log->index);
+        return RR_ERROR;
     }
 
-    if (RaftLogSetTerm(target_log, rr->log->term, rr->log->vote) != RR_OK) {
-        RaftLogClose(target_log);
-        return -1;
+    raft_index_t old_idx = log->snapshot_last_idx;
+    raft_term_t old_term = log->snapshot_last_term;
+
+    log->snapshot_last_idx = idx;
+    log->snapshot_last_term = term;
+
+    /* The last segment is always kept, so new entries have where to go */
+    int drop = 0;
+    while (drop < log->num_segments - 1 &&
+           log->segments[drop + 1].first_idx <= idx + 1) {
+        drop++;
     }
 
-    if (RaftLogSync(target_log) != RR_OK) {
-        num_entries = -1;
+    /* Update the log file first; segments it doesn't list are never read */
+    if (writeLogFile(log, drop, log->num_segments - drop) < 0) {
+        log->snapshot_last_idx = old_idx;
+        log->snapshot_last_term = old_term;
+        return RR_ERROR;
     }
 
-exit:
+    dropSegments(log, 0, drop);
+
+    log->num_entries = log->index - idx;
+    log->file_size = calcFileSize(log);
 
-    return num_entries;
+    LOG_VERBOSE("Log compaction complete, %d segments removed (up to idx %ld).\n",
+            drop, idx);
+
+    return RR_OK;
 }
 
 void RaftLogRemoveFiles(const char *filename)
@@ -985,6 +2167,26 @@ void RaftLogRemoveFiles(const char *filename)
     char *idx_filename = getIndexFilename(filename);
 
     LOG_DEBUG("Removing Raft Log files: %s", filename);
+
+    /* Remove segments listed by the log file */
+    FILE *file = fopen(filename, "r");
+    if (file) {
+        RaftLog log = { 0 };
+        RawLogEntry *re = NULL;
+
+        if (readRawLogEntry(file, &re) == 0 && handleHeader(&log, re) == 0 &&
+            log.version >= RAFTLOG_SEGMENTS_VERSION) {
+            raft_index_t first_idx;
+
+            while (readSegmentRecord(file, &first_idx) > 0) {
+                removeSegmentFiles(filename, first_idx);
+            }
+        }
+
+        freeRawLogEntry(re);
+        fclose(file);
+    }
+
     unlink(filename);
     unlink(idx_filename);
 
@@ -993,49 +2195,31 @@ void RaftLogRemoveFiles(const char *filename)
 
 void RaftLogArchiveFiles(RedisRaftCtx *rr)
 {
-    char *idx_filename = getIndexFilename(rr->config->raft_log_filename);
+    const char *filename = rr->config->raft_log_filename;
+    char *idx_filename = getIndexFilename(filename);
     unlink(idx_filename);
     RedisModule_Free(idx_filename);
 
-    char bak_filename_maxlen = strlen(rr->config->raft_log_filename) + 100;
+    int bak_filename_maxlen = strlen(filename) + 100;
     char bak_filename[bak_filename_maxlen];
-    snprintf(bak_filename, bak_filename_maxlen - 1,
-            "%s.%d.bak", rr->config->raft_log_filename, raft_get_nodeid(rr->raft));
-    rename(rr->config->raft_log_filename, bak_filename);
-}
 
-RRStatus RaftLogRewriteSwitch(RedisRaftCtx *rr, RaftLog *new_log, unsigned long new_log_entries)
-{
-    /* Rename Raft log.  If we fail, we can assume the old log is still
-     * okay and we can just cancel the operation.
-     */
-    if (rename(new_log->filename, rr->log->filename) < 0) {
-        LOG_ERROR("Failed to switch Raft log: %s to %s: %s\n",
-                new_log->filename, rr->log->filename, strerror(errno));
-        return RR_ERROR;
-    }
+    if (rr->log) {
+        for (int i = 0; i < rr->log->num_segments; i++) {
+            RaftLogSegment *seg = &rr->log->segments[i];
 
-    /* Rename the index.  If we fail now we're in inconsistent state, so we
-     * panic and expect the index to be re-built when the process restarts.
-     */
-    char *log_idx_filename = getIndexFilename(rr->log->filename);
-    char *new_idx_filename = getIndexFilename(new_log->filename);
-    if (rename(new_idx_filename, log_idx_filename) < 0) {
-        PANIC("Failed to switch Raft log index: %s to %s: %s\n",
-               new_idx_filename, log_idx_filename, strerror(errno));
-    }
-
-    RedisModule_Free(log_idx_filename);
-    RedisModule_Free(new_idx_filename);
-
-    new_log->filename = rr->log->filename;
-    new_log->num_entries = new_log_entries;
-    new_log->index = new_log->snapshot_last_idx + new_log->num_entries;
+            idx_filename = getIndexFilename(seg->filename);
+            unlink(idx_filename);
+            RedisModule_Free(idx_filename);
 
-    RaftLogClose(rr->log);
-    rr->log = new_log;
+            snprintf(bak_filename, bak_filename_maxlen - 1,
+                    "%s.%d.bak", seg->filename, raft_get_nodeid(rr->raft));
+            rename(seg->filename, bak_filename);
+        }
+    }
 
-    return RR_OK;
+    snprintf(bak_filename, bak_filename_maxlen - 1,
+            "%s.%d.bak", filename, raft_get_nodeid(rr->raft));
+    rename(filename, bak_filename);
 }
 
 /*
@@ -1068,17 +2252,25 @@ static void logImplReset(void *rr_, raft_index_t index, raft_term_t term)
 
     TRACE_LOG_OP("Reset(index=%lu,term=%lu)\n", index, term);
 
+    EntryCache *cache = EntryCacheNew(ENTRY_CACHE_INIT_SIZE);
+    cache->hits = rr->logcache->hits;
+    cache->misses = rr->logcache->misses;
+    cache->miss_bytes = rr->logcache->miss_bytes;
+    cache->needed_evictions = rr->logcache->needed_evictions;
+
     EntryCacheFree(rr->logcache);
-    rr->logcache = EntryCacheNew(ENTRY_CACHE_INIT_SIZE);
+    rr->logcache = cache;
 }
 
 static int logImplAppend(void *rr_, raft_entry_t *ety)
 {
     RedisRaftCtx *rr = (RedisRaftCtx *) rr_;
     TRACE_LOG_OP("Append(id=%d, term=%lu) -> index %lu\n", ety->id, ety->term, rr->log->index + 1);
+    uint64_t start = uv_hrtime();
     if (RaftLogAppend(rr->log, ety) != RR_OK) {
         return -1;
     }
+    HistogramRecord(&rr->latency.log_append, (uv_hrtime() - start) / 1000);
     EntryCacheAppend(rr->logcache, ety, rr->log->index);
     return 0;
 }
@@ -1111,10 +2303,14 @@ static raft_entry_t *logImplGet(void *rr_, raft_index_t idx)
     if (ety != NULL) {
         TRACE_LOG_OP("Get(idx=%lu) -> (cache) id=%d, term=%lu\n",
                 idx, ety->id, ety->term);
+        rr->logcache->hits++;
         return ety;
     }
 
     ety = RaftLogGet(rr->log, idx);
+    if (ety != NULL) {
+        cacheEntriesRead(rr, idx, 1, &ety);
+    }
     TRACE_LOG_OP("Get(idx=%lu) -> (file) id=%d, term=%lu\n",
             idx, ety ? ety->id : -1, ety ? ety->term : 0);
     return ety;
@@ -1123,22 +2319,7 @@ static raft_entry_t *logImplGet(void *rr_, raft_index_t idx)
 static int logImplGetBatch(void *rr_, raft_index_t idx, int entries_n, raft_entry_t **entries)
 {
     RedisRaftCtx *rr = (RedisRaftCtx *) rr_;
-    int n = 0;
-    raft_index_t i = idx;
-
-    while (n < entries_n) {
-        raft_entry_t *e = EntryCacheGet(rr->logcache, i);
-        if (!e) {
-            e = RaftLogGet(rr->log, i);
-        }
-        if (!e) {
-            break;
-        }
-
-        entries[n] = e;
-        n++;
-        i++;
-    }
+    int n = getEntries(rr, idx, entries_n, entries);
 
     TRACE_LOG_OP("GetBatch(idx=%lu entries_n=%d) -> %d\n", idx, entries_n, n);
     return n;
@@ -0,0 +1,255 @@
+/*
+ * This file is part of RedisRaft.
+ *
+ * Copyright (c) 2020 Redis Labs
+ *
+ * RedisRaft is dual licensed under the GNU Affero General Public License version 3
+ * (AGPLv3) or the Redis Source Available License (RSAL).
+ */
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include "redisraft.h"
+
+/* Asynchronous logging.
+ *
+ * With async-logging enabled, raft_module_log() only formats the message into
+ * a ring buffer slot, and a background thread writes it out. This keeps the
+ * timestamp formatting, stdio and flush calls off the Raft thread.
+ *
+ * The ring buffer is a bounded multi-producer queue (as described by Dmitry
+ * Vyukov), so log calls never take a lock: each slot holds a sequence number
+ * that tells producers whether it is free and the consumer whether it is
+ * ready. When the buffer is full, messages are dropped and counted rather
+ * than blocking the caller.
+ *
+ * Messages longer than LOGGER_MSG_SIZE are truncated.
+ */
+
+#define LOGGER_SLOTS            1024
+#define LOGGER_MSG_SIZE         1024
+#define LOGGER_IDLE_USEC        10000
+
+typedef struct LoggerSlot {
+    unsigned long seq;          /* Slot is free if seq == pos, ready if seq == pos + 1 */
+    uint64_t time_usec;         /* Time of log call */
+    unsigned int len;
+    char msg[LOGGER_MSG_SIZE];
+} LoggerSlot;
+
+static struct {
+    LoggerSlot slots[LOGGER_SLOTS];
+    unsigned long enqueue_pos;  /* Next slot producers claim */
+    unsigned long dequeue_pos;  /* Next slot to write out, protected by mutex */
+    unsigned long long dropped; /* Messages dropped as the buffer was full */
+    unsigned long long dropped_reported;    /* Dropped messages already reported in the log */
+    bool async;                 /* Log calls go to the ring buffer */
+    bool running;               /* Thread is running */
+    bool stop;                  /* Thread should stop */
+    bool initialized;
+    uv_thread_t thread;
+    uv_mutex_t mutex;           /* Serializes writing out messages */
+    time_t cached_sec;          /* Second formatted in cached_time */
+    char cached_time[64];
+} logger;
+
+/* Writes the timestamp prefix of a message, reformatting the part that doesn't
+ * change within a second only when necessary.
+ */
+static void formatTime(uint64_t time_usec, char *buf, size_t buf_size)
+{
+    time_t sec = time_usec / 1000000;
+
+    if (sec != logger.cached_sec || !logger.cached_time[0]) {
+        struct tm tm;
+        int n;
+
+        localtime_r(&sec, &tm);
+        n = snprintf(logger.cached_time, sizeof(logger.cached_time), "%u:",
+                (unsigned int) getpid());
+        strftime(logger.cached_time + n, sizeof(logger.cached_time) - n,
+                "%d %b %H:%M:%S", &tm);
+        logger.cached_sec = sec;
+    }
+
+    snprintf(buf, buf_size, "%s.%03u ", logger.cached_time,
+            (unsigned int) (time_usec % 1000000) / 1000);
+}
+
+/* Writes out all ready messages and returns their number; must be called with
+ * the mutex held.
+ */
+static int drainLog(void)
+{
+    FILE *file = redis_raft_logfile;
+    char prefix[80];
+    int count = 0;
+
+    while (true) {
+        LoggerSlot *slot = &logger.slots[logger.dequeue_pos % LOGGER_SLOTS];
+        unsigned long seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+
+        if (seq != logger.dequeue_pos + 1) {
+            break;
+        }
+
+        if (file) {
+            formatTime(slot->time_usec, prefix, sizeof(prefix));
+            fprintf(file, "%s%.*s", prefix, (int) slot->len, slot->msg);
+        }
+
+        __atomic_store_n(&slot->seq, logger.dequeue_pos + LOGGER_SLOTS, __ATOMIC_RELEASE);
+        logger.dequeue_pos++;
+        count++;
+    }
+
+    unsigned long long dropped = __atomic_load_n(&logger.dropped, __ATOMIC_RELAXED);
+    if (dropped != logger.dropped_reported) {
+        if (file) {
+            formatTime(time(NULL) * 1000000ULL, prefix, sizeof(prefix));
+            fprintf(file, "%s%llu log messages dropped\n", prefix,
+                    dropped - logger.dropped_reported);
+        }
+        logger.dropped_reported = dropped;
+        count++;
+    }
+
+    if (count && file) {
+        fflush(file);
+    }
+
+    return count;
+}
+
+static void loggerThread(void *arg)
+{
+    while (!__atomic_load_n(&logger.stop, __ATOMIC_ACQUIRE)) {
+        uv_mutex_lock(&logger.mutex);
+        int count = drainLog();
+        uv_mutex_unlock(&logger.mutex);
+
+        if (!count) {
+            usleep(LOGGER_IDLE_USEC);
+        }
+    }
+}
+
+/* Starts the logging thread, so log calls no longer write the log directly. */
+RRStatus LoggerStart(void)
+{
+    if (logger.running) {
+        return RR_OK;
+    }
+
+    if (!logger.initialized) {
+        for (unsigned long i = 0; i < LOGGER_SLOTS; i++) {
+            logger.slots[i].seq = i;
+        }
+        uv_mutex_init(&logger.mutex);
+        logger.initialized = true;
+    }
+
+    logger.stop = false;
+    if (uv_thread_create(&logger.thread, loggerThread, NULL) != 0) {
+        return RR_ERROR;
+    }
+
+    logger.running = true;
+    __atomic_store_n(&logger.async, true, __ATOMIC_RELEASE);
+
+    return RR_OK;
+}
+
+/* Stops the logging thread, once all messages were written out. */
+void LoggerStop(void)
+{
+    if (!logger.running) {
+        return;
+    }
+
+    __atomic_store_n(&logger.async, false, __ATOMIC_RELEASE);
+    __atomic_store_n(&logger.stop, true, __ATOMIC_RELEASE);
+    uv_thread_join(&logger.thread);
+    logger.running = false;
+
+    LoggerFlush();
+}
+
+bool LoggerIsAsync(void)
+{
+    return __atomic_load_n(&logger.async, __ATOMIC_ACQUIRE);
+}
+
+/* Writes out all messages logged so far, e.g. before aborting. */
+void LoggerFlush(void)
+{
+    if (!logger.initialized) {
+        return;
+    }
+
+    uv_mutex_lock(&logger.mutex);
+    drainLog();
+    uv_mutex_unlock(&logger.mutex);
+}
+
+unsigned long long LoggerGetDropped(void)
+{
+    return __atomic_load_n(&logger.dropped, __ATOMIC_RELAXED);
+}
+
+/* Queues a message for the logging thread.
+ *
+ * Returns false if async logging is not enabled, in which case the caller
+ * should write the message itself.
+ */
+bool LoggerWrite(const char *fmt, va_list ap)
+{
+    if (!__atomic_load_n(&logger.async, __ATOMIC_ACQUIRE)) {
+        return false;
+    }
+
+    unsigned long pos = __atomic_load_n(&logger.enqueue_pos, __ATOMIC_RELAXED);
+    LoggerSlot *slot;
+
+    while (true) {
+        slot = &logger.slots[pos % LOGGER_SLOTS];
+        unsigned long seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        long diff = (long) (seq - pos);
+
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&logger.enqueue_pos, &pos, pos + 1, true,
+                        __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (diff < 0) {
+            /* Full, the slot was not written out yet */
+            __atomic_add_fetch(&logger.dropped, 1, __ATOMIC_RELAXED);
+            return true;
+        } else {
+            pos = __atomic_load_n(&logger.enqueue_pos, __ATOMIC_RELAXED);
+        }
+    }
+
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    slot->time_usec = (uint64_t) tv.tv_sec * 1000000 + tv.tv_usec;
+
+    int n = vsnprintf(slot->msg, sizeof(slot->msg), fmt, ap);
+    if (n < 0) {
+        n = 0;
+    } else if (n >= (int) sizeof(slot->msg)) {
+        /* Truncated, keep the line terminated */
+        n = sizeof(slot->msg) - 1;
+        slot->msg[n - 1] = '\n';
+    }
+    slot->len = n;
+
+    __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+    return true;
+}
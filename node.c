@@ -56,12 +56,40 @@ void NodeFree(Node *node)
         return;
     }
 
+    NodeBulkDisconnect(node);
     clearPendingResponses(node);
 
     LIST_REMOVE(node, entries);
     RedisModule_Free(node);
 }
 
+static void handleCommandInfoReply(redisAsyncContext *c, void *r, void *privdata)
+{
+    Node *node = privdata;
+    redisReply *reply = r;
+
+    /* COMMAND INFO returns a nil element for unknown commands */
+    if (reply && reply->type == REDIS_REPLY_ARRAY && reply->elements == 1 &&
+        reply->element[0]->type == REDIS_REPLY_ARRAY) {
+        node->flags |= NODE_BINARY_AE;
+        NODE_TRACE(node, "Node supports RAFT.AEB\n");
+    }
+}
+
+/* Nodes that know raft-entry-compress-threshold can decompress entries; older
+ * ones return an empty array.
+ */
+static void handleCompressConfigReply(redisAsyncContext *c, void *r, void *privdata)
+{
+    Node *node = privdata;
+    redisReply *reply = r;
+
+    if (reply && reply->type == REDIS_REPLY_ARRAY && reply->elements == 2) {
+        node->flags |= NODE_COMPRESSED_AE;
+        NODE_TRACE(node, "Node supports compressed entries\n");
+    }
+}
+
 static void handleNodeConnect(const redisAsyncContext *c, int status)
 {
     Node *node = (Node *) c->data;
@@ -74,6 +102,15 @@ static void handleNodeConnect(const redisAsyncContext *c, int status)
         node->last_connected_time = RedisModule_Milliseconds();
         clearPendingResponses(node);
 
+        /* Check if the node supports binary AppendEntries; until we know,
+         * RAFT.AE is used.
+         */
+        node->flags &= ~(NODE_BINARY_AE | NODE_COMPRESSED_AE);
+        node->ae_pipeline_idx = 0;
+        redisAsyncCommand(node->rc, handleCommandInfoReply, node, "COMMAND INFO RAFT.AEB");
+        redisAsyncCommand(node->rc, handleCompressConfigReply, node,
+                "RAFT.CONFIG GET raft-entry-compress-threshold");
+
         NODE_TRACE(node, "Node connection established.\n");
     } else {
         node->state = NODE_CONNECT_ERROR;
@@ -202,6 +239,88 @@ void NodeMarkRemoved(Node *node)
     */
 }
 
+/* Snapshots are delivered over a dedicated bulk connection, so large
+ * RAFT.LOADSNAPSHOT chunks don't delay AppendEntries, votes and proxied
+ * commands queued behind them on the node's main connection.
+ *
+ * The bulk connection is established on demand, when a snapshot needs to be
+ * delivered, using the address the main connection resolved. Its requests are
+ * not tracked as pending responses of the main connection; instead, the bulk
+ * connection is dropped if a request takes longer than raft-response-timeout.
+ */
+
+static void handleBulkConnect(const redisAsyncContext *c, int status)
+{
+    Node *node = (Node *) c->data;
+
+    if (status == REDIS_OK) {
+        node->bulk_state = NODE_CONNECTED;
+        NODE_TRACE(node, "Bulk connection established.\n");
+    } else {
+        NODE_TRACE(node, "Bulk connection failed, status=%d\n", status);
+        node->bulk_state = NODE_CONNECT_ERROR;
+        node->bulk_rc = NULL;
+    }
+}
+
+static void handleBulkDisconnect(const redisAsyncContext *c, int status)
+{
+    Node *node = (Node *) c->data;
+
+    if (node) {
+        node->bulk_state = NODE_DISCONNECTED;
+    }
+}
+
+static void clearBulkContext(void *privdata)
+{
+    Node *node = (Node *) privdata;
+
+    if (node) {
+        node->bulk_rc = NULL;
+        node->bulk_request_time = 0;
+    }
+}
+
+void NodeBulkConnect(Node *node)
+{
+    if (!NODE_IS_CONNECTED(node) || !NODE_STATE_IDLE(node->bulk_state)) {
+        return;
+    }
+
+    NODE_TRACE(node, "NodeBulkConnect() called.\n");
+
+    node->bulk_rc = redisAsyncConnect(node->ipaddr, node->addr.port);
+    if (node->bulk_rc->err) {
+        node->bulk_state = NODE_CONNECT_ERROR;
+        redisAsyncFree(node->bulk_rc);
+        node->bulk_rc = NULL;
+        return;
+    }
+
+    node->bulk_rc->data = node;
+    node->bulk_rc->dataCleanup = clearBulkContext;
+    node->bulk_state = NODE_CONNECTING;
+    node->bulk_request_time = 0;
+
+    redisLibuvAttach(node->bulk_rc, node->rr->loop);
+    redisAsyncSetConnectCallback(node->bulk_rc, handleBulkConnect);
+    redisAsyncSetDisconnectCallback(node->bulk_rc, handleBulkDisconnect);
+}
+
+/* Drops the bulk connection; callbacks of pending requests are called with
+ * no reply.
+ */
+void NodeBulkDisconnect(Node *node)
+{
+    node->bulk_state = NODE_DISCONNECTED;
+    if (node->bulk_rc) {
+        redisAsyncContext *ac = node->bulk_rc;
+        node->bulk_rc = NULL;
+        redisAsyncFree(ac);
+    }
+}
+
 bool NodeConnect(Node *node, RedisRaftCtx *rr, NodeConnectCallbackFunc connect_callback)
 {
     struct addrinfo hints = {
@@ -475,6 +594,12 @@ void HandleNodeStates(RedisRaftCtx *rr)
             }
         }
 
+        if (node->bulk_request_time && rr->config->raft_response_timeout &&
+            node->bulk_request_time + rr->config->raft_response_timeout < RedisModule_Milliseconds()) {
+            NODE_TRACE(node, "Pending bulk response timeout expired, disconnecting.\n");
+            NodeBulkDisconnect(node);
+        }
+
         if (NODE_STATE_IDLE(node->state)) {
             if (node->flags & NODE_TERMINATING) {
                 LIST_REMOVE(node, entries);
@@ -0,0 +1,278 @@
+/*
+ * This file is part of RedisRaft.
+ *
+ * Copyright (c) 2020 Redis Labs
+ *
+ * RedisRaft is dual licensed under the GNU Affero General Public License version 3
+ * (AGPLv3) or the Redis Source Available License (RSAL).
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "redisraft.h"
+
+/* Memory pools for short lived, fixed size objects.
+ *
+ * RaftReq structs and raft_entry_t allocations are created and released for
+ * every command, usually by different threads (e.g. a RaftReq is allocated by
+ * the Redis main thread and released by the Raft thread). A pool keeps a
+ * bounded free list of released objects so they can be reused without going
+ * through the allocator.
+ *
+ * The free list is shared by all threads and protected by a mutex, which is
+ * only held for a couple of pointer operations.
+ */
+
+typedef struct PoolItem {
+    struct PoolItem *next;
+} PoolItem;
+
+void MemPoolInit(MemPool *pool, const char *name, size_t obj_size, unsigned long max_free)
+{
+    memset(pool, 0, sizeof(*pool));
+    pool->name = name;
+    pool->obj_size = obj_size < sizeof(PoolItem) ? sizeof(PoolItem) : obj_size;
+    pool->max_free = max_free;
+    uv_mutex_init(&pool->mutex);
+}
+
+/* Releases all cached objects. The pool must not be used afterwards, unless
+ * it is initialized again.
+ */
+void MemPoolTerm(MemPool *pool)
+{
+    PoolItem *item = pool->free_list;
+    while (item != NULL) {
+        PoolItem *next = item->next;
+        RedisModule_Free(item);
+        item = next;
+    }
+
+    pool->free_list = NULL;
+    pool->num_free = 0;
+    uv_mutex_destroy(&pool->mutex);
+}
+
+/* Returns an uninitialized object of pool->obj_size bytes. */
+void *MemPoolAlloc(MemPool *pool)
+{
+    PoolItem *item;
+
+    uv_mutex_lock(&pool->mutex);
+    pool->allocs++;
+    item = pool->free_list;
+    if (item != NULL) {
+        pool->free_list = item->next;
+        pool->num_free--;
+        pool->hits++;
+    }
+    uv_mutex_unlock(&pool->mutex);
+
+    if (!item) {
+        item = RedisModule_Alloc(pool->obj_size);
+    }
+
+    return item;
+}
+
+void MemPoolFree(MemPool *pool, void *ptr)
+{
+    PoolItem *item = ptr;
+
+    if (!item) {
+        return;
+    }
+
+    uv_mutex_lock(&pool->mutex);
+    pool->frees++;
+    if (pool->num_free < pool->max_free) {
+        item->next = pool->free_list;
+        pool->free_list = item;
+        pool->num_free++;
+        item = NULL;
+    }
+    uv_mutex_unlock(&pool->mutex);
+
+    /* Free list is full */
+    if (item != NULL) {
+        RedisModule_Free(item);
+    }
+}
+
+/* ------------------------------------ Size Classed Heap ------------------------------------ */
+
+/* The Raft library allocates entries (and a few other structs) through the
+ * heap functions provided by raft_set_heap_functions(). These are served
+ * from a set of size classed pools, so an entry of a similar size can reuse
+ * the memory of an entry that was recently released.
+ *
+ * Every allocation is prefixed by a header which records the size class it
+ * was taken from and the requested size, so realloc() can avoid copying when
+ * the new size fits the same class. Allocations larger than the largest class
+ * are passed directly to the Redis allocator.
+ */
+
+#define HEAP_NUM_CLASSES        7
+#define HEAP_MIN_CLASS_SIZE     64
+#define HEAP_MAX_CACHED_BYTES   (1024 * 1024)  /* Per class */
+#define HEAP_NO_CLASS           UINT32_MAX
+
+typedef struct HeapHeader {
+    uint32_t cls;
+    uint32_t size;
+    uint64_t unused;        /* Keep data 16 bytes aligned */
+} HeapHeader;
+
+static MemPool heap_pools[HEAP_NUM_CLASSES];
+static unsigned long heap_oversize_allocs = 0;
+
+static const char *heap_pool_names[HEAP_NUM_CLASSES] = {
+    "heap64", "heap128", "heap256", "heap512", "heap1024", "heap2048", "heap4096"
+};
+
+static uint32_t heapSizeClass(size_t size)
+{
+    size_t total = size + sizeof(HeapHeader);
+    size_t class_size = HEAP_MIN_CLASS_SIZE;
+
+    for (uint32_t i = 0; i < HEAP_NUM_CLASSES; i++) {
+        if (total <= class_size) {
+            return i;
+        }
+        class_size <<= 1;
+    }
+
+    return HEAP_NO_CLASS;
+}
+
+void PoolHeapInit(void)
+{
+    size_t class_size = HEAP_MIN_CLASS_SIZE;
+
+    for (int i = 0; i < HEAP_NUM_CLASSES; i++) {
+        MemPoolInit(&heap_pools[i], heap_pool_names[i], class_size,
+                    HEAP_MAX_CACHED_BYTES / class_size);
+        class_size <<= 1;
+    }
+    heap_oversize_allocs = 0;
+}
+
+void PoolHeapTerm(void)
+{
+    for (int i = 0; i < HEAP_NUM_CLASSES; i++) {
+        MemPoolTerm(&heap_pools[i]);
+    }
+}
+
+void *PoolHeapAlloc(size_t size)
+{
+    uint32_t cls = heapSizeClass(size);
+    HeapHeader *hdr;
+
+    if (cls == HEAP_NO_CLASS) {
+        hdr = RedisModule_Alloc(sizeof(HeapHeader) + size);
+        __atomic_add_fetch(&heap_oversize_allocs, 1, __ATOMIC_RELAXED);
+    } else {
+        hdr = MemPoolAlloc(&heap_pools[cls]);
+    }
+
+    hdr->cls = cls;
+    hdr->size = cls == HEAP_NO_CLASS ? 0 : (uint32_t) size;
+
+    return hdr + 1;
+}
+
+void *PoolHeapCalloc(size_t nmemb, size_t size)
+{
+    /* As calloc(), fail if the total size overflows */
+    if (size && nmemb > SIZE_MAX / size) {
+        return NULL;
+    }
+
+    void *ptr = PoolHeapAlloc(nmemb * size);
+    memset(ptr, 0, nmemb * size);
+
+    return ptr;
+}
+
+void PoolHeapFree(void *ptr)
+{
+    if (!ptr) {
+        return;
+    }
+
+    HeapHeader *hdr = (HeapHeader *) ptr - 1;
+    if (hdr->cls == HEAP_NO_CLASS) {
+        RedisModule_Free(hdr);
+    } else {
+        MemPoolFree(&heap_pools[hdr->cls], hdr);
+    }
+}
+
+void *PoolHeapRealloc(void *ptr, size_t size)
+{
+    if (!ptr) {
+        return PoolHeapAlloc(size);
+    }
+
+    HeapHeader *hdr = (HeapHeader *) ptr - 1;
+
+    /* Oversized allocations stay oversized, so the header doesn't need to
+     * track their size.
+     */
+    if (hdr->cls == HEAP_NO_CLASS) {
+        if (heapSizeClass(size) == HEAP_NO_CLASS) {
+            hdr = RedisModule_Realloc(hdr, sizeof(HeapHeader) + size);
+            return hdr + 1;
+        }
+
+        void *newptr = PoolHeapAlloc(size);
+        memcpy(newptr, ptr, size);
+        RedisModule_Free(hdr);
+        return newptr;
+    }
+
+    if (heapSizeClass(size) == hdr->cls) {
+        hdr->size = (uint32_t) size;
+        return ptr;
+    }
+
+    void *newptr = PoolHeapAlloc(size);
+    memcpy(newptr, ptr, size < hdr->size ? size : hdr->size);
+    PoolHeapFree(ptr);
+
+    return newptr;
+}
+
+/* Aggregated statistics of all heap pools, for RAFT.INFO */
+void PoolHeapGetStats(MemPoolStats *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+
+    for (int i = 0; i < HEAP_NUM_CLASSES; i++) {
+        MemPool *pool = &heap_pools[i];
+
+        uv_mutex_lock(&pool->mutex);
+        stats->allocs += pool->allocs;
+        stats->hits += pool->hits;
+        stats->frees += pool->frees;
+        stats->num_free += pool->num_free;
+        stats->free_bytes += pool->num_free * pool->obj_size;
+        uv_mutex_unlock(&pool->mutex);
+    }
+
+    stats->allocs += __atomic_load_n(&heap_oversize_allocs, __ATOMIC_RELAXED);
+}
+
+void MemPoolGetStats(MemPool *pool, MemPoolStats *stats)
+{
+    uv_mutex_lock(&pool->mutex);
+    stats->allocs = pool->allocs;
+    stats->hits = pool->hits;
+    stats->frees = pool->frees;
+    stats->num_free = pool->num_free;
+    stats->free_bytes = pool->num_free * pool->obj_size;
+    uv_mutex_unlock(&pool->mutex);
+}
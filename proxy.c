@@ -76,6 +76,219 @@ exit:
     RaftReqFree(req);
 }
 
+static void handleReadIndexResponse(redisAsyncContext *c, void *r, void *privdata)
+{
+    RaftReq *req = privdata;
+    redisReply *reply = r;
+
+    redis_raft.proxy_outstanding_reqs--;
+    NodeDismissPendingResponse(req->r.redis.proxy_node);
+
+    if (!reply) {
+        NodeMarkDisconnected(req->r.redis.proxy_node);
+        RedisModule_ReplyWithError(req->ctx, "TIMEOUT no reply from leader");
+        redis_raft.proxy_failed_responses++;
+        goto exit;
+    }
+
+    if (RedisModule_BlockedClientDisconnected(req->ctx)) {
+        goto exit;
+    }
+
+    if (reply->type != REDIS_REPLY_INTEGER) {
+        /* Errors (e.g. -MOVED, -TIMEOUT) are passed to the client as is */
+        if (reply->type == REDIS_REPLY_ERROR) {
+            RedisModule_ReplyWithError(req->ctx, reply->str);
+        } else {
+            RedisModule_ReplyWithError(req->ctx, "ERR bad reply from leader");
+        }
+        goto exit;
+    }
+
+    req->r.redis.read_idx = reply->integer;
+    HandleFollowerRead(&redis_raft, req);
+    return;
+
+exit:
+    RaftReqFree(req);
+}
+
+/* Asks the leader for its read index, so a read-only command can be executed
+ * locally once we've applied the log up to that index.
+ */
+RRStatus ProxyReadIndex(RedisRaftCtx *rr, RaftReq *req, Node *leader)
+{
+    if (!leader->rc || !NODE_IS_CONNECTED(leader)) {
+        redis_raft.proxy_failed_reqs++;
+        return RR_ERROR;
+    }
+
+    req->r.redis.proxy_node = leader;
+    if (redisAsyncCommand(leader->rc, handleReadIndexResponse, req,
+                "RAFT.READINDEX") != REDIS_OK) {
+        redis_raft.proxy_failed_reqs++;
+        return RR_ERROR;
+    }
+
+    NodeAddPendingResponse(leader, true);
+    rr->proxy_reqs++;
+    rr->proxy_outstanding_reqs++;
+
+    return RR_OK;
+}
+
+/* Proxied single commands received while handling the request queue are
+ * coalesced and sent to the leader as a single RAFT.ENTRY, prefixed by the
+ * batch marker rather than bundled as MULTI/EXEC. The leader appends them as a
+ * single entry, executes each command on its own and replies with an array of
+ * individual replies.
+ *
+ * The leader only fails the RAFT.ENTRY as a whole with errors that apply to
+ * every command, e.g. -MOVED or -TIMEOUT, so every client gets that error.
+ */
+
+#define PROXY_BATCH_MAX_CMDS    128
+
+typedef struct ProxyBatch {
+    Node *node;
+    int len;
+    struct rqueue reqs;
+} ProxyBatch;
+
+static void handleProxiedBatchResponse(redisAsyncContext *c, void *r, void *privdata)
+{
+    ProxyBatch *batch = privdata;
+    redisReply *reply = r;
+    RaftReq *req;
+    int i = 0;
+
+    redis_raft.proxy_outstanding_reqs -= batch->len;
+    NodeDismissPendingResponse(batch->node);
+
+    if (!reply) {
+        NodeMarkDisconnected(batch->node);
+        redis_raft.proxy_failed_responses += batch->len;
+    }
+
+    while ((req = STAILQ_FIRST(&batch->reqs)) != NULL) {
+        STAILQ_REMOVE_HEAD(&batch->reqs, entries);
+
+        if (!reply) {
+            RedisModule_ReplyWithError(req->ctx, "TIMEOUT no reply from leader");
+        } else if (RedisModule_BlockedClientDisconnected(req->ctx)) {
+            /* Nothing to reply */
+        } else if (reply->type == REDIS_REPLY_ERROR) {
+            RedisModule_ReplyWithError(req->ctx, reply->str);
+        } else if (reply->type != REDIS_REPLY_ARRAY || reply->elements != batch->len ||
+                   hiredisReplyToModule(reply->element[i], req->ctx) != RR_OK) {
+            RedisModule_ReplyWithError(req->ctx, "ERR bad reply from leader");
+        }
+
+        RaftReqFree(req);
+        i++;
+    }
+
+    RedisModule_Free(batch);
+}
+
+static RRStatus sendProxyBatch(RedisRaftCtx *rr, ProxyBatch *batch)
+{
+    RaftRedisCommand *commands[batch->len + 1];
+    RaftRedisCommandArray array = {
+        .size = batch->len + 1,
+        .len = batch->len + 1,
+        .commands = commands
+    };
+    RaftReq *req;
+    int i = 1;
+
+    commands[0] = RaftRedisCommandBatchMarker();
+    STAILQ_FOREACH(req, &batch->reqs, entries) {
+        commands[i++] = req->r.redis.cmds.commands[0];
+    }
+
+    raft_entry_t *entry = RaftRedisCommandArraySerialize(&array);
+    int ret = redisAsyncCommand(batch->node->rc, handleProxiedBatchResponse,
+        batch, "RAFT.ENTRY %b", entry->data, entry->data_len);
+    raft_entry_release(entry);
+
+    if (ret != REDIS_OK) {
+        return RR_ERROR;
+    }
+
+    NodeAddPendingResponse(batch->node, true);
+    rr->proxy_reqs += batch->len;
+    rr->proxy_outstanding_reqs += batch->len;
+
+    return RR_OK;
+}
+
+/* Sends all proxied commands that are waiting to be batched. */
+void ProxyFlushBatch(RedisRaftCtx *rr)
+{
+    ProxyBatch *batch = rr->proxy_batch;
+    RaftReq *req;
+
+    if (!batch) {
+        return;
+    }
+    rr->proxy_batch = NULL;
+
+    /* A single command is sent as is */
+    if (batch->len == 1) {
+        req = STAILQ_FIRST(&batch->reqs);
+        if (ProxyCommand(rr, req, batch->node) != RR_OK) {
+            RedisModule_ReplyWithError(req->ctx, "NOTLEADER Failed to proxy command");
+            RaftReqFree(req);
+        }
+        RedisModule_Free(batch);
+        return;
+    }
+
+    if (!batch->node->rc || !NODE_IS_CONNECTED(batch->node) ||
+        sendProxyBatch(rr, batch) != RR_OK) {
+        redis_raft.proxy_failed_reqs += batch->len;
+        while ((req = STAILQ_FIRST(&batch->reqs)) != NULL) {
+            STAILQ_REMOVE_HEAD(&batch->reqs, entries);
+            RedisModule_ReplyWithError(req->ctx, "NOTLEADER Failed to proxy command");
+            RaftReqFree(req);
+        }
+        RedisModule_Free(batch);
+    }
+}
+
+/* Queues a command to be proxied to the leader as part of a batch, which is
+ * sent by ProxyFlushBatch().
+ *
+ * Transactions (i.e. MULTI/EXEC, which is a lone MULTI if empty) are sent
+ * immediately, after any batched commands.
+ */
+RRStatus ProxyBatchCommand(RedisRaftCtx *rr, RaftReq *req, Node *leader)
+{
+    if (req->r.redis.cmds.len != 1 || RaftRedisCommandIsMulti(req->r.redis.cmds.commands[0])) {
+        ProxyFlushBatch(rr);
+        return ProxyCommand(rr, req, leader);
+    }
+
+    if (rr->proxy_batch && rr->proxy_batch->node != leader) {
+        ProxyFlushBatch(rr);
+    }
+
+    if (!rr->proxy_batch) {
+        rr->proxy_batch = RedisModule_Calloc(1, sizeof(ProxyBatch));
+        rr->proxy_batch->node = leader;
+        STAILQ_INIT(&rr->proxy_batch->reqs);
+    }
+
+    req->r.redis.proxy_node = leader;
+    STAILQ_INSERT_TAIL(&rr->proxy_batch->reqs, req, entries);
+    if (++rr->proxy_batch->len == PROXY_BATCH_MAX_CMDS) {
+        ProxyFlushBatch(rr);
+    }
+
+    return RR_OK;
+}
+
 RRStatus ProxyCommand(RedisRaftCtx *rr, RaftReq *req, Node *leader)
 {
     /* TODO: Fail if any key is watched. */
@@ -29,13 +29,26 @@ const char *RaftReqTypeStr[] = {
     "RR_INFO",
     "RR_LOADSNAPSHOT",
     "RR_COMPACT",
-    "RR_CLIENT_DISCONNECT"
+    "RR_CLIENT_DISCONNECT",
+    "RR_READINDEX"
 };
 
+/* Pool of released RaftReq structs, see pool.c */
+MemPool RaftReqPool;
+
 /* Forward declarations */
 static void initRaftLibrary(RedisRaftCtx *rr);
 static void configureFromSnapshot(RedisRaftCtx *rr);
 static RaftReqHandler RaftReqHandlers[];
+static void processPendingReads(RedisRaftCtx *rr);
+static void appendRedisCommand(RedisRaftCtx *rr, RaftReq *req);
+static void appendWriteBatch(RedisRaftCtx *rr);
+static bool holdWrite(RedisRaftCtx *rr, RaftReq *req);
+static void appendHeldWrites(RedisRaftCtx *rr);
+static void replyPendingAppendEntries(RedisRaftCtx *rr);
+
+/* Max. number of commands appended as a single entry with raft-write-batching */
+#define WRITE_BATCH_MAX_CMDS    256
 
 static bool processExiting = false;
 static void __setProcessExiting(void) {
@@ -150,12 +163,15 @@ static void executeRaftRedisCommandArray(RaftRedisCommandArray *array,
         size_t cmdlen;
         const char *cmd = RedisModule_StringPtrLen(c->argv[0], &cmdlen);
 
-        /* We need to handle MULTI as a special case:
+        /* We need to handle MULTI and batches as a special case:
         * 1. Skip the command (no need to execute MULTI in a Module context).
         * 2. If we're returning a response, group it as an array (multibulk).
+        *
+        * The commands of a batch are executed one by one, each replying on
+        * its own like in a transaction.
         */
 
-        if (i == 0 && cmdlen == 5 && !strncasecmp(cmd, "MULTI", 5)) {
+        if (i == 0 && (RaftRedisCommandIsMulti(c) || RaftRedisCommandArrayIsBatch(array))) {
             if (reply_ctx) {
                 RedisModule_ReplyWithArray(reply_ctx, array->len - 1);
             }
@@ -188,46 +204,258 @@ static void executeRaftRedisCommandArray(RaftRedisCommandArray *array,
  * There are two variants:
  * 1) Execution of a raft entry received from another node.
  * 2) Execution of a locally initiated command.
+ *
+ * Entries are applied in batches: the Redis lock is acquired by the first
+ * entry and held until APPLY_BATCH_MAX_ENTRIES entries have been applied,
+ * APPLY_BATCH_MAX_USEC have elapsed or raft_apply_all() returns. Clients
+ * are unblocked only after the lock is released.
  */
 
+#define APPLY_BATCH_MAX_ENTRIES     1024
+#define APPLY_BATCH_MAX_USEC        1000
+
+static void beginApplyBatch(RedisRaftCtx *rr)
+{
+    if (rr->apply_locked) {
+        return;
+    }
+
+    RedisModule_ThreadSafeContextLock(rr->ctx);
+    rr->apply_locked = true;
+    rr->apply_batch_count = 0;
+    rr->apply_batch_start = uv_hrtime();
+}
+
+static void endApplyBatch(RedisRaftCtx *rr)
+{
+    RaftReq *req;
+
+    if (!rr->apply_locked) {
+        return;
+    }
+
+    RedisModule_ThreadSafeContextUnlock(rr->ctx);
+    rr->apply_locked = false;
+    HistogramRecord(&rr->latency.apply_lock_hold,
+            (uv_hrtime() - rr->apply_batch_start) / 1000);
+
+    while ((req = STAILQ_FIRST(&rr->applied_reqs)) != NULL) {
+        STAILQ_REMOVE_HEAD(&rr->applied_reqs, entries);
+        RaftReqFree(req);
+    }
+}
+
+static bool applyBatchFull(RedisRaftCtx *rr)
+{
+    return rr->apply_batch_count >= APPLY_BATCH_MAX_ENTRIES ||
+           uv_hrtime() - rr->apply_batch_start >= APPLY_BATCH_MAX_USEC * 1000;
+}
+
+/* Commit latency tracking.
+ *
+ * The time the commit index is seen advancing is kept until all entries up
+ * to it are applied, so the time every entry waited to be applied can be
+ * measured. If more than COMMIT_MARKS_LEN advances are pending, the last one
+ * is extended, which only overestimates latency of the newer entries.
+ */
+static void recordCommitIdx(RedisRaftCtx *rr)
+{
+    raft_index_t idx = raft_get_commit_idx(rr->raft);
+
+    if (idx <= raft_get_last_applied_idx(rr->raft)) {
+        return;
+    }
+
+    if (rr->commit_marks_num > 0) {
+        CommitMark *last = &rr->commit_marks[(rr->commit_marks_first + rr->commit_marks_num - 1)
+                                             % COMMIT_MARKS_LEN];
+        if (last->idx >= idx) {
+            return;
+        }
+        if (rr->commit_marks_num == COMMIT_MARKS_LEN) {
+            last->idx = idx;
+            return;
+        }
+    }
+
+    CommitMark *mark = &rr->commit_marks[(rr->commit_marks_first + rr->commit_marks_num)
+                                         % COMMIT_MARKS_LEN];
+    mark->idx = idx;
+    mark->time = uv_hrtime();
+    rr->commit_marks_num++;
+}
+
+static void recordEntryApplied(RedisRaftCtx *rr, raft_index_t idx)
+{
+    while (rr->commit_marks_num > 0 &&
+           rr->commit_marks[rr->commit_marks_first].idx < idx) {
+        rr->commit_marks_first = (rr->commit_marks_first + 1) % COMMIT_MARKS_LEN;
+        rr->commit_marks_num--;
+    }
+
+    if (rr->commit_marks_num > 0) {
+        CommitMark *mark = &rr->commit_marks[rr->commit_marks_first];
+        HistogramRecord(&rr->latency.commit_to_apply, (uv_hrtime() - mark->time) / 1000);
+    }
+}
+
+/* Returns the last entry known to be durable in the local log. */
+static raft_index_t getSyncedIdx(RedisRaftCtx *rr)
+{
+    return rr->log ? rr->log->synced_idx : raft_get_current_idx(rr->raft);
+}
+
+/* Returns the commit index, limited to entries that are durable on a majority
+ * of the voters.
+ *
+ * The leader sends entries to followers while it syncs them to its own log,
+ * but the Raft library counts the leader's copy as soon as it's appended.  So
+ * until the local sync completes, an entry is committed only if a majority of
+ * the voters other than us acknowledged it, as followers acknowledge entries
+ * once they're durable.
+ */
+static raft_index_t getDurableCommitIdx(RedisRaftCtx *rr)
+{
+    raft_index_t commit_idx = raft_get_commit_idx(rr->raft);
+
+    if (!rr->log || !raft_is_leader(rr->raft) || commit_idx <= rr->log->synced_idx) {
+        return commit_idx;
+    }
+
+    int num_nodes = raft_get_num_nodes(rr->raft);
+    raft_index_t match[num_nodes];
+    int voters = 0;
+    int i, j;
+
+    /* Match indexes of the other voters, in descending order */
+    for (i = 0; i < num_nodes; i++) {
+        raft_node_t *rn = raft_get_node_from_idx(rr->raft, i);
+        if (raft_get_nodeid(rr->raft) == raft_node_get_id(rn) || !raft_node_is_voting(rn)) {
+            continue;
+        }
+
+        raft_index_t idx = raft_node_get_match_idx(rn);
+        for (j = voters++; j > 0 && match[j - 1] < idx; j--) {
+            match[j] = match[j - 1];
+        }
+        match[j] = idx;
+    }
+
+    raft_index_t durable_idx = rr->log->synced_idx;
+    int quorum = raft_get_num_voting_nodes(rr->raft) / 2 + 1;
+    if (voters >= quorum && match[quorum - 1] > durable_idx) {
+        durable_idx = match[quorum - 1];
+    }
+
+    return durable_idx < commit_idx ? durable_idx : commit_idx;
+}
+
+/* Returns false if we're the leader and the commit index includes entries
+ * that are not durable on a majority yet (see getDurableCommitIdx()).
+ *
+ * Such entries must not be applied, as clients are replied to when they are.
+ */
+static bool isCommitIdxSynced(RedisRaftCtx *rr)
+{
+    return getDurableCommitIdx(rr) == raft_get_commit_idx(rr->raft);
+}
+
+static void processPendingAcks(RedisRaftCtx *rr);
+static void ackRedisCommand(RedisRaftCtx *rr, RaftReq *req, raft_entry_t *entry);
+
+/* Applies all committed entries, and releases the Redis lock if it was
+ * acquired in the process.
+ */
+static int applyCommittedEntries(RedisRaftCtx *rr)
+{
+    if (!isCommitIdxSynced(rr)) {
+        return 0;
+    }
+
+    recordCommitIdx(rr);
+    processPendingAcks(rr);
+
+    int ret = raft_apply_all(rr->raft);
+    endApplyBatch(rr);
+    processPendingReads(rr);
+
+    return ret;
+}
+
 static void executeLogEntry(RedisRaftCtx *rr, raft_entry_t *entry, raft_index_t entry_idx)
 {
-    assert(entry->type == RAFT_LOGTYPE_NORMAL);
+    assert(entry->type == RAFT_LOGTYPE_NORMAL || entry->type == RAFT_LOGTYPE_COMPRESSED);
 
-    /* TODO: optimize and avoid deserialization here, we can use the
-     * original argv in RaftReq
+    RaftReq *req = entry->user_data;
+
+    /* Applied before its acknowledgment level was reached, e.g. by
+     * raft_periodic(). Acknowledge now, then apply it as if detached.
      */
+    if (req && req->r.redis.ack != RAFT_ACK_APPLIED) {
+        STAILQ_REMOVE(&rr->pending_acks, req, RaftReq, entries);
+        ackRedisCommand(rr, req, entry);
+        STAILQ_INSERT_TAIL(&rr->applied_reqs, req, entries);
+        req = NULL;
+    }
 
+    RedisModuleCtx *ctx = req ? req->ctx : rr->ctx;
+
+    /* If the entry originated locally, the request is still attached and
+     * holds the original commands, so there's no need to deserialize.
+     */
     RaftRedisCommandArray entry_cmds = { 0 };
-    if (RaftRedisCommandArrayDeserialize(&entry_cmds, entry->data, entry->data_len) != RR_OK) {
+    RaftRedisCommandArray *cmds = &entry_cmds;
+
+    if (req) {
+        cmds = &req->r.redis.cmds;
+    } else if (RaftEntryIsCompressed(entry)) {
+        raft_entry_t *decompressed = RaftEntryDecompress(entry);
+        if (!decompressed ||
+            RaftRedisCommandArrayDeserialize(&entry_cmds, decompressed->data, decompressed->data_len) != RR_OK) {
+            PANIC("Invalid Raft entry");
+        }
+        raft_entry_release(decompressed);
+    } else if (RaftRedisCommandArrayDeserialize(&entry_cmds, entry->data, entry->data_len) != RR_OK) {
         PANIC("Invalid Raft entry");
     }
 
-    RaftReq *req = entry->user_data;
-    RedisModuleCtx *ctx = req ? req->ctx : rr->ctx;
-
     /* Redis Module API requires commands executing on a locked thread
      * safe context.
      */
 
-    RedisModule_ThreadSafeContextLock(ctx);
-    executeRaftRedisCommandArray(&entry_cmds, ctx, req? req->ctx : NULL);
+    beginApplyBatch(rr);
+    executeRaftRedisCommandArray(cmds, ctx, req? req->ctx : NULL);
+
+    /* Commands that were batched into this entry reply to their own clients */
+    if (req) {
+        RaftReq *b;
+        STAILQ_FOREACH(b, &req->r.redis.batch, entries) {
+            executeRaftRedisCommandArray(&b->r.redis.cmds, b->ctx, b->ctx);
+        }
+    }
 
-    /* Update snapshot info in Redis dataset. This must be done now so it's
-     * always consistent with what we applied and we never end up applying
-     * an entry onto a snapshot where it was applied already.
+    /* Update snapshot info in Redis dataset. This must be done while the
+     * lock is held so it's always consistent with what we applied and we
+     * never end up applying an entry onto a snapshot where it was applied
+     * already.
      */
     rr->snapshot_info.last_applied_term = entry->term;
     rr->snapshot_info.last_applied_idx = entry_idx;
 
-    RedisModule_ThreadSafeContextUnlock(ctx);
+    recordEntryApplied(rr, entry_idx);
+
     RaftRedisCommandArrayFree(&entry_cmds);
 
     if (req) {
-        /* Free request now, we don't need it anymore */
+        /* Release request when the batch ends, we don't need it anymore */
         entry->user_data = NULL;
         rr->client_attached_entries--;
-        RaftReqFree(req);
+        STAILQ_INSERT_TAIL(&rr->applied_reqs, req, entries);
+    }
+
+    rr->apply_batch_count++;
+    if (applyBatchFull(rr)) {
+        endApplyBatch(rr);
     }
 }
 
@@ -309,6 +537,112 @@ static int raftSendRequestVote(raft_server_t *raft, void *user_data,
 
 /* ------------------------------------ AppendEntries ------------------------------------ */
 
+#define AE_PIPELINE_MAX_ENTRIES     1024
+
+static void pipelineAppendEntries(RedisRaftCtx *rr, Node *node, raft_node_t *raft_node);
+static void sendCommitIdx(RedisRaftCtx *rr);
+
+/* ------------------------------------ Leader Lease ------------------------------------ */
+
+/* A node that acknowledges an AppendEntries message will not elect a new leader
+ * for at least election_timeout after it received it. The leader holds a lease
+ * while this applies to a majority of voting nodes, counting from the time the
+ * message was sent and allowing for some clock drift.
+ */
+
+#define LEASE_CLOCK_DRIFT_PERCENT   10
+
+static void recordAppendEntriesSent(RedisRaftCtx *rr, msg_appendentries_t *msg)
+{
+    AESendTime *st = &rr->ae_send_times[msg->msg_id % AE_SEND_TIMES_LEN];
+
+    /* Pipelined messages reuse the msg_id, keep the earliest send time */
+    if (st->time && st->msg_id == msg->msg_id && st->term == msg->term) {
+        return;
+    }
+
+    st->msg_id = msg->msg_id;
+    st->term = msg->term;
+    st->time = uv_hrtime();
+}
+
+static void recordAppendEntriesAck(RedisRaftCtx *rr, Node *node,
+        msg_appendentries_response_t *response)
+{
+    AESendTime *st = &rr->ae_send_times[response->msg_id % AE_SEND_TIMES_LEN];
+
+    if (response->term != raft_get_current_term(rr->raft) ||
+        st->msg_id != response->msg_id || st->term != response->term) {
+        return;
+    }
+
+    /* Pipelined messages are measured from the first one sent */
+    HistogramRecord(&rr->latency.replication_rtt, (uv_hrtime() - st->time) / 1000);
+
+    if (node->lease_ack_term != st->term || node->lease_ack_time < st->time) {
+        node->lease_ack_term = st->term;
+        node->lease_ack_time = st->time;
+    }
+}
+
+/* Returns true if we hold a valid leader lease, so reads may be served locally
+ * without confirming leadership with a quorum.
+ */
+static bool checkLeaderLease(RedisRaftCtx *rr)
+{
+    raft_term_t term = raft_get_current_term(rr->raft);
+    raft_index_t commit_idx = raft_get_commit_idx(rr->raft);
+    uint64_t lease_duration = (uint64_t) rr->config->election_timeout *
+        (100 - LEASE_CLOCK_DRIFT_PERCENT) / 100 * 1000000;
+    uint64_t now = uv_hrtime();
+    int voters = 0;
+    int acked = 0;
+    int i;
+
+    if (!raft_is_leader(rr->raft)) {
+        return false;
+    }
+
+    /* Our state is only known to be up to date once an entry of the current
+     * term was committed and everything committed was applied.
+     */
+    if (raft_get_last_applied_idx(rr->raft) < commit_idx) {
+        return false;
+    }
+
+    raft_entry_t *entry = raft_get_entry_from_idx(rr->raft, commit_idx);
+    if (!entry) {
+        return false;
+    }
+    bool committed_in_term = entry->term == term;
+    raft_entry_release(entry);
+
+    if (!committed_in_term) {
+        return false;
+    }
+
+    for (i = 0; i < raft_get_num_nodes(rr->raft); i++) {
+        raft_node_t *rn = raft_get_node_from_idx(rr->raft, i);
+        if (!raft_node_is_voting(rn)) {
+            continue;
+        }
+
+        voters++;
+        if (raft_node_get_id(rn) == raft_get_nodeid(rr->raft)) {
+            acked++;
+            continue;
+        }
+
+        Node *node = raft_node_get_udata(rn);
+        if (node && node->lease_ack_term == term &&
+            now < node->lease_ack_time + lease_duration) {
+            acked++;
+        }
+    }
+
+    return acked > voters / 2;
+}
+
 static void handleAppendEntriesResponse(redisAsyncContext *c, void *r, void *privdata)
 {
     Node *node = privdata;
@@ -343,6 +677,9 @@ static void handleAppendEntriesResponse(redisAsyncContext *c, void *r, void *pri
     };
 
     raft_node_t *raft_node = raft_get_node(rr->raft, node->id);
+    raft_index_t commit_idx = getDurableCommitIdx(rr);
+
+    recordAppendEntriesAck(rr, node, &response);
 
     int ret;
     if ((ret = raft_recv_appendentries_response(
@@ -352,24 +689,78 @@ static void handleAppendEntriesResponse(redisAsyncContext *c, void *r, void *pri
         NODE_TRACE(node, "raft_recv_appendentries_response failed, error %d\n", ret);
     }
 
+    /* Entries that were pipelined following a rejected message are rejected
+     * as well, so we stop pipelining until the node is in sync again.
+     */
+    if (!response.success) {
+        node->ae_pipeline_idx = 0;
+    } else if (raft_node) {
+        pipelineAppendEntries(rr, node, raft_node);
+    }
+
     /* Maybe we have pending stuff to apply now */
-    raft_apply_all(rr->raft);
+    applyCommittedEntries(rr);
     raft_process_read_queue(rr->raft);
+
+    if (getDurableCommitIdx(rr) > commit_idx) {
+        sendCommitIdx(rr);
+    }
 }
 
-static int raftSendAppendEntries(raft_server_t *raft, void *user_data,
+/* Sends AppendEntries using RAFT.AEB, where the entire message is packed
+ * into a single argument.
+ *
+ * The command is formatted here, with the message serialized in place, so
+ * entry data is copied once into the command and once more by hiredis into
+ * its output buffer. Formatting it with redisAsyncCommandArgv() would copy
+ * it into an intermediate buffer first.
+ */
+static RRStatus sendAppendEntriesBinary(raft_server_t *raft, Node *node,
         raft_node_t *raft_node, msg_appendentries_t *msg)
 {
-    Node *node = (Node *) raft_node_get_udata(raft_node);
+    char target_node_str[12];
+    char source_node_str[12];
+    char header[128];
+    RRStatus ret = RR_OK;
+
+    snprintf(target_node_str, sizeof(target_node_str), "%d", raft_node_get_id(raft_node));
+    snprintf(source_node_str, sizeof(source_node_str), "%d", raft_get_nodeid(raft));
+
+    size_t msg_len = RaftAppendEntriesSerializedSize(msg);
+    int header_len = snprintf(header, sizeof(header),
+            "*4\r\n$8\r\nRAFT.AEB\r\n$%zu\r\n%s\r\n$%zu\r\n%s\r\n$%zu\r\n",
+            strlen(target_node_str), target_node_str,
+            strlen(source_node_str), source_node_str,
+            msg_len);
+
+    size_t cmd_len = header_len + msg_len + 2;
+    char *cmd = RedisModule_Alloc(cmd_len);
+    memcpy(cmd, header, header_len);
+
+    char *p = RaftAppendEntriesSerializeTo(msg, cmd + header_len);
+    memcpy(p, "\r\n", 2);
+    assert(p + 2 - cmd == cmd_len);
+
+    if (redisAsyncFormattedCommand(node->rc, handleAppendEntriesResponse,
+                node, cmd, cmd_len) != REDIS_OK) {
+        NODE_TRACE(node, "failed appendentries");
+        ret = RR_ERROR;
+    } else {
+        NodeAddPendingResponse(node, false);
+    }
+
+    RedisModule_Free(cmd);
+    return ret;
+}
 
+/* Sends AppendEntries using RAFT.AE, where every entry takes two arguments. */
+static RRStatus sendAppendEntriesText(raft_server_t *raft, Node *node,
+        raft_node_t *raft_node, msg_appendentries_t *msg)
+{
     int argc = 5 + msg->n_entries * 2;
     char *argv[argc];
     size_t argvlen[argc];
-
-    if (!NODE_IS_CONNECTED(node)) {
-        NODE_TRACE(node, "not connected, state=%s\n", NodeStateStr[node->state]);
-        return 0;
-    }
+    RRStatus ret = RR_OK;
 
     char target_node_str[12];
     char source_node_str[12];
@@ -408,6 +799,7 @@ static int raftSendAppendEntries(raft_server_t *raft, void *user_data,
     if (redisAsyncCommandArgv(node->rc, handleAppendEntriesResponse,
                 node, argc, (const char **)argv, argvlen) != REDIS_OK) {
         NODE_TRACE(node, "failed appendentries");
+        ret = RR_ERROR;
     } else{
         NodeAddPendingResponse(node, false);
     }
@@ -415,6 +807,294 @@ static int raftSendAppendEntries(raft_server_t *raft, void *user_data,
     for (i = 0; i < msg->n_entries; i++) {
         RedisModule_Free(argv[5 + i*2]);
     }
+    return ret;
+}
+
+/* Returns the message entries with compressed entries replaced by
+ * decompressed copies, or NULL if none is compressed. The caller should
+ * release the returned entries.
+ */
+static raft_entry_t **decompressEntries(msg_appendentries_t *msg)
+{
+    raft_entry_t **entries = NULL;
+    int i;
+
+    for (i = 0; i < msg->n_entries; i++) {
+        if (RaftEntryIsCompressed(msg->entries[i])) {
+            break;
+        }
+    }
+    if (i == msg->n_entries) {
+        return NULL;
+    }
+
+    entries = RedisModule_Calloc(msg->n_entries, sizeof(entries[0]));
+    for (i = 0; i < msg->n_entries; i++) {
+        raft_entry_t *e = msg->entries[i];
+
+        if (RaftEntryIsCompressed(e)) {
+            if (!(entries[i] = RaftEntryDecompress(e))) {
+                PANIC("Invalid compressed Raft entry");
+            }
+        } else {
+            raft_entry_hold(e);
+            entries[i] = e;
+        }
+    }
+
+    return entries;
+}
+
+static RRStatus sendAppendEntries(raft_server_t *raft, Node *node,
+        raft_node_t *raft_node, msg_appendentries_t *msg)
+{
+    msg_appendentries_t decompressed_msg;
+    raft_entry_t **decompressed = NULL;
+    RRStatus ret;
+
+    recordAppendEntriesSent(node->rr, msg);
+    node->ae_last_send_time = uv_hrtime();
+    node->ae_commit_sent = msg->leader_commit;
+
+    /* Nodes running an older version can't apply compressed entries, so
+     * they get them decompressed.
+     */
+    if (!(node->flags & NODE_COMPRESSED_AE) && (decompressed = decompressEntries(msg))) {
+        decompressed_msg = *msg;
+        decompressed_msg.entries = decompressed;
+        msg = &decompressed_msg;
+    }
+
+    if (node->flags & NODE_BINARY_AE) {
+        ret = sendAppendEntriesBinary(raft, node, raft_node, msg);
+    } else {
+        ret = sendAppendEntriesText(raft, node, raft_node, msg);
+    }
+
+    if (decompressed) {
+        for (int i = 0; i < msg->n_entries; i++) {
+            raft_entry_release(decompressed[i]);
+        }
+        RedisModule_Free(decompressed);
+    }
+
+    return ret;
+}
+
+/* AppendEntries pipelining.
+ *
+ * The Raft library sends a node new entries only after it has acknowledged
+ * the previous ones, so there's a single AppendEntries message in flight.
+ * When raft-ae-pipeline-depth is greater than one, we send additional
+ * messages with entries that follow the last one sent, without waiting.
+ *
+ * node->ae_pipeline_idx tracks the last entry sent to the node.  It is only
+ * meaningful while messages are in flight in the current term and is reset
+ * when a message is rejected, in which case the library takes over to find
+ * a matching index.
+ */
+
+static raft_index_t getPipelineIdx(RedisRaftCtx *rr, Node *node)
+{
+    if (!node->pending_raft_response_num ||
+        node->ae_pipeline_term != raft_get_current_term(rr->raft) ||
+        node->ae_pipeline_idx > raft_get_current_idx(rr->raft)) {
+        return 0;
+    }
+
+    return node->ae_pipeline_idx;
+}
+
+static void setPipelineIdx(RedisRaftCtx *rr, Node *node, raft_index_t idx)
+{
+    if (idx > getPipelineIdx(rr, node)) {
+        node->ae_pipeline_idx = idx;
+        node->ae_pipeline_term = raft_get_current_term(rr->raft);
+    }
+}
+
+static void pipelineAppendEntries(RedisRaftCtx *rr, Node *node, raft_node_t *raft_node)
+{
+    int depth = rr->config->raft_ae_pipeline_depth;
+
+    if (depth <= 1 || !raft_is_leader(rr->raft) || !NODE_IS_CONNECTED(node)) {
+        return;
+    }
+
+    /* Only pipeline if the node is known to be in sync.  Otherwise the library
+     * is still looking for a matching index.
+     */
+    raft_index_t next_idx = raft_node_get_next_idx(raft_node);
+    if (raft_node_get_match_idx(raft_node) != next_idx - 1) {
+        return;
+    }
+
+    raft_index_t sent_idx = getPipelineIdx(rr, node);
+    if (sent_idx < next_idx - 1) {
+        sent_idx = next_idx - 1;
+    }
+
+    raft_index_t current_idx = raft_get_current_idx(rr->raft);
+    while (node->pending_raft_response_num < depth && sent_idx < current_idx) {
+        raft_term_t prev_term;
+
+        if (sent_idx == raft_get_snapshot_last_idx(rr->raft)) {
+            prev_term = raft_get_snapshot_last_term(rr->raft);
+        } else {
+            raft_entry_t *prev = raft_get_entry_from_idx(rr->raft, sent_idx);
+            if (!prev) {
+                return;
+            }
+            prev_term = prev->term;
+            raft_entry_release(prev);
+        }
+
+        int n = current_idx - sent_idx;
+        if (n > AE_PIPELINE_MAX_ENTRIES) {
+            n = AE_PIPELINE_MAX_ENTRIES;
+        }
+
+        raft_entry_t *entries[n];
+        n = RaftLogImpl.get_batch(rr, sent_idx + 1, n, entries);
+        if (!n) {
+            return;
+        }
+
+        msg_appendentries_t msg = {
+            .term = raft_get_current_term(rr->raft),
+            .prev_log_idx = sent_idx,
+            .prev_log_term = prev_term,
+            .leader_commit = getDurableCommitIdx(rr),
+            .msg_id = node->ae_last_msg_id,
+            .n_entries = n,
+            .entries = entries
+        };
+
+        RRStatus ret = sendAppendEntries(rr->raft, node, raft_node, &msg);
+
+        int i;
+        for (i = 0; i < n; i++) {
+            raft_entry_release(entries[i]);
+        }
+
+        if (ret != RR_OK) {
+            return;
+        }
+
+        sent_idx += n;
+        setPipelineIdx(rr, node, sent_idx);
+    }
+}
+
+/* Lets followers know the commit index advanced, so they apply committed
+ * entries right away rather than on the next heartbeat.
+ *
+ * Nodes still waiting for a response get the new commit index with the next
+ * message we send them, so this only sends an AppendEntries to idle nodes.
+ * This limits the extra messages to one per node and round trip.
+ */
+static void sendCommitIdx(RedisRaftCtx *rr)
+{
+    raft_index_t commit_idx = getDurableCommitIdx(rr);
+
+    if (!raft_is_leader(rr->raft)) {
+        return;
+    }
+
+    for (int i = 0; i < raft_get_num_nodes(rr->raft); i++) {
+        raft_node_t *rn = raft_get_node_from_idx(rr->raft, i);
+        Node *node = raft_node_get_udata(rn);
+
+        if (node && raft_get_nodeid(rr->raft) != raft_node_get_id(rn) &&
+            NODE_IS_CONNECTED(node) && !node->pending_raft_response_num &&
+            !node->load_snapshot_in_progress && node->ae_commit_sent < commit_idx) {
+            raft_send_appendentries(rr->raft, rn);
+        }
+    }
+}
+
+/* Sends an AppendEntries to idle nodes we haven't sent anything to for half
+ * the request timeout, while raft_periodic() is held back and doesn't send
+ * heartbeats (see callRaftPeriodic()).
+ */
+static void sendHeartbeats(RedisRaftCtx *rr)
+{
+    uint64_t heartbeat_nsec = (uint64_t) rr->config->request_timeout * 1000000 / 2;
+    uint64_t now = uv_hrtime();
+
+    if (!raft_is_leader(rr->raft)) {
+        return;
+    }
+
+    for (int i = 0; i < raft_get_num_nodes(rr->raft); i++) {
+        raft_node_t *rn = raft_get_node_from_idx(rr->raft, i);
+        Node *node = raft_node_get_udata(rn);
+
+        if (node && raft_get_nodeid(rr->raft) != raft_node_get_id(rn) &&
+            NODE_IS_CONNECTED(node) && !node->pending_raft_response_num &&
+            !node->load_snapshot_in_progress &&
+            now - node->ae_last_send_time >= heartbeat_nsec) {
+            raft_send_appendentries(rr->raft, rn);
+        }
+    }
+}
+
+/* Pipelines new entries to all nodes; called after entries are appended. */
+static void pipelineAppendEntriesAll(RedisRaftCtx *rr)
+{
+    int i;
+
+    if (rr->config->raft_ae_pipeline_depth <= 1) {
+        return;
+    }
+
+    for (i = 0; i < raft_get_num_nodes(rr->raft); i++) {
+        raft_node_t *rn = raft_get_node_from_idx(rr->raft, i);
+        Node *node = raft_node_get_udata(rn);
+
+        if (node && raft_get_nodeid(rr->raft) != raft_node_get_id(rn)) {
+            pipelineAppendEntries(rr, node, rn);
+        }
+    }
+}
+
+static int raftSendAppendEntries(raft_server_t *raft, void *user_data,
+        raft_node_t *raft_node, msg_appendentries_t *msg)
+{
+    RedisRaftCtx *rr = user_data;
+    Node *node = (Node *) raft_node_get_udata(raft_node);
+
+    if (!NODE_IS_CONNECTED(node)) {
+        NODE_TRACE(node, "not connected, state=%s\n", NodeStateStr[node->state]);
+        return 0;
+    }
+
+    /* Don't resend entries that were already pipelined */
+    msg_appendentries_t m = *msg;
+    raft_index_t sent_idx = getPipelineIdx(rr, node);
+    if (sent_idx > m.prev_log_idx && m.n_entries > 0) {
+        int skip = sent_idx - m.prev_log_idx;
+        if (skip > m.n_entries) {
+            skip = m.n_entries;
+        }
+
+        m.prev_log_idx += skip;
+        m.prev_log_term = m.entries[skip - 1]->term;
+        m.entries += skip;
+        m.n_entries -= skip;
+    }
+
+    /* Entries are sent before they're synced locally, but followers only
+     * learn they're committed once they're durable on a majority.
+     */
+    m.leader_commit = getDurableCommitIdx(rr);
+
+    node->ae_last_msg_id = msg->msg_id;
+    if (sendAppendEntries(raft, node, raft_node, &m) == RR_OK) {
+        setPipelineIdx(rr, node, m.prev_log_idx + m.n_entries);
+        pipelineAppendEntries(rr, node, raft_node);
+    }
+
     return 0;
 }
 
@@ -453,6 +1133,11 @@ static int raftApplyLog(raft_server_t *raft, void *user_data, raft_entry_t *entr
     RedisRaftCtx *rr = user_data;
     RaftCfgChange *req;
 
+    /* Don't hold the Redis lock while processing configuration changes */
+    if (entry->type != RAFT_LOGTYPE_NORMAL && entry->type != RAFT_LOGTYPE_COMPRESSED) {
+        endApplyBatch(rr);
+    }
+
     switch (entry->type) {
         case RAFT_LOGTYPE_DEMOTE_NODE:
             if (rr->state == REDIS_RAFT_UP && raft_is_leader(rr->raft)) {
@@ -476,6 +1161,7 @@ static int raftApplyLog(raft_server_t *raft, void *user_data, raft_entry_t *entr
             }
             break;
         case RAFT_LOGTYPE_NORMAL:
+        case RAFT_LOGTYPE_COMPRESSED:
             executeLogEntry(rr, entry, entry_idx);
             break;
         default:
@@ -698,7 +1384,7 @@ RRStatus applyLoadedRaftLog(RedisRaftCtx *rr)
     raft_set_snapshot_metadata(rr->raft, rr->snapshot_info.last_applied_term,
             rr->snapshot_info.last_applied_idx);
 
-    raft_apply_all(rr->raft);
+    applyCommittedEntries(rr);
 
     raft_set_current_term(rr->raft, rr->log->term);
     raft_vote_for_nodeid(rr->raft, rr->log->vote);
@@ -785,6 +1471,37 @@ static void handleLoadingState(RedisRaftCtx *rr)
     }
 }
 
+/* Returns the lowest log index that is still needed: the next index to be
+ * applied or, on a leader, the next index of the slowest connected follower.
+ * Disconnected followers are not considered, as there is no telling when
+ * they'll return.
+ */
+static raft_index_t getCacheKeepIdx(RedisRaftCtx *rr)
+{
+    raft_index_t keep_idx = raft_get_last_applied_idx(rr->raft) + 1;
+
+    if (!raft_is_leader(rr->raft)) {
+        return keep_idx;
+    }
+
+    int num_nodes = raft_get_num_nodes(rr->raft);
+    for (int i = 0; i < num_nodes; i++) {
+        raft_node_t *rnode = raft_get_node_from_idx(rr->raft, i);
+        Node *node = raft_node_get_udata(rnode);
+
+        if (rnode == raft_get_my_node(rr->raft) || !node || !NODE_IS_CONNECTED(node)) {
+            continue;
+        }
+
+        raft_index_t next_idx = raft_node_get_next_idx(rnode);
+        if (next_idx < keep_idx) {
+            keep_idx = next_idx;
+        }
+    }
+
+    return keep_idx;
+}
+
 static void callRaftPeriodic(uv_timer_t *handle)
 {
     RedisRaftCtx *rr = (RedisRaftCtx *) uv_handle_get_data((uv_handle_t *) handle);
@@ -820,9 +1537,18 @@ static void callRaftPeriodic(uv_timer_t *handle)
         } /* else we're still in progress */
     }
 
-    ret = raft_periodic(rr->raft, rr->config->raft_interval);
-    if (ret == 0) {
-        ret = raft_apply_all(rr->raft);
+    /* raft_periodic() applies committed entries, so it waits until they are
+     * durable on a majority, which may take until they're synced locally.
+     * Meanwhile we still send heartbeats.
+     */
+    ret = 0;
+    if (isCommitIdxSynced(rr)) {
+        ret = raft_periodic(rr->raft, rr->config->raft_interval);
+        if (ret == 0) {
+            ret = applyCommittedEntries(rr);
+        }
+    } else {
+        sendHeartbeats(rr);
     }
 
     if (ret == RAFT_ERR_SHUTDOWN) {
@@ -839,7 +1565,8 @@ static void callRaftPeriodic(uv_timer_t *handle)
 
     /* Compact cache */
     if (rr->config->raft_log_max_cache_size) {
-        EntryCacheCompact(rr->logcache, rr->config->raft_log_max_cache_size);
+        EntryCacheCompact(rr->logcache, rr->config->raft_log_max_cache_size,
+                          getCacheKeepIdx(rr));
     }
 
     /* Initiate snapshot if log size exceeds raft-log-file-max */
@@ -1049,7 +1776,13 @@ static void configureFromSnapshot(RedisRaftCtx *rr)
 RRStatus RedisRaftInit(RedisModuleCtx *ctx, RedisRaftCtx *rr, RedisRaftConfig *config)
 {
     memset(rr, 0, sizeof(RedisRaftCtx));
+    rr->snapshot_recv_fd = -1;
     STAILQ_INIT(&rr->rqueue);
+    STAILQ_INIT(&rr->applied_reqs);
+    STAILQ_INIT(&rr->held_writes);
+    STAILQ_INIT(&rr->pending_acks);
+    STAILQ_INIT(&rr->pending_ae_replies);
+    STAILQ_INIT(&rr->pending_reads);
 
     /* Register an atexit handler to tell us we're exiting.  Redis offers no
      * other way and we need to be aware of this to avoid getting into execution
@@ -1153,6 +1886,12 @@ void RaftReqFree(RaftReq *req)
             if (req->ctx && req->r.redis.cmds.size) {
                 RaftRedisCommandArrayFree(&req->r.redis.cmds);
             }
+            /* Requests batched into the same entry are done as well */
+            while (!STAILQ_EMPTY(&req->r.redis.batch)) {
+                RaftReq *b = STAILQ_FIRST(&req->r.redis.batch);
+                STAILQ_REMOVE_HEAD(&req->r.redis.batch, entries);
+                RaftReqFree(b);
+            }
             // TODO: hold a reference from entry so we can disconnect our req
             break;
         case RR_LOADSNAPSHOT:
@@ -1171,6 +1910,9 @@ void RaftReqFree(RaftReq *req)
                     }
                     break;
                 case RR_DEBUG_SENDSNAPSHOT:
+                    if (req->r.debug.d.sendsnapshot.ids) {
+                        RedisModule_Free(req->r.debug.d.sendsnapshot.ids);
+                    }
                     break;
             }
             break;
@@ -1181,12 +1923,13 @@ void RaftReqFree(RaftReq *req)
 
         RedisModule_UnblockClient(req->client, NULL);
     }
-    RedisModule_Free(req);
+    MemPoolFree(&RaftReqPool, req);
 }
 
 RaftReq *RaftReqInit(RedisModuleCtx *ctx, enum RaftReqType type)
 {
-    RaftReq *req = RedisModule_Calloc(1, sizeof(RaftReq));
+    RaftReq *req = MemPoolAlloc(&RaftReqPool);
+    memset(req, 0, sizeof(RaftReq));
     if (ctx != NULL) {
         req->client = RedisModule_BlockClient(ctx, NULL, NULL, NULL, 0);
         req->ctx = RedisModule_GetThreadSafeContext(req->client);
@@ -1204,41 +1947,120 @@ RaftReq *RaftDebugReqInit(RedisModuleCtx *ctx, enum RaftDebugReqType type)
     RaftReq *req = RaftReqInit(ctx, RR_DEBUG);
     req->r.debug.type = type;
 
-    return req;
+    return req;
+}
+
+void RaftReqSubmit(RedisRaftCtx *rr, RaftReq *req)
+{
+    req->submit_time = uv_hrtime();
+
+    uv_mutex_lock(&rr->rqueue_mutex);
+    bool was_empty = STAILQ_EMPTY(&rr->rqueue);
+    STAILQ_INSERT_TAIL(&rr->rqueue, req, entries);
+    uv_mutex_unlock(&rr->rqueue_mutex);
+
+    /* If the queue was not empty, the Raft thread has not fetched it yet and
+     * was already signaled.
+     */
+    if (was_empty) {
+        uv_async_send(&rr->rqueue_sig);
+    }
+}
+
+/* Moves all queued requests to the specified list, so they can be processed
+ * without holding the lock.
+ */
+static bool raft_req_fetch_all(RedisRaftCtx *rr, struct rqueue *target)
+{
+    uv_mutex_lock(&rr->rqueue_mutex);
+    STAILQ_CONCAT(target, &rr->rqueue);
+    uv_mutex_unlock(&rr->rqueue_mutex);
+
+    return !STAILQ_EMPTY(target);
+}
+
+/* Called once entries appended to the log are synced. */
+static void handleLogSynced(RedisRaftCtx *rr)
+{
+    replyPendingAppendEntries(rr);
+    processPendingAcks(rr);
+
+    if (rr->state != REDIS_RAFT_UP || !raft_is_leader(rr->raft)) {
+        return;
+    }
+
+    /* Entries that followers acknowledged before they were synced here may be
+     * committed now.
+     */
+    applyCommittedEntries(rr);
+    sendCommitIdx(rr);
 }
 
-void RaftReqSubmit(RedisRaftCtx *rr, RaftReq *req)
+/* Called when an asynchronous sync started by commitLogBatch() completes. */
+static void handleLogAsyncSync(void *arg, uint64_t sync_usec)
 {
-    uv_mutex_lock(&rr->rqueue_mutex);
-    STAILQ_INSERT_TAIL(&rr->rqueue, req, entries);
-    uv_mutex_unlock(&rr->rqueue_mutex);
-    uv_async_send(&rr->rqueue_sig);
+    RedisRaftCtx *rr = arg;
+
+    HistogramRecord(&rr->latency.log_batch_sync, sync_usec);
+    handleLogSynced(rr);
+    appendHeldWrites(rr);
 }
 
-static RaftReq *raft_req_fetch(RedisRaftCtx *rr)
+/* Sync all entries appended to the log while draining the request queue.
+ *
+ * With raft-log-async-fsync, the sync is only started here and entries become
+ * durable when it completes, so the Raft thread never waits for the disk.
+ */
+static void commitLogBatch(RedisRaftCtx *rr)
 {
-    RaftReq *r = NULL;
+    if (!rr->log || !rr->log->batch) {
+        return;
+    }
 
-    uv_mutex_lock(&rr->rqueue_mutex);
-    if (!STAILQ_EMPTY(&rr->rqueue)) {
-        r = STAILQ_FIRST(&rr->rqueue);
-        STAILQ_REMOVE_HEAD(&rr->rqueue, entries);
+    if (rr->config->raft_log_async_fsync) {
+        rr->log->batch = false;
+        if (!RaftLogSyncAsync(rr->log, rr->loop, handleLogAsyncSync, rr)) {
+            handleLogSynced(rr);
+        }
+        return;
     }
-    uv_mutex_unlock(&rr->rqueue_mutex);
 
-    return r;
+    bool synced = rr->log->unsynced_entries > 0;
+    uint64_t start = uv_hrtime();
+    if (RaftLogEndBatch(rr->log) != RR_OK) {
+        PANIC("Failed to sync Raft log");
+    }
+    if (synced) {
+        HistogramRecord(&rr->latency.log_batch_sync, (uv_hrtime() - start) / 1000);
+        handleLogSynced(rr);
+    }
 }
 
 void RaftReqHandleQueue(uv_async_t *handle)
 {
     RedisRaftCtx *rr = (RedisRaftCtx *) uv_handle_get_data((uv_handle_t *) handle);
+    struct rqueue reqs = STAILQ_HEAD_INITIALIZER(reqs);
     RaftReq *req;
 
-    while ((req = raft_req_fetch(rr))) {
-        TRACE("RaftReqHandleQueue: req=%p, type=%s\n",
-                req, RaftReqTypeStr[req->type]);
-        RaftReqHandlers[req->type](rr, req);
+    if ((rr->config->raft_log_group_commit || rr->config->raft_log_async_fsync) && rr->log) {
+        RaftLogBeginBatch(rr->log);
+    }
+
+    while (raft_req_fetch_all(rr, &reqs)) {
+        while ((req = STAILQ_FIRST(&reqs)) != NULL) {
+            STAILQ_REMOVE_HEAD(&reqs, entries);
+
+            TRACE("RaftReqHandleQueue: req=%p, type=%s\n",
+                    req, RaftReqTypeStr[req->type]);
+            HistogramRecord(&rr->latency.rqueue_wait,
+                    (uv_hrtime() - req->submit_time) / 1000);
+            RaftReqHandlers[req->type](rr, req);
+        }
     }
+
+    appendWriteBatch(rr);
+    ProxyFlushBatch(rr);
+    commitLogBatch(rr);
 }
 
 /* ------------------------------------ RaftReq Implementation ------------------------------------ */
@@ -1272,6 +2094,15 @@ exit:
 }
 
 
+static void replyAppendEntries(RedisModuleCtx *ctx, msg_appendentries_response_t *response)
+{
+    RedisModule_ReplyWithArray(ctx, 4);
+    RedisModule_ReplyWithLongLong(ctx, response->term);
+    RedisModule_ReplyWithLongLong(ctx, response->success);
+    RedisModule_ReplyWithLongLong(ctx, response->current_idx);
+    RedisModule_ReplyWithLongLong(ctx, response->msg_id);
+}
+
 static void handleAppendEntries(RedisRaftCtx *rr, RaftReq *req)
 {
     msg_appendentries_response_t response;
@@ -1291,16 +2122,53 @@ static void handleAppendEntries(RedisRaftCtx *rr, RaftReq *req)
         goto exit;
     }
 
-    RedisModule_ReplyWithArray(req->ctx, 4);
-    RedisModule_ReplyWithLongLong(req->ctx, response.term);
-    RedisModule_ReplyWithLongLong(req->ctx, response.success);
-    RedisModule_ReplyWithLongLong(req->ctx, response.current_idx);
-    RedisModule_ReplyWithLongLong(req->ctx, response.msg_id);
+    /* Entries must be durable before they are acknowledged to the leader. If
+     * they are synced asynchronously, the reply waits until they are.
+     */
+    if (rr->log && rr->config->raft_log_async_fsync) {
+        req->r.appendentries.response = response;
+        STAILQ_INSERT_TAIL(&rr->pending_ae_replies, req, entries);
+        replyPendingAppendEntries(rr);
+    } else {
+        if (rr->log && RaftLogSyncBatch(rr->log) != RR_OK) {
+            PANIC("Failed to sync Raft log");
+        }
+
+        replyAppendEntries(req->ctx, &response);
+        RaftReqFree(req);
+    }
+
+    /* The message may have advanced the commit index, so apply now rather
+     * than on the next periodic call.
+     */
+    applyCommittedEntries(rr);
+    return;
 
 exit:
     RaftReqFree(req);
 }
 
+/* Replies to AppendEntries requests whose entries are synced, in the order
+ * they were received.
+ */
+static void replyPendingAppendEntries(RedisRaftCtx *rr)
+{
+    RaftReq *req;
+
+    while ((req = STAILQ_FIRST(&rr->pending_ae_replies)) != NULL) {
+        msg_appendentries_response_t *response = &req->r.appendentries.response;
+
+        if (rr->log && response->current_idx > rr->log->synced_idx &&
+            rr->log->synced_idx < rr->log->index) {
+            break;
+        }
+
+        STAILQ_REMOVE_HEAD(&rr->pending_ae_replies, entries);
+        replyAppendEntries(req->ctx, response);
+        RaftReqFree(req);
+    }
+}
+
 static void handleCfgChange(RedisRaftCtx *rr, RaftReq *req)
 {
     raft_entry_t *entry;
@@ -1362,18 +2230,65 @@ exit:
     RaftReqFree(req);
 }
 
+/* Replies with an error to a request and all requests batched with it. */
+static void replyRedisCommandError(RaftReq *req, const char *err)
+{
+    RaftReq *b;
+
+    RedisModule_ReplyWithError(req->ctx, err);
+    STAILQ_FOREACH(b, &req->r.redis.batch, entries) {
+        RedisModule_ReplyWithError(b->ctx, err);
+    }
+}
+
+/* Serializes a request and all requests batched with it into a single entry.
+ * The commands are prefixed by the batch marker rather than bundled as
+ * MULTI/EXEC, so they are executed one after the other exactly as if they were
+ * appended in separate entries.
+ */
+static raft_entry_t *serializeWriteBatch(RaftReq *req)
+{
+    RaftRedisCommandArray array = { 0 };
+    RaftReq *b;
+
+    array.size = 1 + req->r.redis.cmds.len;
+    STAILQ_FOREACH(b, &req->r.redis.batch, entries) {
+        array.size += b->r.redis.cmds.len;
+    }
+    array.commands = RedisModule_Alloc(array.size * sizeof(RaftRedisCommand *));
+
+    array.commands[0] = RaftRedisCommandBatchMarker();
+    memcpy(&array.commands[1], req->r.redis.cmds.commands,
+           req->r.redis.cmds.len * sizeof(RaftRedisCommand *));
+    array.len = 1 + req->r.redis.cmds.len;
+    STAILQ_FOREACH(b, &req->r.redis.batch, entries) {
+        memcpy(&array.commands[array.len], b->r.redis.cmds.commands,
+               b->r.redis.cmds.len * sizeof(RaftRedisCommand *));
+        array.len += b->r.redis.cmds.len;
+    }
+
+    raft_entry_t *entry = RaftRedisCommandArraySerialize(&array);
+    RedisModule_Free(array.commands);
+
+    return entry;
+}
+
 static void freeRedisCommandRaftEntry(raft_entry_t *ety)
 {
     RaftReq *req = (RaftReq *) ety->user_data;
     ety->user_data = NULL;
 
     if (req) {
+        if (req->r.redis.ack != RAFT_ACK_APPLIED) {
+            STAILQ_REMOVE(&redis_raft.pending_acks, req, RaftReq, entries);
+        }
         redis_raft.client_attached_entries--;
-        RedisModule_ReplyWithError(req->ctx, "TIMEOUT not committed yet");
+        replyRedisCommandError(req, "TIMEOUT not committed yet");
         RaftReqFree(req);
     }
 
-    RedisModule_Free(ety);
+    /* Entries are allocated by the Raft library using the pool heap */
+    PoolHeapFree(ety);
 }
 
 static void handleReadOnlyCommand(void *arg, int can_read)
@@ -1407,6 +2322,83 @@ static bool checkReadOnlyCommand(RedisModuleString *cmd)
     return RedisModule_DictGetC(readonlyCommandDict, lcmd, cmd_len, NULL) != NULL;
 }
 
+/* ReadIndex: a leader replies with the index a follower needs to apply before
+ * it can serve a read locally, once it has confirmed it is still the leader.
+ */
+
+static void handleReadIndexReady(void *arg, int can_read)
+{
+    RaftReq *req = (RaftReq *) arg;
+
+    if (!can_read) {
+        RedisModule_ReplyWithError(req->ctx, "TIMEOUT no quorum for read");
+    } else {
+        RedisModule_ReplyWithLongLong(req->ctx, req->r.readindex.idx);
+    }
+
+    RaftReqFree(req);
+}
+
+static void handleReadIndex(RedisRaftCtx *rr, RaftReq *req)
+{
+    if (checkRaftState(rr, req) == RR_ERROR ||
+        checkLeader(rr, req, NULL) == RR_ERROR) {
+        RaftReqFree(req);
+        return;
+    }
+
+    /* The commit index is only known to be up to date once an entry of the
+     * current term was committed. Until then, use the last index which is
+     * committed along with that entry.
+     */
+    raft_index_t idx = raft_get_commit_idx(rr->raft);
+    raft_entry_t *entry = raft_get_entry_from_idx(rr->raft, idx);
+    if (!entry || entry->term != raft_get_current_term(rr->raft)) {
+        idx = raft_get_current_idx(rr->raft);
+    }
+    if (entry) {
+        raft_entry_release(entry);
+    }
+
+    req->r.readindex.idx = idx;
+
+    if (rr->config->lease_reads && checkLeaderLease(rr)) {
+        handleReadIndexReady(req, 1);
+    } else {
+        raft_queue_read_request(rr->raft, handleReadIndexReady, req);
+    }
+}
+
+/* Executes a follower read once the log was applied up to its read index,
+ * or queues it until then.
+ */
+void HandleFollowerRead(RedisRaftCtx *rr, RaftReq *req)
+{
+    if (STAILQ_EMPTY(&rr->pending_reads) &&
+        raft_get_last_applied_idx(rr->raft) >= req->r.redis.read_idx) {
+        handleReadOnlyCommand(req, 1);
+        return;
+    }
+
+    STAILQ_INSERT_TAIL(&rr->pending_reads, req, entries);
+}
+
+static void processPendingReads(RedisRaftCtx *rr)
+{
+    RaftReq *req;
+
+    while ((req = STAILQ_FIRST(&rr->pending_reads)) != NULL &&
+           raft_get_last_applied_idx(rr->raft) >= req->r.redis.read_idx) {
+        STAILQ_REMOVE_HEAD(&rr->pending_reads, entries);
+
+        if (RedisModule_BlockedClientDisconnected(req->ctx)) {
+            RaftReqFree(req);
+        } else {
+            handleReadOnlyCommand(req, 1);
+        }
+    }
+}
+
 static bool checkReadOnlyCommandArray(RaftRedisCommandArray *array)
 {
     int i;
@@ -1588,20 +2580,36 @@ static void handleRedisCommand(RedisRaftCtx *rr,RaftReq *req)
      * commands we've received this as a RAFT.ENTRY input and bundling, probably through a
      * proxy, and bundling was done before.
      */
-    if (req->r.redis.cmds.len == 1) {
+    if (req->r.redis.cmds.len == 1 && req->r.redis.ack == RAFT_ACK_APPLIED) {
         if (handleMultiExec(rr, req)) {
             return;
         }
     }
 
+    /* RAFT.ACK writes are not proxied, as the leader would not know their
+     * acknowledgment level.
+     */
     if (checkRaftState(rr, req) == RR_ERROR ||
-        checkLeader(rr, req, rr->config->follower_proxy ? &leader_proxy : NULL) == RR_ERROR) {
+        checkLeader(rr, req, rr->config->follower_proxy && req->r.redis.ack == RAFT_ACK_APPLIED ?
+                    &leader_proxy : NULL) == RR_ERROR) {
         goto exit;
     }
 
-    /* Proxy */
+    /* Proxy, or execute read-only commands locally using the leader's
+     * read index.
+     */
     if (leader_proxy) {
-        if (ProxyCommand(rr, req, leader_proxy) != RR_OK) {
+        if (rr->config->follower_reads && checkReadOnlyCommandArray(&req->r.redis.cmds)) {
+            if (!rr->config->quorum_reads) {
+                handleReadOnlyCommand(req, 1);
+            } else if (ProxyReadIndex(rr, req, leader_proxy) != RR_OK) {
+                RedisModule_ReplyWithError(req->ctx, "NOTLEADER Failed to proxy command");
+                goto exit;
+            }
+            return;
+        }
+
+        if (ProxyBatchCommand(rr, req, leader_proxy) != RR_OK) {
             RedisModule_ReplyWithError(req->ctx, "NOTLEADER Failed to proxy command");
             goto exit;
         }
@@ -1612,7 +2620,8 @@ static void handleRedisCommand(RedisRaftCtx *rr,RaftReq *req)
      * until we can confirm it's safe to execute (i.e. still a leader).
      */
     if (checkReadOnlyCommandArray(&req->r.redis.cmds)) {
-        if (rr->config->quorum_reads) {
+        if (rr->config->quorum_reads &&
+            !(rr->config->lease_reads && checkLeaderLease(rr))) {
             raft_queue_read_request(rr->raft, handleReadOnlyCommand, req);
         } else {
             handleReadOnlyCommand(req, 1);
@@ -1620,34 +2629,246 @@ static void handleRedisCommand(RedisRaftCtx *rr,RaftReq *req)
         return;
     }
 
-    raft_entry_t *entry = RaftRedisCommandArraySerialize(&req->r.redis.cmds);
-    entry->id = rand();
+    /* Commands that are not already bundled are batched into a single entry,
+     * which is appended once the request queue is drained. An empty MULTI/EXEC
+     * is a single MULTI command, but still a transaction, so it's excluded.
+     */
+    if (rr->config->raft_write_batching && req->r.redis.cmds.len == 1 &&
+        !RaftRedisCommandIsMulti(req->r.redis.cmds.commands[0]) &&
+        req->r.redis.ack == RAFT_ACK_APPLIED) {
+        if (!rr->write_batch) {
+            rr->write_batch = req;
+            STAILQ_INIT(&req->r.redis.batch);
+        } else {
+            STAILQ_INSERT_TAIL(&rr->write_batch->r.redis.batch, req, entries);
+        }
+
+        if (++rr->write_batch_len == WRITE_BATCH_MAX_CMDS) {
+            appendWriteBatch(rr);
+        }
+        return;
+    }
+
+    if (holdWrite(rr, req)) {
+        return;
+    }
+
+    appendRedisCommand(rr, req);
+    return;
+
+exit:
+    RaftReqFree(req);
+}
+
+/* Appends a write that was batched or held, if we can still do so.
+ *
+ * Leadership may have changed meanwhile. If so, the same checks fail and reply
+ * to all other requests in the batch as well.
+ */
+static void appendDeferredCommand(RedisRaftCtx *rr, RaftReq *req)
+{
+    if (checkRaftState(rr, req) == RR_ERROR || checkLeader(rr, req, NULL) == RR_ERROR) {
+        RaftReq *b;
+        STAILQ_FOREACH(b, &req->r.redis.batch, entries) {
+            if (checkRaftState(rr, b) == RR_OK) {
+                checkLeader(rr, b, NULL);
+            }
+        }
+        RaftReqFree(req);
+        return;
+    }
+
+    appendRedisCommand(rr, req);
+}
+
+/* Appends pending batched commands to the log. */
+static void appendWriteBatch(RedisRaftCtx *rr)
+{
+    RaftReq *req = rr->write_batch;
+
+    if (!req) {
+        return;
+    }
+
+    rr->write_batch = NULL;
+    rr->write_batch_len = 0;
+
+    if (holdWrite(rr, req)) {
+        return;
+    }
+
+    appendDeferredCommand(rr, req);
+}
+
+/* With raft-log-async-fsync, a single voter holds writes while a sync is in
+ * progress and appends them once it completes, as a new batch.  Otherwise it
+ * could not apply the entries of the completed sync, as the commit index would
+ * already include newer entries that are not synced yet.
+ *
+ * With other voters, entries are committed once they're durable on a majority
+ * (see getDurableCommitIdx()), so writes are appended right away.
+ */
+static bool holdWrite(RedisRaftCtx *rr, RaftReq *req)
+{
+    if (!rr->log || !rr->log->sync_req || raft_get_num_voting_nodes(rr->raft) > 1) {
+        return false;
+    }
+
+    STAILQ_INSERT_TAIL(&rr->held_writes, req, entries);
+    return true;
+}
+
+static void appendHeldWrites(RedisRaftCtx *rr)
+{
+    struct rqueue reqs = STAILQ_HEAD_INITIALIZER(reqs);
+    RaftReq *req;
+
+    STAILQ_CONCAT(&reqs, &rr->held_writes);
+    if (STAILQ_EMPTY(&reqs) || !rr->log) {
+        return;
+    }
+
+    RaftLogBeginBatch(rr->log);
+    while ((req = STAILQ_FIRST(&reqs)) != NULL) {
+        STAILQ_REMOVE_HEAD(&reqs, entries);
+        appendDeferredCommand(rr, req);
+    }
+    commitLogBatch(rr);
+}
+
+/* Replies to a RAFT.ACK write with its entry index, and detaches it from the
+ * entry, which is applied later like an entry received from the leader. The
+ * caller frees the request.
+ */
+static void ackRedisCommand(RedisRaftCtx *rr, RaftReq *req, raft_entry_t *entry)
+{
+    if (entry && entry->user_data == req) {
+        entry->user_data = NULL;
+        rr->client_attached_entries--;
+    }
+
+    RedisModule_ReplyWithLongLong(req->ctx, req->r.redis.response.idx);
+}
+
+/* Acknowledges RAFT.ACK writes that reached their acknowledgment level:
+ * RAFT_ACK_DURABLE once the entry is synced to our log, and
+ * RAFT_ACK_COMMITTED once the commit index passes it.
+ */
+static void processPendingAcks(RedisRaftCtx *rr)
+{
+    raft_index_t synced_idx = getSyncedIdx(rr);
+    raft_index_t commit_idx = getDurableCommitIdx(rr);
+    RaftReq *req, *tmp;
+
+    STAILQ_FOREACH_SAFE(req, &rr->pending_acks, entries, tmp) {
+        raft_index_t idx = req->r.redis.response.idx;
+
+        if (idx > synced_idx) {
+            break;
+        }
+        if (req->r.redis.ack == RAFT_ACK_COMMITTED && idx > commit_idx) {
+            continue;
+        }
+
+        STAILQ_REMOVE(&rr->pending_acks, req, RaftReq, entries);
+
+        raft_entry_t *entry = raft_get_entry_from_idx(rr->raft, idx);
+        ackRedisCommand(rr, req, entry);
+        RaftReqFree(req);
+        if (entry) {
+            raft_entry_release(entry);
+        }
+    }
+}
+
+/* Appends a command, along with any commands batched with it, to the log as a
+ * single entry. The request is freed once the entry is applied.
+ */
+static void appendRedisCommand(RedisRaftCtx *rr, RaftReq *req)
+{
+    raft_entry_t *entry;
+
+    if (STAILQ_EMPTY(&req->r.redis.batch)) {
+        entry = RaftRedisCommandArraySerialize(&req->r.redis.cmds);
+    } else {
+        entry = serializeWriteBatch(req);
+    }
+
+    /* Compression changes the type, see RaftEntryCompress() */
     entry->type = RAFT_LOGTYPE_NORMAL;
+
+    size_t data_len = entry->data_len;
+    entry = RaftEntryCompress(entry, rr->config->raft_entry_compress_threshold);
+    if (RaftEntryIsCompressed(entry)) {
+        rr->compressed_entries++;
+        rr->compression_saved_bytes += data_len - entry->data_len;
+    }
+
+    entry->id = rand();
     entry->user_data = req;
     entry->free_func = freeRedisCommandRaftEntry;
     rr->client_attached_entries++;
     int e = raft_recv_entry(rr->raft, entry, &req->r.redis.response);
-    raft_entry_release(entry);
 
     if (e != 0) {
+        /* Entry was not appended, so we reply and free the request here */
+        entry->user_data = NULL;
+        rr->client_attached_entries--;
+        raft_entry_release(entry);
+
+        RaftReq *b;
         replyRaftError(req->ctx, e);
-        goto exit;
+        STAILQ_FOREACH(b, &req->r.redis.batch, entries) {
+            replyRaftError(b->ctx, e);
+        }
+        RaftReqFree(req);
+        return;
+    }
+
+    raft_entry_release(entry);
+    pipelineAppendEntriesAll(rr);
+
+    if (req->r.redis.ack != RAFT_ACK_APPLIED) {
+        STAILQ_INSERT_TAIL(&rr->pending_acks, req, entries);
+        processPendingAcks(rr);
     }
 
     /* If we're a single node we can try to apply now, as we have no need
      * or way to wait for AE responses to do that.
+     *
+     * With group commit the entry is not durable yet, so this is deferred
+     * until the batch is synced.
      */
-    if (raft_get_current_idx(rr->raft) == raft_get_commit_idx(rr->raft)) {
-        raft_apply_all(rr->raft);
+    if (!(rr->log && rr->log->batch) &&
+        raft_get_current_idx(rr->raft) == raft_get_commit_idx(rr->raft)) {
+        applyCommittedEntries(rr);
     }
 
     /* Unless applied by raft_apply_all() (and freed by it), the request
      * is pending so we don't free it or unblock the client.
      */
-    return;
+}
 
-exit:
-    RaftReqFree(req);
+static char *catLatencyInfo(char *s, size_t *slen, const char *name, Histogram *h)
+{
+    return catsnprintf(s, slen,
+            "latency_%s_usec:count=%llu,mean=%lu,p50=%lu,p99=%lu,p999=%lu,max=%lu\r\n",
+            name, h->count,
+            (unsigned long) HistogramMean(h),
+            (unsigned long) HistogramPercentile(h, 50),
+            (unsigned long) HistogramPercentile(h, 99),
+            (unsigned long) HistogramPercentile(h, 99.9),
+            (unsigned long) h->max);
+}
+
+static void resetLatencyStats(RedisRaftCtx *rr)
+{
+    HistogramReset(&rr->latency.rqueue_wait);
+    HistogramReset(&rr->latency.log_append);
+    HistogramReset(&rr->latency.log_batch_sync);
+    HistogramReset(&rr->latency.replication_rtt);
+    HistogramReset(&rr->latency.commit_to_apply);
+    HistogramReset(&rr->latency.apply_lock_hold);
 }
 
 static void handleInfo(RedisRaftCtx *rr, RaftReq *req)
@@ -1706,8 +2927,8 @@ static void handleInfo(RedisRaftCtx *rr, RaftReq *req)
         }
 
         s = catsnprintf(s, &slen,
-                "node%d:id=%d,state=%s,voting=%s,addr=%s,port=%d,last_conn_secs=%ld,conn_errors=%lu,conn_oks=%lu\r\n",
-                i, node->id, NodeStateStr[node->state],
+                "node%d:id=%d,state=%s,bulk_state=%s,voting=%s,addr=%s,port=%d,last_conn_secs=%ld,conn_errors=%lu,conn_oks=%lu\r\n",
+                i, node->id, NodeStateStr[node->state], NodeStateStr[node->bulk_state],
                 raft_node_is_voting(rnode) ? "yes" : "no",
                 node->addr.host, node->addr.port,
                 node->last_connected_time ? (now - node->last_connected_time)/1000 : -1,
@@ -1718,27 +2939,49 @@ static void handleInfo(RedisRaftCtx *rr, RaftReq *req)
             "\r\n# Log\r\n"
             "log_entries:%d\r\n"
             "current_index:%d\r\n"
+            "synced_index:%ld\r\n"
             "commit_index:%d\r\n"
             "last_applied_index:%d\r\n"
             "file_size:%lu\r\n"
+            "log_segments:%d\r\n"
             "cache_memory_size:%lu\r\n"
             "cache_entries:%lu\r\n"
+            "cache_hits:%llu\r\n"
+            "cache_misses:%llu\r\n"
+            "cache_miss_bytes:%llu\r\n"
+            "cache_needed_evictions:%llu\r\n"
+            "compressed_entries:%llu\r\n"
+            "compression_saved_bytes:%llu\r\n"
             "client_attached_entries:%lu\r\n",
             rr->raft ? raft_get_log_count(rr->raft) : 0,
             rr->raft ? raft_get_current_idx(rr->raft) : 0,
+            rr->log ? rr->log->synced_idx : 0,
             rr->raft ? raft_get_commit_idx(rr->raft) : 0,
             rr->raft ? raft_get_last_applied_idx(rr->raft) : 0,
             rr->log ? rr->log->file_size : 0,
+            rr->log ? rr->log->num_segments : 0,
             rr->logcache ? rr->logcache->entries_memsize : 0,
             rr->logcache ? rr->logcache->len : 0,
+            rr->logcache ? rr->logcache->hits : 0,
+            rr->logcache ? rr->logcache->misses : 0,
+            rr->logcache ? rr->logcache->miss_bytes : 0,
+            rr->logcache ? rr->logcache->needed_evictions : 0,
+            rr->compressed_entries,
+            rr->compression_saved_bytes,
             rr->client_attached_entries);
 
     s = catsnprintf(s, &slen,
             "\r\n# Snapshot\r\n"
             "snapshot_in_progress:%s\r\n"
-            "snapshots_loaded:%lu\r\n",
+            "snapshots_loaded:%lu\r\n"
+            "snapshots_streamed:%lu\r\n"
+            "snapshot_file_opens:%lu\r\n"
+            "snapshot_chunk_reads:%llu\r\n",
             rr->snapshot_in_progress ? "yes" : "no",
-            rr->snapshots_loaded);
+            rr->snapshots_loaded,
+            rr->snapshots_streamed,
+            rr->snapshot_file_opens,
+            rr->snapshot_chunk_reads);
 
     s = catsnprintf(s, &slen,
             "\r\n# Clients\r\n"
@@ -1753,6 +2996,46 @@ static void handleInfo(RedisRaftCtx *rr, RaftReq *req)
             rr->proxy_failed_responses,
             rr->proxy_outstanding_reqs);
 
+    s = catsnprintf(s, &slen, "\r\n# Latency\r\n");
+    s = catLatencyInfo(s, &slen, "rqueue_wait", &rr->latency.rqueue_wait);
+    s = catLatencyInfo(s, &slen, "log_append", &rr->latency.log_append);
+    s = catLatencyInfo(s, &slen, "log_batch_sync", &rr->latency.log_batch_sync);
+    s = catLatencyInfo(s, &slen, "replication_rtt", &rr->latency.replication_rtt);
+    s = catLatencyInfo(s, &slen, "commit_to_apply", &rr->latency.commit_to_apply);
+    s = catLatencyInfo(s, &slen, "apply_lock_hold", &rr->latency.apply_lock_hold);
+
+    if (req->r.info.reset_latency) {
+        resetLatencyStats(rr);
+    }
+
+    MemPoolStats req_stats, heap_stats;
+    MemPoolGetStats(&RaftReqPool, &req_stats);
+    PoolHeapGetStats(&heap_stats);
+
+    s = catsnprintf(s, &slen,
+            "\r\n# Memory Pools\r\n"
+            "req_pool_allocs:%llu\r\n"
+            "req_pool_hits:%llu\r\n"
+            "req_pool_cached:%lu\r\n"
+            "entry_pool_allocs:%llu\r\n"
+            "entry_pool_hits:%llu\r\n"
+            "entry_pool_cached:%lu\r\n"
+            "entry_pool_cached_bytes:%lu\r\n",
+            req_stats.allocs,
+            req_stats.hits,
+            req_stats.num_free,
+            heap_stats.allocs,
+            heap_stats.hits,
+            heap_stats.num_free,
+            heap_stats.free_bytes);
+
+    s = catsnprintf(s, &slen,
+            "\r\n# Logging\r\n"
+            "async_logging:%s\r\n"
+            "log_messages_dropped:%llu\r\n",
+            LoggerIsAsync() ? "yes" : "no",
+            LoggerGetDropped());
+
     RedisModule_ReplyWithStringBuffer(req->ctx, s, strlen(s));
     RedisModule_Free(s);
 
@@ -1880,17 +3163,42 @@ exit:
 
 static void handleDebugSendSnapshot(RedisRaftCtx *rr, RaftReq *req)
 {
-    raft_node_t *node = raft_get_node(rr->raft, req->r.debug.d.nodecfg.id);
-    if (!node) {
-        RedisModule_ReplyWithError(req->ctx, "ERR node does not exist");
-        goto exit;
+    int num_ids = req->r.debug.d.sendsnapshot.num_ids;
+    bool bulk_connected = true;
+
+    for (int i = 0; i < num_ids; i++) {
+        raft_node_t *raft_node = raft_get_node(rr->raft, req->r.debug.d.sendsnapshot.ids[i]);
+        Node *node = raft_node ? raft_node_get_udata(raft_node) : NULL;
+        if (!node) {
+            RedisModule_ReplyWithError(req->ctx, "ERR node does not exist");
+            goto exit;
+        }
+
+        if (!NODE_BULK_IS_CONNECTED(node)) {
+            NodeBulkConnect(node);
+            bulk_connected = false;
+        }
     }
 
-    if (raftSendSnapshot(rr->raft, rr, node) != 0) {
-        RedisModule_ReplyWithError(req->ctx, "ERR failed to send snapshot");
+    /* Don't start any delivery until all of them can start, or they would
+     * not share the snapshot file.
+     */
+    if (!bulk_connected) {
+        RedisModule_ReplyWithError(req->ctx, "ERR bulk connection not established, try again");
         goto exit;
     }
 
+    /* All deliveries start before the snapshot file is opened, so they
+     * attach to the same SnapshotSource, see snapshotInitiateRead().
+     */
+    for (int i = 0; i < num_ids; i++) {
+        raft_node_t *node = raft_get_node(rr->raft, req->r.debug.d.sendsnapshot.ids[i]);
+        if (raftSendSnapshot(rr->raft, rr, node) != 0) {
+            RedisModule_ReplyWithError(req->ctx, "ERR failed to send snapshot");
+            goto exit;
+        }
+    }
+
     RedisModule_ReplyWithSimpleString(req->ctx, "OK");
 
 exit:
@@ -1935,5 +3243,6 @@ static RaftReqHandler RaftReqHandlers[] = {
     handleLoadSnapshot,     /* RR_LOADSNAPSHOT */
     handleDebug,            /* RR_DEBUG */
     handleClientDisconnect, /* RR_CLIENT_DISCONNECT */
+    handleReadIndex,        /* RR_READINDEX */
     NULL
 };
@@ -29,6 +29,13 @@ void raft_module_log(const char *fmt, ...)
         return;
     }
 
+    va_start(ap, fmt);
+    bool queued = LoggerWrite(fmt, ap);
+    va_end(ap);
+    if (queued) {
+        return;
+    }
+
     gettimeofday(&tv, NULL);
     localtime_r(&tv.tv_sec, &tm);
 
@@ -244,14 +251,82 @@ static int cmdRaft(RedisModuleCtx *ctx, RedisModuleString **argv, int argc)
     return REDISMODULE_OK;
 }
 
+/* RAFT.ACK [APPLIED|COMMITTED|DURABLE] [Redis command to execute]
+ *   Like RAFT, but replies once the command reaches the specified
+ *   acknowledgment level, rather than once it is applied:
+ *   APPLIED   - Applied locally; same as RAFT.
+ *   COMMITTED - Committed to the log by the majority, but possibly not
+ *               applied yet.
+ *   DURABLE   - Written and synced to the leader's log, but possibly not
+ *               replicated yet. The write is lost if the leader fails before
+ *               replicating it.
+ *   A command that is not applied yet has no reply, so COMMITTED and DURABLE
+ *   reply with the index of its log entry instead. Read-only commands are
+ *   executed as usual. The command is never proxied to the leader.
+ * Reply:
+ *   -NOCLUSTER ||
+ *   -LOADING ||
+ *   -NOLEADER ||
+ *   -MOVED <addr> ||
+ *   -TIMEOUT (if the entry is discarded before being committed) ||
+ *   :<index> ||
+ *   Any standard Redis reply, with APPLIED or read-only commands.
+ */
+
+static int cmdRaftAck(RedisModuleCtx *ctx, RedisModuleString **argv, int argc)
+{
+    RaftAckLevel ack;
+
+    if (argc < 3) {
+        RedisModule_WrongArity(ctx);
+        return REDISMODULE_OK;
+    }
+
+    const char *level = RedisModule_StringPtrLen(argv[1], NULL);
+    if (!strcasecmp(level, "applied")) {
+        ack = RAFT_ACK_APPLIED;
+    } else if (!strcasecmp(level, "committed")) {
+        ack = RAFT_ACK_COMMITTED;
+    } else if (!strcasecmp(level, "durable")) {
+        ack = RAFT_ACK_DURABLE;
+    } else {
+        RedisModule_ReplyWithError(ctx, "ERR invalid acknowledgment level");
+        return REDISMODULE_OK;
+    }
+
+    const char *cmdname = RedisModule_StringPtrLen(argv[2], NULL);
+    if (!strcasecmp(cmdname, "multi") || !strcasecmp(cmdname, "exec") ||
+        !strcasecmp(cmdname, "discard")) {
+        RedisModule_ReplyWithError(ctx, "ERR RAFT.ACK does not support MULTI/EXEC");
+        return REDISMODULE_OK;
+    }
+
+    RaftReq *req = RaftReqInit(ctx, RR_REDISCOMMAND);
+    RaftRedisCommand *cmd = RaftRedisCommandArrayExtend(&req->r.redis.cmds);
+
+    req->r.redis.ack = ack;
+    cmd->argc = argc - 2;
+    cmd->argv = RedisModule_Alloc((argc - 2) * sizeof(RedisModuleString *));
+
+    int i;
+    for (i = 0; i < argc - 2; i++) {
+        cmd->argv[i] =  argv[i + 2];
+        RedisModule_RetainString(req->ctx, cmd->argv[i]);
+    }
+    RaftReqSubmit(&redis_raft, req);
+
+    return REDISMODULE_OK;
+}
+
 /* RAFT.ENTRY [Serialized Entry]
  *   Receive a serialized batch of Redis commands (like a Raft entry) and
  *   process them, as if received as individual RAFT commands.
  *
- *   This is used to simplify the proxying of MULTI/EXEC commands.
+ *   This is used to simplify the proxying of MULTI/EXEC commands, and of
+ *   batches of commands that start with RAFT_BATCH_MARKER.
  * Reply:
  *   -MOVED <addr> ||
- *   Any standard Redis reply
+ *   Any standard Redis reply, or an array of replies for a batch
  */
 static int cmdRaftEntry(RedisModuleCtx *ctx, RedisModuleString **argv, int argc)
 {
@@ -274,14 +349,54 @@ static int cmdRaftEntry(RedisModuleCtx *ctx, RedisModuleString **argv, int argc)
     return REDISMODULE_OK;
 }
 
-/* RAFT.INFO
+/* RAFT.READINDEX
+ *   Confirm leadership and return an index a follower has to apply before it
+ *   can execute a read, per the Raft dissertation's ReadIndex.
+ * Reply:
+ *   -MOVED <addr> ||
+ *   -TIMEOUT ||
+ *   :<index>
+ */
+static int cmdRaftReadIndex(RedisModuleCtx *ctx, RedisModuleString **argv, int argc)
+{
+    if (argc != 1) {
+        RedisModule_WrongArity(ctx);
+        return REDISMODULE_OK;
+    }
+
+    RaftReq *req = RaftReqInit(ctx, RR_READINDEX);
+    RaftReqSubmit(&redis_raft, req);
+
+    return REDISMODULE_OK;
+}
+
+/* RAFT.INFO [RESETLATENCY]
  *   Display Raft module specific info.
+ *   RESETLATENCY resets the latency histograms after they are displayed.
  * Reply:
  *   Raw text output, formatted like INFO.
  */
 static int cmdRaftInfo(RedisModuleCtx *ctx, RedisModuleString **argv, int argc)
 {
+    bool reset_latency = false;
+
+    if (argc > 2) {
+        RedisModule_WrongArity(ctx);
+        return REDISMODULE_OK;
+    }
+
+    if (argc == 2) {
+        size_t len;
+        const char *arg = RedisModule_StringPtrLen(argv[1], &len);
+        if (len != strlen("resetlatency") || strncasecmp(arg, "resetlatency", len)) {
+            RedisModule_ReplyWithError(ctx, "ERR invalid RAFT.INFO argument");
+            return REDISMODULE_OK;
+        }
+        reset_latency = true;
+    }
+
     RaftReq *req = RaftReqInit(ctx, RR_INFO);
+    req->r.info.reset_latency = reset_latency;
     RaftReqSubmit(&redis_raft, req);
 
     return REDISMODULE_OK;
@@ -378,6 +493,50 @@ error_cleanup:
     return REDISMODULE_OK;
 }
 
+/* RAFT.AEB [target_node_id] [src_node_id] [packed message]
+ *   Same as RAFT.AE, but with the message and all entries packed into a single
+ *   binary argument.  See RaftAppendEntriesSerialize() for the encoding.
+ * Reply:
+ *   Same as RAFT.AE.
+ */
+
+static int cmdRaftAppendEntriesBinary(RedisModuleCtx *ctx, RedisModuleString **argv, int argc)
+{
+    RedisRaftCtx *rr = &redis_raft;
+
+    if (argc != 4) {
+        RedisModule_WrongArity(ctx);
+        return REDISMODULE_OK;
+    }
+
+    int target_node_id;
+    if (RedisModuleStringToInt(argv[1], &target_node_id) == REDISMODULE_ERR ||
+        target_node_id != rr->config->id) {
+            RedisModule_ReplyWithError(ctx, "invalid or incorrect target node id");
+            return REDISMODULE_OK;
+    }
+
+    RaftReq *req = RaftReqInit(ctx, RR_APPENDENTRIES);
+    if (RedisModuleStringToInt(argv[2], &req->r.appendentries.src_node_id) == REDISMODULE_ERR) {
+        RedisModule_ReplyWithError(ctx, "invalid source node id");
+        goto error_cleanup;
+    }
+
+    size_t msglen;
+    const char *msgstr = RedisModule_StringPtrLen(argv[3], &msglen);
+    if (RaftAppendEntriesDeserialize(&req->r.appendentries.msg, msgstr, msglen) != RR_OK) {
+        RedisModule_ReplyWithError(ctx, "invalid message");
+        goto error_cleanup;
+    }
+
+    RaftReqSubmit(rr, req);
+    return REDISMODULE_OK;
+
+error_cleanup:
+    RaftReqFree(req);
+    return REDISMODULE_OK;
+}
+
 /* RAFT.CONFIG GET [wildcard]
  *   Query Raft configuration parameters.
  *
@@ -419,13 +578,24 @@ static int cmdRaftConfig(RedisModuleCtx *ctx, RedisModuleString **argv, int argc
  *    -LEADER ||
  *    :0 (already have snapshot or newer)
  *    :1 (loaded)
+ *
+ * RAFT.LOADSNAPSHOT [target-node-id] [current-term] [snapshot-last-index]
+ *                   [offset] [total-size] [data]
+ *   Store a chunk of the specified snapshot, and load it once the last chunk
+ *   has been received.
+ *
+ *  Reply:
+ *    -LEADER ||
+ *    *2 :0 :[offset] (already have snapshot or newer)
+ *    *2 :1 :[offset] (loaded)
+ *    *2 :2 :[offset] (send next chunk from offset)
  */
 
 static int cmdRaftLoadSnapshot(RedisModuleCtx *ctx, RedisModuleString **argv, int argc)
 {
     RedisRaftCtx *rr = &redis_raft;
 
-    if (argc != 5) {
+    if (argc != 5 && argc != 7) {
         RedisModule_WrongArity(ctx);
         return REDISMODULE_OK;
     }
@@ -445,10 +615,30 @@ static int cmdRaftLoadSnapshot(RedisModuleCtx *ctx, RedisModuleString **argv, in
         return REDISMODULE_OK;
     }
 
+    long long offset = 0;
+    long long size;
+    RedisModuleString *data = argv[argc - 1];
+
+    if (argc == 7) {
+        if (RedisModule_StringToLongLong(argv[4], &offset) != REDISMODULE_OK ||
+            RedisModule_StringToLongLong(argv[5], &size) != REDISMODULE_OK ||
+            offset < 0 || size < 0) {
+            RedisModule_ReplyWithError(ctx, "ERR invalid numeric values");
+            return REDISMODULE_OK;
+        }
+    } else {
+        size_t data_len;
+        RedisModule_StringPtrLen(data, &data_len);
+        size = data_len;
+    }
+
     RaftReq *req = RaftReqInit(ctx, RR_LOADSNAPSHOT);
-    req->r.loadsnapshot.snapshot = argv[4];
+    req->r.loadsnapshot.snapshot = data;
     req->r.loadsnapshot.idx = idx;
     req->r.loadsnapshot.term = term;
+    req->r.loadsnapshot.chunked = argc == 7;
+    req->r.loadsnapshot.offset = offset;
+    req->r.loadsnapshot.size = size;
     RedisModule_RetainString(ctx, req->r.loadsnapshot.snapshot);
 
     RaftReqSubmit(&redis_raft, req);
@@ -568,19 +758,29 @@ static int cmdRaftDebug(RedisModuleCtx *ctx, RedisModuleString **argv, int argc)
         req->r.debug.d.nodecfg.str[slen] = '\0';
         RaftReqSubmit(&redis_raft, req);
     } else if (!strncasecmp(cmd, "sendsnapshot", cmdlen)) {
-        if (argc != 3) {
+        if (argc < 3) {
             RedisModule_WrongArity(ctx);
             return REDISMODULE_OK;
         }
 
-        long long node_id;
-        if (RedisModule_StringToLongLong(argv[2], &node_id) != REDISMODULE_OK) {
-            RedisModule_ReplyWithError(ctx, "ERR invalid node id");
-            return REDISMODULE_OK;
+        /* Deliveries to all the given nodes are started together, so they
+         * share a single read of the snapshot file.
+         */
+        int num_ids = argc - 2;
+        raft_node_id_t *ids = RedisModule_Alloc(sizeof(raft_node_id_t) * num_ids);
+        for (int i = 0; i < num_ids; i++) {
+            long long node_id;
+            if (RedisModule_StringToLongLong(argv[i + 2], &node_id) != REDISMODULE_OK) {
+                RedisModule_Free(ids);
+                RedisModule_ReplyWithError(ctx, "ERR invalid node id");
+                return REDISMODULE_OK;
+            }
+            ids[i] = (raft_node_id_t) node_id;
         }
 
         RaftReq *req = RaftDebugReqInit(ctx, RR_DEBUG_SENDSNAPSHOT);
-        req->r.debug.d.sendsnapshot.id = node_id;
+        req->r.debug.d.sendsnapshot.ids = ids;
+        req->r.debug.d.sendsnapshot.num_ids = num_ids;
         RaftReqSubmit(&redis_raft, req);
     } else {
         RedisModule_ReplyWithError(ctx, "ERR invalid debug subcommand");
@@ -610,11 +810,21 @@ static int registerRaftCommands(RedisModuleCtx *ctx)
         return REDISMODULE_ERR;
     }
 
+    if (RedisModule_CreateCommand(ctx, "raft.ack",
+                cmdRaftAck, "write", 0, 0, 0) == REDISMODULE_ERR) {
+        return REDISMODULE_ERR;
+    }
+
     if (RedisModule_CreateCommand(ctx, "raft.entry",
                 cmdRaftEntry, "write", 0, 0, 0) == REDISMODULE_ERR) {
         return REDISMODULE_ERR;
     }
 
+    if (RedisModule_CreateCommand(ctx, "raft.readindex",
+                cmdRaftReadIndex, "admin", 0, 0, 0) == REDISMODULE_ERR) {
+        return REDISMODULE_ERR;
+    }
+
     if (RedisModule_CreateCommand(ctx, "raft.info",
                 cmdRaftInfo, "admin", 0, 0, 0) == REDISMODULE_ERR) {
         return REDISMODULE_ERR;
@@ -640,6 +850,11 @@ static int registerRaftCommands(RedisModuleCtx *ctx)
         return REDISMODULE_ERR;
     }
 
+    if (RedisModule_CreateCommand(ctx, "raft.aeb",
+                cmdRaftAppendEntriesBinary, "write", 0, 0, 0) == REDISMODULE_ERR) {
+        return REDISMODULE_ERR;
+    }
+
     if (RedisModule_CreateCommand(ctx, "raft.requestvote",
                 cmdRaftRequestVote, "admin", 0, 0, 0) == REDISMODULE_ERR) {
         return REDISMODULE_ERR;
@@ -707,15 +922,22 @@ int RedisModule_OnLoad(RedisModuleCtx *ctx, RedisModuleString **argv, int argc)
         return REDISMODULE_ERR;
     }
 
-    raft_set_heap_functions(RedisModule_Alloc,
-                            RedisModule_Calloc,
-                            RedisModule_Realloc,
-                            RedisModule_Free);
+    MemPoolInit(&RaftReqPool, "raftreq", sizeof(RaftReq), RAFTREQ_POOL_MAX_FREE);
+    PoolHeapInit();
+    raft_set_heap_functions(PoolHeapAlloc,
+                            PoolHeapCalloc,
+                            PoolHeapRealloc,
+                            PoolHeapFree);
     uv_replace_allocator(RedisModule_Alloc,
                          RedisModule_Realloc,
                          RedisModule_Calloc,
                          RedisModule_Free);
 
+    if (config.async_logging && LoggerStart() != RR_OK) {
+        RedisModule_Log(ctx, REDIS_WARNING, "Failed to start logging thread!");
+        return REDISMODULE_ERR;
+    }
+
     if (RedisRaftInit(ctx, &redis_raft, &config) == RR_ERROR) {
         return REDISMODULE_ERR;
     }
@@ -10,6 +10,7 @@
 #ifndef _REDISRAFT_H
 #define _REDISRAFT_H
 
+#include <stdarg.h>
 #include <stdint.h>
 #include <stdbool.h>
 #ifdef HAVE_SYS_QUEUE
@@ -73,7 +74,7 @@ void raft_module_log(const char *fmt, ...);
                     "!!!!!!!!!!!!!!!!!!!!!!!!!!!!!\n" \
                     "REDIS RAFT PANIC\n" \
                     "!!!!!!!!!!!!!!!!!!!!!!!!!!!!!\n\n" \
-                    fmt, ##__VA_ARGS__); abort(); } while (0)
+                    fmt, ##__VA_ARGS__); LoggerFlush(); abort(); } while (0)
 
 #ifdef ENABLE_TRACE
 #define TRACE(fmt, ...) \
@@ -152,6 +153,69 @@ typedef struct RaftSnapshotInfo {
     SnapshotCfgEntry *cfg;
 } RaftSnapshotInfo;
 
+/* Send time of an AppendEntries message, used to track the leader lease. */
+#define AE_SEND_TIMES_LEN   64
+
+typedef struct AESendTime {
+    unsigned long msg_id;
+    raft_term_t term;
+    uint64_t time;          /* uv_hrtime() when first sent */
+} AESendTime;
+
+/* A pool of fixed size objects, see pool.c */
+typedef struct MemPool {
+    const char *name;
+    size_t obj_size;
+    unsigned long max_free;         /* Max number of cached objects */
+    uv_mutex_t mutex;
+    struct PoolItem *free_list;
+    unsigned long num_free;
+    unsigned long long allocs;      /* Total allocations */
+    unsigned long long hits;        /* Allocations served from the free list */
+    unsigned long long frees;
+} MemPool;
+
+typedef struct MemPoolStats {
+    unsigned long long allocs;
+    unsigned long long hits;
+    unsigned long long frees;
+    unsigned long num_free;
+    unsigned long free_bytes;
+} MemPoolStats;
+
+/* A latency histogram, see histogram.c */
+#define HISTOGRAM_SUB_BUCKET_BITS   4
+#define HISTOGRAM_SUB_BUCKETS       (1 << HISTOGRAM_SUB_BUCKET_BITS)
+#define HISTOGRAM_MAX_BITS          40
+#define HISTOGRAM_BUCKETS           \
+    ((HISTOGRAM_MAX_BITS - HISTOGRAM_SUB_BUCKET_BITS + 1) * HISTOGRAM_SUB_BUCKETS)
+
+typedef struct Histogram {
+    unsigned long long count;
+    uint64_t min;
+    uint64_t max;
+    uint64_t sum;
+    unsigned long long buckets[HISTOGRAM_BUCKETS];
+} Histogram;
+
+/* Latency of the stages of the write path, in microseconds */
+typedef struct RaftLatencyStats {
+    Histogram rqueue_wait;      /* RaftReqSubmit() until the Raft thread handles the request */
+    Histogram log_append;       /* Writing (and unless batched, syncing) an entry to the log */
+    Histogram log_batch_sync;   /* Syncing entries appended with raft-log-group-commit */
+    Histogram replication_rtt;  /* AppendEntries sent until a node responds */
+    Histogram commit_to_apply;  /* Entry committed until it is applied */
+    Histogram apply_lock_hold;  /* Redis lock held while applying a batch of entries */
+} RaftLatencyStats;
+
+/* Commit index advances still pending apply, for commit_to_apply latency */
+#define COMMIT_MARKS_LEN    16
+
+typedef struct CommitMark {
+    raft_index_t idx;
+    uint64_t time;
+} CommitMark;
+
 /* State of the RAFT.CLUSTER JOIN operation.
  *
  * The address list is initialized by RAFT.CLUSTER JOIN, but it may grow if RAFT.NODE ADD
@@ -188,8 +252,27 @@ typedef struct {
     struct RaftReq *debug_req;    /* Current RAFT.DEBUG request context, if processing one */
     bool callbacks_set;         /* TODO: Needed? */
     int snapshot_child_fd;      /* Pipe connected to snapshot child process */
+    int snapshot_recv_fd;       /* Temporary file of snapshot being received */
+    raft_term_t snapshot_recv_term;     /* Leader term of snapshot being received */
+    raft_index_t snapshot_recv_idx;     /* Last index of snapshot being received */
+    size_t snapshot_recv_size;          /* Total size of snapshot being received */
+    size_t snapshot_recv_offset;        /* Bytes of snapshot received so far */
+    struct SnapshotStream *snapshot_stream; /* Diskless snapshot delivery in progress */
+    struct SnapshotSource *snapshot_source; /* Snapshot file shared by nodes it is delivered to */
     RaftSnapshotInfo snapshot_info; /* Current snapshot info */
     RedisModuleCommandFilter *registered_filter;
+    bool apply_locked;          /* Redis lock is held while applying a batch of entries */
+    unsigned int apply_batch_count;     /* Number of entries applied in current batch */
+    uint64_t apply_batch_start; /* Time current apply batch started (uv_hrtime) */
+    struct rqueue applied_reqs; /* Requests applied in current batch, pending release */
+    struct rqueue held_writes;  /* Writes held until the log sync in progress completes */
+    struct rqueue pending_acks; /* RAFT.ACK writes appended but not acknowledged yet */
+    struct rqueue pending_ae_replies;   /* AppendEntries replies waiting for their entries to be synced */
+    AESendTime ae_send_times[AE_SEND_TIMES_LEN];    /* Recently sent AppendEntries, for leader lease */
+    struct rqueue pending_reads;    /* Follower reads waiting for their read index to be applied */
+    struct ProxyBatch *proxy_batch; /* Proxied commands waiting to be sent to the leader */
+    struct RaftReq *write_batch;    /* Commands waiting to be appended as a single entry */
+    int write_batch_len;
     /* General stats */
     unsigned long client_attached_entries;      /* Number of log entries attached to user connections */
     unsigned long long proxy_reqs;              /* Number of proxied requests */
@@ -197,6 +280,15 @@ typedef struct {
     unsigned long long proxy_failed_responses;  /* Number of failed proxy responses, i.e. did not complete */
     unsigned long proxy_outstanding_reqs;       /* Number of proxied requests pending */
     unsigned long snapshots_loaded;             /* Number of snapshots loaded */
+    unsigned long snapshots_streamed;           /* Number of diskless snapshot streams started */
+    unsigned long snapshot_file_opens;          /* Number of times the snapshot file was opened for delivery */
+    unsigned long long snapshot_chunk_reads;    /* Number of snapshot file chunks read for delivery */
+    unsigned long long compressed_entries;      /* Number of entries appended compressed */
+    unsigned long long compression_saved_bytes; /* Payload bytes saved by compressing entries */
+    RaftLatencyStats latency;                   /* Write path latency, reset by RAFT.INFO RESETLATENCY */
+    CommitMark commit_marks[COMMIT_MARKS_LEN];  /* When commit index advances were seen */
+    int commit_marks_first;
+    int commit_marks_num;
 } RedisRaftCtx;
 
 extern RedisRaftCtx redis_raft;
@@ -210,8 +302,14 @@ extern raft_log_impl_t RaftLogImpl;
 #define REDIS_RAFT_DEFAULT_RECONNECT_INTERVAL       100
 #define REDIS_RAFT_DEFAULT_PROXY_RESPONSE_TIMEOUT   10000
 #define REDIS_RAFT_DEFAULT_RAFT_RESPONSE_TIMEOUT    1000
+#define REDIS_RAFT_DEFAULT_AE_PIPELINE_DEPTH        1
 #define REDIS_RAFT_DEFAULT_LOG_MAX_CACHE_SIZE       8*1000*1000
 #define REDIS_RAFT_DEFAULT_LOG_MAX_FILE_SIZE        64*1000*1000
+#define REDIS_RAFT_DEFAULT_LOG_SEGMENT_SIZE         8*1000*1000
+#define REDIS_RAFT_DEFAULT_LOG_LOAD_THREADS         4
+#define REDIS_RAFT_DEFAULT_ENTRY_COMPRESS_THRESHOLD 0
+#define REDIS_RAFT_DEFAULT_SNAPSHOT_CHUNK_SIZE      4*1000*1000
+#define REDIS_RAFT_DEFAULT_SNAPSHOT_DISKLESS_DIR    "/dev/shm"
 
 typedef struct RedisRaftConfig {
     raft_node_id_t id;          /* Local node Id */
@@ -220,7 +318,10 @@ typedef struct RedisRaftConfig {
     char *raft_log_filename;    /* Raft log file name, derived from dbfilename */
     bool follower_proxy;        /* Do follower nodes proxy requests to leader? */
     bool quorum_reads;          /* Reads have to go through quorum */
+    bool lease_reads;           /* Quorum reads are served locally while leader lease is valid */
+    bool follower_reads;        /* Proxying followers serve reads locally using ReadIndex */
     bool raftize_all_commands;  /* Automatically pass all commands through Raft? */
+    bool async_logging;         /* Write the log from a background thread */
     /* Tuning */
     int raft_interval;
     int request_timeout;
@@ -228,10 +329,20 @@ typedef struct RedisRaftConfig {
     int reconnect_interval;
     int proxy_response_timeout;
     int raft_response_timeout;
+    int raft_ae_pipeline_depth;     /* Max. AppendEntries messages in flight per node */
+    unsigned long raft_snapshot_chunk_size; /* Size of snapshot chunks sent to nodes */
+    bool raft_snapshot_diskless;    /* Stream a new snapshot to nodes, rather than read the snapshot file */
+    char *raft_snapshot_diskless_dir;   /* Directory where streamed snapshots are staged */
     /* Cache and file comapction */
     unsigned long raft_log_max_cache_size;
     unsigned long raft_log_max_file_size;
+    unsigned long raft_log_segment_size;    /* Size of Raft log segment files */
+    int raft_log_load_threads;      /* Threads that parse log segments on startup */
+    unsigned long raft_entry_compress_threshold;    /* Compress entry payloads of this size or larger, 0 to disable */
     bool raft_log_fsync;
+    bool raft_log_group_commit;     /* Sync entries appended in one request queue drain together */
+    bool raft_log_async_fsync;      /* Sync entries without blocking the Raft thread */
+    bool raft_write_batching;       /* Append commands received in one request queue drain as one entry */
 } RedisRaftConfig;
 
 typedef void (*NodeConnectCallbackFunc)(const redisAsyncContext *, int);
@@ -247,7 +358,9 @@ typedef enum NodeState {
 extern const char *NodeStateStr[];
 
 typedef enum NodeFlags {
-    NODE_TERMINATING    = 1 << 0
+    NODE_TERMINATING    = 1 << 0,
+    NODE_BINARY_AE      = 1 << 1,           /* Node supports RAFT.AEB */
+    NODE_COMPRESSED_AE  = 1 << 2            /* Node supports compressed entries */
 } NodeFlags;
 
 #define NODE_STATE_IDLE(x) \
@@ -257,6 +370,9 @@ typedef enum NodeFlags {
 #define NODE_IS_CONNECTED(node) \
     ((node->state == NODE_CONNECTED) && !(node->flags & NODE_TERMINATING))
 
+#define NODE_BULK_IS_CONNECTED(node) \
+    ((node->bulk_state == NODE_CONNECTED) && !(node->flags & NODE_TERMINATING))
+
 typedef struct PendingResponse {
     bool proxy;
     int id;
@@ -275,20 +391,31 @@ typedef struct Node {
     unsigned int connect_oks;           /* Successful connects */
     unsigned int connect_errors;        /* Connection errors since last connection */
     redisAsyncContext *rc;              /* hiredis async context */
+    redisAsyncContext *bulk_rc;         /* hiredis async context for snapshot delivery */
+    NodeState bulk_state;               /* State of bulk_rc */
+    long long bulk_request_time;        /* Time a pending bulk_rc request was sent, or 0 */
     uv_getaddrinfo_t uv_resolver;       /* libuv resolver context */
     RedisRaftCtx *rr;                   /* Pointer back to redis_raft */
     NodeConnectCallbackFunc connect_callback;   /* Connection callback */
     bool load_snapshot_in_progress; /* Are we currently pushing a snapshot? */
     raft_index_t load_snapshot_idx; /* Index of snapshot we're pushing */
     time_t load_snapshot_last_time; /* Last time we pushed a snapshot */
-    uv_fs_t uv_snapshot_req;        /* libuv handle managing snapshot loading from disk */
-    uv_file uv_snapshot_file;       /* libuv handle for snapshot file */
+    raft_term_t load_snapshot_term; /* Term in which we started pushing the snapshot */
     size_t snapshot_size;           /* Size of snapshot we're pushing */
-    char *snapshot_buf;             /* Snapshot buffer; TODO: Currently we buffer the entire RDB
-                                     * because hiredis will not stream it for us. */
-    uv_buf_t uv_snapshot_buf;       /* libuv wrapper for snapshot_buf */
+    size_t snapshot_offset;         /* Offset of the chunk we're pushing */
+    struct SnapshotSource *snapshot_source; /* Snapshot file we're pushing */
+    bool snapshot_chunk_wanted;     /* Waiting for the chunk at snapshot_offset to be read */
+    bool snapshot_stream;           /* Is the snapshot pushed from a stream? */
+    bool snapshot_use_file;         /* Push the snapshot file, the stream failed */
     long pending_raft_response_num;     /* Number of pending Raft responses */
     long pending_proxy_response_num;    /* Number of pending proxy responses */
+    raft_index_t ae_pipeline_idx;       /* Last entry index sent in a pipelined AppendEntries */
+    raft_term_t ae_pipeline_term;       /* Term in which ae_pipeline_idx was set */
+    unsigned long ae_last_msg_id;       /* Last AppendEntries msg_id set by the Raft library */
+    uint64_t ae_last_send_time;         /* Time last AppendEntries was sent (uv_hrtime) */
+    raft_index_t ae_commit_sent;        /* Commit index sent in the last AppendEntries */
+    uint64_t lease_ack_time;            /* Send time of last AppendEntries acknowledged in lease_ack_term */
+    raft_term_t lease_ack_term;         /* Term of lease_ack_time */
     STAILQ_HEAD(pending_responses, PendingResponse) pending_responses;
     LIST_ENTRY(Node) entries;
 } Node;
@@ -317,9 +444,14 @@ enum RaftReqType {
     RR_LOADSNAPSHOT,
     RR_DEBUG,
     RR_CLIENT_DISCONNECT,
+    RR_READINDEX,
 };
 
 extern const char *RaftReqTypeStr[];
+extern MemPool RaftReqPool;
+
+/* Max number of released RaftReq structs kept for reuse */
+#define RAFTREQ_POOL_MAX_FREE   1024
 
 typedef struct {
     raft_node_id_t id;
@@ -337,6 +469,14 @@ typedef struct {
     RaftRedisCommand **commands;
 } RaftRedisCommandArray;
 
+/* First command of a batch of independent commands, see serialization.c */
+#define RAFT_BATCH_MARKER           "RAFT.BATCH"
+
+/* Entry types above RAFT_LOGTYPE_NUM are not interpreted by the Raft library.
+ * A compressed entry is a normal entry whose payload is LZF compressed.
+ */
+#define RAFT_LOGTYPE_COMPRESSED     (RAFT_LOGTYPE_NUM + 1)
+
 /* Debug message structure, used for RAFT.DEBUG / RR_DEBUG
  * requests.
  */
@@ -357,16 +497,25 @@ typedef struct RaftDebugReq {
             char *str;
         } nodecfg;
         struct {
-            raft_node_id_t id;
+            raft_node_id_t *ids;
+            int num_ids;
         } sendsnapshot;
     } d;
 } RaftDebugReq;
 
+/* When a write submitted with RAFT.ACK is replied to */
+typedef enum RaftAckLevel {
+    RAFT_ACK_APPLIED = 0,       /* Entry applied, reply is the command's reply */
+    RAFT_ACK_COMMITTED,         /* Entry committed, reply is its index */
+    RAFT_ACK_DURABLE            /* Entry synced to the leader's log, reply is its index */
+} RaftAckLevel;
+
 typedef struct RaftReq {
     int type;
     STAILQ_ENTRY(RaftReq) entries;
     RedisModuleBlockedClient *client;
     RedisModuleCtx *ctx;
+    uint64_t submit_time;       /* When submitted to the Raft thread (uv_hrtime) */
     union {
         struct {
             NodeAddrListElement *addr;
@@ -375,6 +524,7 @@ typedef struct RaftReq {
         struct {
             raft_node_id_t src_node_id;
             msg_appendentries_t msg;
+            msg_appendentries_response_t response;  /* Deferred reply, with raft-log-async-fsync */
         } appendentries;
         struct {
             raft_node_id_t src_node_id;
@@ -384,39 +534,81 @@ typedef struct RaftReq {
             Node *proxy_node;
             RaftRedisCommandArray cmds;
             msg_entry_response_t response;
+            RaftAckLevel ack;           /* When to reply; pending in pending_acks unless applied */
+            raft_index_t read_idx;      /* Follower read: index to apply before reading */
+            struct rqueue batch;        /* Requests appended in the same entry, after this one */
         } redis;
         struct {
             raft_term_t term;
             raft_index_t idx;
+            bool chunked;           /* Sent in chunks, expects an array reply */
+            size_t offset;          /* Offset of chunk */
+            size_t size;            /* Total size of snapshot */
             RedisModuleString *snapshot;
         } loadsnapshot;
         struct {
             unsigned long long client_id;
         } client_disconnect;
+        struct {
+            raft_index_t idx;
+        } readindex;
+        struct {
+            bool reset_latency;
+        } info;
         RaftDebugReq debug;
     } r;
 } RaftReq;
 
-#define RAFTLOG_VERSION     1
+#define RAFTLOG_VERSION     3
+
+/* First log version that stores entries in segments */
+#define RAFTLOG_SEGMENTS_VERSION    3
 
 /* Flags for RaftLogOpen */
 #define RAFTLOG_KEEP_INDEX  1                   /* Index was written by this process, safe to use. */
 
+/* A Raft log segment file, which holds consecutive entries starting at
+ * first_idx, and its index file.
+ */
+typedef struct RaftLogSegment {
+    raft_index_t        first_idx;              /* Index of first entry */
+    size_t              file_size;              /* Segment file size */
+    char                *filename;
+    FILE                *file;
+    FILE                *idxfile;
+    off_t               *idxmap;                /* Memory mapped index file */
+    size_t              idxmap_len;             /* Number of offsets mapped */
+} RaftLogSegment;
+
+/* Called when an asynchronous sync completes, see RaftLogSyncAsync() */
+typedef void (*RaftLogSyncCallback)(void *arg, uint64_t sync_usec);
+
 typedef struct RaftLog {
     uint32_t            version;                /* Log file format version */
     char                dbid[RAFT_DBID_LEN+1];  /* DB unique ID */
     raft_node_id_t      node_id;                /* Node ID */
     bool                fsync;                  /* Should fsync every append? */
+    bool                batch;                  /* Group commit batch open, appends are not synced */
+    unsigned long int   unsynced_entries;       /* Entries appended to the open batch, not synced yet */
+    raft_index_t        synced_idx;             /* Last entry known to be durable */
+    unsigned long       sync_epoch;             /* Incremented when entries are removed */
+    struct LogSyncReq   *sync_req;              /* Asynchronous sync in progress */
+    struct LogSyncReq   *sealed_sync;           /* Sync of a sealed segment, waiting for sync_req */
+    uv_loop_t           *sync_loop;
+    RaftLogSyncCallback sync_cb;                /* Called when an asynchronous sync completes */
+    void                *sync_cb_arg;
     unsigned long int   num_entries;            /* Entries in log */
     raft_term_t         snapshot_last_term;     /* Last term included in snapshot */
     raft_index_t        snapshot_last_idx;      /* Last index included in snapshot */
     raft_index_t        index;                  /* Index of last entry */
     raft_term_t         term;                   /* Last term we're aware of */
     raft_node_id_t      vote;                   /* Our vote in the last term, or -1 */
-    size_t              file_size;              /* File size at the time of last write */
-    const char          *filename;
-    FILE                *file;
-    FILE                *idxfile;
+    size_t              file_size;              /* Size of entries that follow the snapshot */
+    size_t              segment_size;           /* Segment size to start a new segment at */
+    int                 load_threads;           /* Segments parsed concurrently on load */
+    const char          *filename;              /* Log header and list of segments */
+    int                 num_segments;
+    RaftLogSegment      *segments;              /* Ordered by index, last one is appended to */
 } RaftLog;
 
 
@@ -426,6 +618,7 @@ typedef struct SnapshotResult {
     int success;
     char rdb_filename[256];
     char err[256];
+    size_t rdb_size;        /* Size of RDB, when streamed by the child */
 } SnapshotResult;
 
 /* Command filtering re-entrancy counter handling.
@@ -470,6 +663,8 @@ Node *NodeInit(int id, const NodeAddr *addr);
 bool NodeConnect(Node *node, RedisRaftCtx *rr, NodeConnectCallbackFunc connect_callback);
 void NodeMarkDisconnected(Node *node);
 void NodeMarkRemoved(Node *node);
+void NodeBulkConnect(Node *node);
+void NodeBulkDisconnect(Node *node);
 bool NodeAddrParse(const char *node_addr, size_t node_addr_len, NodeAddr *result);
 void NodeAddrListAddElement(NodeAddrListElement **head, NodeAddr *addr);
 void NodeAddrListFree(NodeAddrListElement *head);
@@ -481,10 +676,20 @@ void NodeDismissPendingResponse(Node *node);
 raft_entry_t *RaftRedisCommandArraySerialize(const RaftRedisCommandArray *source);
 size_t RaftRedisCommandDeserialize(RaftRedisCommand *target, const void *buf, size_t buf_size);
 RRStatus RaftRedisCommandArrayDeserialize(RaftRedisCommandArray *target, const void *buf, size_t buf_size);
+raft_entry_t *RaftEntryCompress(raft_entry_t *ety, size_t threshold);
+bool RaftEntryIsCompressed(raft_entry_t *ety);
+raft_entry_t *RaftEntryDecompress(raft_entry_t *ety);
 void RaftRedisCommandArrayFree(RaftRedisCommandArray *array);
 void RaftRedisCommandFree(RaftRedisCommand *r);
 RaftRedisCommand *RaftRedisCommandArrayExtend(RaftRedisCommandArray *target);
+bool RaftRedisCommandIsMulti(const RaftRedisCommand *cmd);
+RaftRedisCommand *RaftRedisCommandBatchMarker(void);
+bool RaftRedisCommandArrayIsBatch(const RaftRedisCommandArray *array);
 void RaftRedisCommandArrayMove(RaftRedisCommandArray *target, RaftRedisCommandArray *source);
+size_t RaftAppendEntriesSerializedSize(const msg_appendentries_t *msg);
+char *RaftAppendEntriesSerializeTo(const msg_appendentries_t *msg, char *buf);
+char *RaftAppendEntriesSerialize(const msg_appendentries_t *msg, size_t *len);
+RRStatus RaftAppendEntriesDeserialize(msg_appendentries_t *target, const void *buf, size_t buf_size);
 
 /* raft.c */
 RRStatus RedisRaftInit(RedisModuleCtx *ctx, RedisRaftCtx *rr, RedisRaftConfig *config);
@@ -496,6 +701,7 @@ RaftReq *RaftReqInit(RedisModuleCtx *ctx, enum RaftReqType type);
 RaftReq *RaftDebugReqInit(RedisModuleCtx *ctx, enum RaftDebugReqType type);
 void RaftReqSubmit(RedisRaftCtx *rr, RaftReq *req);
 void RaftReqHandleQueue(uv_async_t *handle);
+void HandleFollowerRead(RedisRaftCtx *rr, RaftReq *req);
 
 /* util.c */
 int RedisModuleStringToInt(RedisModuleString *str, int *value);
@@ -507,6 +713,41 @@ char *RedisInfoGetParam(RedisRaftCtx *rr, const char *section, const char *param
 RRStatus parseMemorySize(const char *value, unsigned long *result);
 RRStatus formatExactMemorySize(unsigned long value, char *buf, size_t buf_size);
 
+/* crc32c.c */
+uint32_t crc32c(uint32_t crc, const void *buf, size_t len);
+
+/* compress.c */
+size_t LZFCompress(const void *in, size_t in_len, void *out, size_t out_len);
+size_t LZFDecompress(const void *in, size_t in_len, void *out, size_t out_len);
+
+/* histogram.c */
+void HistogramReset(Histogram *h);
+void HistogramRecord(Histogram *h, uint64_t value);
+uint64_t HistogramPercentile(Histogram *h, double percentile);
+uint64_t HistogramMean(Histogram *h);
+
+/* logger.c */
+RRStatus LoggerStart(void);
+void LoggerStop(void);
+bool LoggerIsAsync(void);
+void LoggerFlush(void);
+unsigned long long LoggerGetDropped(void);
+bool LoggerWrite(const char *fmt, va_list ap);
+
+/* pool.c */
+void MemPoolInit(MemPool *pool, const char *name, size_t obj_size, unsigned long max_free);
+void MemPoolTerm(MemPool *pool);
+void *MemPoolAlloc(MemPool *pool);
+void MemPoolFree(MemPool *pool, void *ptr);
+void MemPoolGetStats(MemPool *pool, MemPoolStats *stats);
+void PoolHeapInit(void);
+void PoolHeapTerm(void);
+void *PoolHeapAlloc(size_t size);
+void *PoolHeapCalloc(size_t nmemb, size_t size);
+void *PoolHeapRealloc(void *ptr, size_t size);
+void PoolHeapFree(void *ptr);
+void PoolHeapGetStats(MemPoolStats *stats);
+
 /* log.c */
 RaftLog *RaftLogCreate(const char *filename, const char *dbid, raft_term_t snapshot_term, raft_index_t snapshot_index, raft_term_t current_term, raft_node_id_t last_vote, RedisRaftConfig *config);
 RaftLog *RaftLogOpen(const char *filename, RedisRaftConfig *config, int flags);
@@ -517,17 +758,20 @@ RRStatus RaftLogSetTerm(RaftLog *log, raft_term_t term, raft_node_id_t vote);
 int RaftLogLoadEntries(RaftLog *log, int (*callback)(void *, raft_entry_t *, raft_index_t), void *callback_arg);
 RRStatus RaftLogWriteEntry(RaftLog *log, raft_entry_t *entry);
 RRStatus RaftLogSync(RaftLog *log);
+void RaftLogBeginBatch(RaftLog *log);
+RRStatus RaftLogSyncBatch(RaftLog *log);
+RRStatus RaftLogEndBatch(RaftLog *log);
+bool RaftLogSyncAsync(RaftLog *log, uv_loop_t *loop, RaftLogSyncCallback cb, void *arg);
 raft_entry_t *RaftLogGet(RaftLog *log, raft_index_t idx);
+int RaftLogGetBatch(RaftLog *log, raft_index_t idx, int entries_n, raft_entry_t **entries);
 RRStatus RaftLogDelete(RaftLog *log, raft_index_t from_idx, func_entry_notify_f cb, void *cb_arg);
 RRStatus RaftLogReset(RaftLog *log, raft_index_t index, raft_term_t term);
 raft_index_t RaftLogCount(RaftLog *log);
 raft_index_t RaftLogFirstIdx(RaftLog *log);
 raft_index_t RaftLogCurrentIdx(RaftLog *log);
-long long int RaftLogRewrite(RedisRaftCtx *rr, const char *filename, raft_index_t last_idx, raft_term_t last_term);
-long long int RaftLogRewriteAppend(RedisRaftCtx *rr, RaftLog *target_log, raft_index_t from_idx);
+RRStatus RaftLogCompact(RaftLog *log, raft_index_t idx, raft_term_t term);
 void RaftLogRemoveFiles(const char *filename);
 void RaftLogArchiveFiles(RedisRaftCtx *rr);
-RRStatus RaftLogRewriteSwitch(RedisRaftCtx *rr, RaftLog *new_log, unsigned long new_log_entries);
 
 typedef struct EntryCache {
     unsigned long int size;             /* Size of ptrs */
@@ -536,15 +780,23 @@ typedef struct EntryCache {
     unsigned long int start;            /* ptrs array index of first entry */
     unsigned long int entries_memsize;  /* Total memory used by entries */
     raft_entry_t **ptrs;
+    raft_index_t keep_idx;              /* Lowest index still needed, see EntryCacheCompact */
+
+    /* Stats */
+    unsigned long long hits;            /* Entries read from the cache */
+    unsigned long long misses;          /* Entries read from the log file */
+    unsigned long long miss_bytes;      /* Bytes of entries read from the log file */
+    unsigned long long needed_evictions; /* Evicted entries that were still needed */
 } EntryCache;
 
 EntryCache *EntryCacheNew(unsigned long initial_size);
 void EntryCacheFree(EntryCache *cache);
 void EntryCacheAppend(EntryCache *cache, raft_entry_t *ety, raft_index_t idx);
+void EntryCachePrepend(EntryCache *cache, raft_entry_t *ety, raft_index_t idx);
 raft_entry_t *EntryCacheGet(EntryCache *cache, raft_index_t idx);
 long EntryCacheDeleteHead(EntryCache *cache, raft_index_t idx);
 long EntryCacheDeleteTail(EntryCache *cache, raft_index_t index);
-long EntryCacheCompact(EntryCache *cache, size_t max_memory);
+long EntryCacheCompact(EntryCache *cache, size_t max_memory, raft_index_t keep_idx);
 
 /* config.c */
 void ConfigInit(RedisModuleCtx *ctx, RedisRaftConfig *config);
@@ -571,5 +823,8 @@ void archiveSnapshot(RedisRaftCtx *rr);
 
 /* proxy.c */
 RRStatus ProxyCommand(RedisRaftCtx *rr, RaftReq *req, Node *leader);
+RRStatus ProxyReadIndex(RedisRaftCtx *rr, RaftReq *req, Node *leader);
+RRStatus ProxyBatchCommand(RedisRaftCtx *rr, RaftReq *req, Node *leader);
+void ProxyFlushBatch(RedisRaftCtx *rr);
 
 #endif  /* _REDISRAFT_H */
@@ -8,7 +8,9 @@
  */
 
 #include <assert.h>
+#include <limits.h>
 #include <string.h>
+#include <strings.h>
 #include "redisraft.h"
 
 /* RaftRedisCommand represents a single Redis command to execute.  Every Raft log entry
@@ -88,23 +90,79 @@ void RaftRedisCommandArrayFree(RaftRedisCommandArray *array)
     array->size = array->len = 0;
 }
 
+/* Returns true if the command is a MULTI, i.e. the first command of an
+ * array that holds a MULTI/EXEC transaction.
+ */
+bool RaftRedisCommandIsMulti(const RaftRedisCommand *cmd)
+{
+    size_t len;
+    const char *str = RedisModule_StringPtrLen(cmd->argv[0], &len);
+
+    return len == 5 && !strncasecmp(str, "MULTI", 5);
+}
+
+/* Batches of independent commands.
+ *
+ * Commands of different clients that are written as a single entry (see
+ * raft-write-batching) or proxied to the leader as a single RAFT.ENTRY are
+ * prefixed by a command made of RAFT_BATCH_MARKER alone:
+ *
+ *   *3\n*1\n$10\nRAFT.BATCH\n*2\n$4\nINCR\n$1\na\n*2\n$4\nINCR\n$1\nb\n
+ *
+ * Each command is executed on its own and has its own reply, so a batch never
+ * holds a MULTI/EXEC transaction.
+ */
+RaftRedisCommand *RaftRedisCommandBatchMarker(void)
+{
+    static RedisModuleString *marker_str = NULL;
+    static RaftRedisCommand marker = { .argc = 1 };
+
+    if (!marker_str) {
+        marker_str = RedisModule_CreateString(NULL, RAFT_BATCH_MARKER, strlen(RAFT_BATCH_MARKER));
+        marker.argv = &marker_str;
+    }
+
+    return &marker;
+}
+
+/* Returns true if the array is a batch of independent commands, rather than a
+ * single command or a MULTI/EXEC transaction.
+ */
+bool RaftRedisCommandArrayIsBatch(const RaftRedisCommandArray *array)
+{
+    if (array->len < 2 || array->commands[0]->argc != 1) {
+        return false;
+    }
+
+    size_t len;
+    const char *str = RedisModule_StringPtrLen(array->commands[0]->argv[0], &len);
+
+    return len == strlen(RAFT_BATCH_MARKER) && !memcmp(str, RAFT_BATCH_MARKER, len);
+}
 
-/* Return expected length of integer value as decimal digits + 2 byte overhead */
+
+/* Returns the number of decimal digits in val */
+static inline int countDigits(unsigned long val)
+{
+    int n = 1;
+
+    while (val >= 10000) {
+        val /= 10000;
+        n += 4;
+    }
+
+    return n + (val >= 10) + (val >= 100) + (val >= 1000);
+}
+
+/* Return exact length of integer value as decimal digits + 2 byte overhead */
 static int calcIntSerializedLen(size_t val)
 {
-    if (val < 10) return 3;
-    if (val < 100) return 4;
-    if (val < 1000) return 5;
-    if (val < 10000) return 6;
-    if (val < 100000) return 7;
-    if (val < 1000000) return 8;
-    if (val < 10000000) return 9;
-    return 22;
+    return countDigits(val) + 2;
 }
 
 static size_t calcSerializedSize(RaftRedisCommand *cmd)
 {
-    size_t sz = calcIntSerializedLen(cmd->argc + 1);
+    size_t sz = calcIntSerializedLen(cmd->argc);
     int i;
 
     for (i = 0; i < cmd->argc; i++) {
@@ -116,13 +174,42 @@ static size_t calcSerializedSize(RaftRedisCommand *cmd)
     return sz;
 }
 
+static const char digitPairs[201] =
+    "0001020304050607080910111213141516171819"
+    "2021222324252627282930313233343536373839"
+    "4041424344454647484950515253545556575859"
+    "6061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+/* Encodes <prefix><val>\n, filling in digits from the end two at a time.
+ * Returns the encoded length, or -1 if it doesn't fit in sz bytes.
+ */
 static int encodeInteger(char prefix, char *ptr, size_t sz, unsigned long val)
 {
-    int n = snprintf(ptr, sz, "%c%lu\n", prefix, val);
-    
-    if (n >= sz) {
+    int digits = countDigits(val);
+    int n = digits + 2;
+
+    if (n > sz) {
         return -1;
     }
+
+    char *p = ptr + digits;
+    while (val >= 100) {
+        const char *d = &digitPairs[(val % 100) * 2];
+        val /= 100;
+        *p-- = d[1];
+        *p-- = d[0];
+    }
+    if (val >= 10) {
+        *p-- = digitPairs[val * 2 + 1];
+        *p = digitPairs[val * 2];
+    } else {
+        *p = '0' + val;
+    }
+
+    ptr[0] = prefix;
+    ptr[n - 1] = '\n';
+
     return n;
 }
 
@@ -175,37 +262,33 @@ raft_entry_t *RaftRedisCommandArraySerialize(const RaftRedisCommandArray *source
     return ety;
 }
 
+#define MAX_INT_DIGITS  19      /* Fits in 64 bits without overflow */
+
+/* Decodes <expect_prefix><val>\n, returning the encoded length or -1 if
+ * invalid.  Digits are consumed with a single unsigned range check each.
+ */
 static int decodeInteger(const char *ptr, size_t sz, char expect_prefix, size_t *val)
 {
-    size_t tmp = 0;
-    int len = 1;
-
     if (sz < 3 || *ptr != expect_prefix) {
         return -1;
     }
 
-    ptr++; sz--;
-    while (*ptr != '\n') {
-        if (*ptr < '0' || *ptr > '9') {
-            return -1;
-        }
-        tmp *= 10;
-        tmp += (*ptr - '0');
-
-        ptr++;
-        sz--;
-        len++;
-        
-        if (!sz) {
-            return -1;
-        }
+    const char *p = ptr + 1;
+    const char *end = ptr + (sz - 1 < MAX_INT_DIGITS + 1 ? sz - 1 : MAX_INT_DIGITS + 1);
+    size_t tmp = 0;
+    unsigned int d;
+
+    while (p < end && (d = (unsigned char) *p - '0') <= 9) {
+        tmp = tmp * 10 + d;
+        p++;
     }
 
-    sz--;
-    ptr++;
-    *val = tmp;
+    if (p == ptr + 1 || *p != '\n') {
+        return -1;
+    }
 
-    return len + 1;
+    *val = tmp;
+    return p - ptr + 1;
 }
 
 size_t RaftRedisCommandDeserialize(RaftRedisCommand *target, const void *buf, size_t buf_size)
@@ -244,6 +327,93 @@ error:
     return 0;
 }
 
+/* Compressed entries.
+ *
+ * Entries with a large payload may be compressed when they are created (see
+ * raft-entry-compress-threshold). A compressed entry has the type
+ * RAFT_LOGTYPE_COMPRESSED rather than RAFT_LOGTYPE_NORMAL, which is carried
+ * in the log entry header and in AppendEntries messages, and its payload is:
+ *
+ *   $<uncompressed length>\n<LZF compressed data>
+ *
+ * Entries remain compressed in the log file, the entry cache and AppendEntries
+ * messages to nodes that support them, and are only decompressed to be
+ * executed.
+ */
+#define COMPRESSED_LEN_PREFIX   '$'
+#define LZF_MAX_RATIO       132     /* A 2 byte reference expands to 264 bytes */
+
+/* Compresses the entry's payload if it is at least threshold bytes long and
+ * compression saves at least 1/8 of its size.
+ *
+ * Returns a new entry with the compressed payload, releasing the original one,
+ * or the original entry if it was not compressed.
+ */
+raft_entry_t *RaftEntryCompress(raft_entry_t *ety, size_t threshold)
+{
+    if (!threshold || ety->data_len < threshold || ety->type != RAFT_LOGTYPE_NORMAL) {
+        return ety;
+    }
+
+    char hdr[32];
+    int hdr_len = encodeInteger(COMPRESSED_LEN_PREFIX, hdr, sizeof(hdr), ety->data_len);
+    assert(hdr_len != -1);
+
+    size_t max_len = ety->data_len - ety->data_len / 8 - hdr_len;
+    char *buf = RedisModule_Alloc(max_len);
+    size_t len = LZFCompress(ety->data, ety->data_len, buf, max_len);
+    if (!len) {
+        RedisModule_Free(buf);
+        return ety;
+    }
+
+    raft_entry_t *compressed = raft_entry_new(hdr_len + len);
+    memcpy(compressed->data, hdr, hdr_len);
+    memcpy(compressed->data + hdr_len, buf, len);
+    compressed->id = ety->id;
+    compressed->type = RAFT_LOGTYPE_COMPRESSED;
+    compressed->term = ety->term;
+
+    RedisModule_Free(buf);
+    raft_entry_release(ety);
+
+    return compressed;
+}
+
+bool RaftEntryIsCompressed(raft_entry_t *ety)
+{
+    return ety->type == RAFT_LOGTYPE_COMPRESSED;
+}
+
+/* Returns a new, regular entry with the decompressed payload of a compressed
+ * entry, or NULL if the payload is invalid. The compressed entry is not
+ * released.
+ */
+raft_entry_t *RaftEntryDecompress(raft_entry_t *ety)
+{
+    size_t len;
+    int n;
+
+    assert(RaftEntryIsCompressed(ety));
+
+    if ((n = decodeInteger(ety->data, ety->data_len, COMPRESSED_LEN_PREFIX, &len)) < 0 ||
+        !len || len > UINT_MAX || len / LZF_MAX_RATIO > ety->data_len - n) {
+        return NULL;
+    }
+
+    raft_entry_t *decompressed = raft_entry_new(len);
+    if (LZFDecompress(ety->data + n, ety->data_len - n, decompressed->data, len) != len) {
+        raft_entry_release(decompressed);
+        return NULL;
+    }
+
+    decompressed->id = ety->id;
+    decompressed->type = RAFT_LOGTYPE_NORMAL;
+    decompressed->term = ety->term;
+
+    return decompressed;
+}
+
 RRStatus RaftRedisCommandArrayDeserialize(RaftRedisCommandArray *target, const void *buf, size_t buf_size)
 {
     const void *p = buf;
@@ -281,3 +451,248 @@ RRStatus RaftRedisCommandArrayDeserialize(RaftRedisCommandArray *target, const v
 }
 
 
+
+/* Binary encoding of AppendEntries messages, used by RAFT.AEB.
+ *
+ * The message is packed into a single buffer of fixed width, little endian
+ * fields:
+ *
+ *   term, prev_log_idx, prev_log_term, leader_commit, msg_id   (8 bytes each)
+ *   n_entries                                                  (4 bytes)
+ *
+ * Followed by n_entries entries:
+ *
+ *   term (8 bytes), id (4 bytes), type (4 bytes), data_len (4 bytes)
+ *   data (data_len bytes)
+ */
+
+#define AE_HEADER_SIZE  (5 * 8 + 4)
+#define AE_ENTRY_HEADER_SIZE  (8 + 3 * 4)
+
+static char *putUInt64(char *p, uint64_t val)
+{
+    int i;
+
+    for (i = 0; i < 8; i++) {
+        *p++ = (char) (val >> (i * 8));
+    }
+
+    return p;
+}
+
+static char *putUInt32(char *p, uint32_t val)
+{
+    int i;
+
+    for (i = 0; i < 4; i++) {
+        *p++ = (char) (val >> (i * 8));
+    }
+
+    return p;
+}
+
+static const char *getUInt64(const char *p, uint64_t *val)
+{
+    const unsigned char *u = (const unsigned char *) p;
+    int i;
+
+    *val = 0;
+    for (i = 0; i < 8; i++) {
+        *val |= (uint64_t) u[i] << (i * 8);
+    }
+
+    return p + 8;
+}
+
+static const char *getUInt32(const char *p, uint32_t *val)
+{
+    const unsigned char *u = (const unsigned char *) p;
+    int i;
+
+    *val = 0;
+    for (i = 0; i < 4; i++) {
+        *val |= (uint32_t) u[i] << (i * 8);
+    }
+
+    return p + 4;
+}
+
+/* Returns the size of an AppendEntries message once serialized. */
+size_t RaftAppendEntriesSerializedSize(const msg_appendentries_t *msg)
+{
+    size_t size = AE_HEADER_SIZE;
+    int i;
+
+    for (i = 0; i < msg->n_entries; i++) {
+        size += AE_ENTRY_HEADER_SIZE + msg->entries[i]->data_len;
+    }
+
+    return size;
+}
+
+/* Serializes an AppendEntries message into buf, which must hold
+ * RaftAppendEntriesSerializedSize() bytes. Returns the end of the message.
+ */
+char *RaftAppendEntriesSerializeTo(const msg_appendentries_t *msg, char *buf)
+{
+    char *p = buf;
+    int i;
+
+    p = putUInt64(p, msg->term);
+    p = putUInt64(p, msg->prev_log_idx);
+    p = putUInt64(p, msg->prev_log_term);
+    p = putUInt64(p, msg->leader_commit);
+    p = putUInt64(p, msg->msg_id);
+    p = putUInt32(p, msg->n_entries);
+
+    for (i = 0; i < msg->n_entries; i++) {
+        raft_entry_t *e = msg->entries[i];
+
+        p = putUInt64(p, e->term);
+        p = putUInt32(p, e->id);
+        p = putUInt32(p, e->type);
+        p = putUInt32(p, e->data_len);
+        memcpy(p, e->data, e->data_len);
+        p += e->data_len;
+    }
+
+    return p;
+}
+
+/* Serializes an AppendEntries message into a newly allocated buffer, which
+ * the caller should free.
+ */
+char *RaftAppendEntriesSerialize(const msg_appendentries_t *msg, size_t *len)
+{
+    size_t size = RaftAppendEntriesSerializedSize(msg);
+    char *buf = RedisModule_Alloc(size);
+    char *p = RaftAppendEntriesSerializeTo(msg, buf);
+
+    assert(p - buf == size);
+
+    *len = size;
+    return buf;
+}
+
+/* Received entries are sliced out of a single allocation, rather than
+ * allocated one by one.
+ *
+ * raft_entry_t holds its data inline, so entries can't point into the
+ * message buffer itself. Instead, all entries of a message are laid out in one
+ * block, each preceded by a pointer back to the block. Every entry holds a
+ * reference to the block, which is freed when the last entry is released.
+ */
+typedef struct AEEntryBlock {
+    unsigned long refs;
+} AEEntryBlock;
+
+#define AE_BLOCK_ALIGN(n)   (((n) + 7) & ~((size_t) 7))
+#define AE_BLOCK_HEADER_SIZE    AE_BLOCK_ALIGN(sizeof(AEEntryBlock))
+#define AE_SLICE_SIZE(data_len) \
+    AE_BLOCK_ALIGN(sizeof(AEEntryBlock *) + sizeof(raft_entry_t) + (data_len))
+
+static void releaseAEEntrySlice(raft_entry_t *ety)
+{
+    AEEntryBlock *block = *((AEEntryBlock **) ety - 1);
+
+    if (!--block->refs) {
+        RedisModule_Free(block);
+    }
+}
+
+/* Deserializes an AppendEntries message.  On success, the target message holds
+ * an allocated array of entries which should be released by the caller.
+ */
+RRStatus RaftAppendEntriesDeserialize(msg_appendentries_t *target, const void *buf, size_t buf_size)
+{
+    const char *p = buf;
+    const char *end = p + buf_size;
+    uint64_t val64;
+    uint32_t val32;
+    int i;
+
+    memset(target, 0, sizeof(*target));
+
+    if (buf_size < AE_HEADER_SIZE) {
+        return RR_ERROR;
+    }
+
+    p = getUInt64(p, &val64);
+    target->term = val64;
+    p = getUInt64(p, &val64);
+    target->prev_log_idx = val64;
+    p = getUInt64(p, &val64);
+    target->prev_log_term = val64;
+    p = getUInt64(p, &val64);
+    target->leader_commit = val64;
+    p = getUInt64(p, &val64);
+    target->msg_id = val64;
+    p = getUInt32(p, &val32);
+
+    /* Every entry requires at least its header */
+    if (val32 > (end - p) / AE_ENTRY_HEADER_SIZE) {
+        return RR_ERROR;
+    }
+    if (!val32) {
+        return RR_OK;
+    }
+
+    /* Validate all entries and size the block before allocating anything */
+    const char *entries_start = p;
+    size_t block_size = AE_BLOCK_HEADER_SIZE;
+
+    for (i = 0; i < val32; i++) {
+        uint32_t data_len;
+
+        if (end - p < AE_ENTRY_HEADER_SIZE) {
+            return RR_ERROR;
+        }
+
+        getUInt32(p + 16, &data_len);
+        p += AE_ENTRY_HEADER_SIZE;
+
+        if (end - p < data_len) {
+            return RR_ERROR;
+        }
+
+        p += data_len;
+        block_size += AE_SLICE_SIZE(data_len);
+    }
+
+    if (p != end) {
+        return RR_ERROR;
+    }
+
+    AEEntryBlock *block = RedisModule_Alloc(block_size);
+    char *slice = (char *) block + AE_BLOCK_HEADER_SIZE;
+
+    block->refs = val32;
+    target->entries = RedisModule_Calloc(val32, sizeof(target->entries[0]));
+    target->n_entries = val32;
+
+    for (i = 0, p = entries_start; i < val32; i++) {
+        uint32_t id, type, data_len;
+
+        p = getUInt64(p, &val64);
+        p = getUInt32(p, &id);
+        p = getUInt32(p, &type);
+        p = getUInt32(p, &data_len);
+
+        *(AEEntryBlock **) slice = block;
+        raft_entry_t *e = (raft_entry_t *) (slice + sizeof(AEEntryBlock *));
+        memset(e, 0, sizeof(*e));
+        e->term = val64;
+        e->id = (int32_t) id;
+        e->type = (int32_t) type;
+        e->refs = 1;
+        e->free_func = releaseAEEntrySlice;
+        e->data_len = data_len;
+        memcpy(e->data, p, data_len);
+        p += data_len;
+
+        target->entries[i] = e;
+        slice += AE_SLICE_SIZE(data_len);
+    }
+
+    return RR_OK;
+}
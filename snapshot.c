@@ -10,6 +10,7 @@
 #include <string.h>
 #include <stdlib.h>
 #include <assert.h>
+#include <sys/stat.h>
 #include "redisraft.h"
 
 /* These are ugly hacks to work around missing Redis Module API calls!
@@ -110,56 +111,31 @@ void cancelSnapshot(RedisRaftCtx *rr, SnapshotResult *sr)
 
 RRStatus finalizeSnapshot(RedisRaftCtx *rr, SnapshotResult *sr)
 {
-    RaftLog *new_log = NULL;
-    unsigned long num_log_entries;
-
-    char temp_log_filename[256];
-    snprintf(temp_log_filename, sizeof(temp_log_filename) - 1, "%s.tmp",
-        rr->config->raft_log_filename);
-
     assert(rr->snapshot_in_progress);
 
     TRACE("Finalizing snapshot.\n");
 
-    /* If a persistent log is in use, we now have to append any new
-     * entries to the temporary log and switch.
-     */
-    if (rr->log) {
-        num_log_entries = RaftLogRewrite(rr, temp_log_filename,
-            rr->last_snapshot_idx, rr->last_snapshot_term);
-
-        new_log = RaftLogOpen(temp_log_filename, rr->config, RAFTLOG_KEEP_INDEX);
-        if (!new_log) {
-            LOG_ERROR("Failed to open log after rewrite: %s\n", strerror(errno));
-            cancelSnapshot(rr, sr);
-            return -1;
-        }
-
-        LOG_VERBOSE("Log rewrite complete, %lld entries rewritten (from idx %lu).\n",
-                num_log_entries, raft_get_snapshot_last_idx(rr->raft));
-
-    }
-
-    /* We now have to switch temp files. We need to rename two files in a non-atomic
-     * operation, so order is critical and we must rename the snapshot file first.
-     * This guarantees we lose no data if we fail now before renaming the log -- all
-     * we'll have to do is skip redundant log entries.
+    /* The snapshot file must be renamed before the log is compacted.  This
+     * guarantees we lose no data if we fail now before compacting the log --
+     * all we'll have to do is skip redundant log entries.
      */
 
     if (rename(sr->rdb_filename, rr->config->rdb_filename) < 0) {
         LOG_ERROR("Failed to switch snapshot filename (%s to %s): %s\n",
                 sr->rdb_filename, rr->config->rdb_filename, strerror(errno));
-        if (new_log) {
-            RaftLogClose(new_log);
-        }
         cancelSnapshot(rr, sr);
         return -1;
     }
 
-    if (RaftLogRewriteSwitch(rr, new_log, num_log_entries) != RR_OK) {
-        RaftLogClose(new_log);
-        cancelSnapshot(rr, sr);
-        return -1;
+    /* If a persistent log is in use, remove the segments that only hold
+     * entries included in the snapshot.
+     */
+    if (rr->log) {
+        if (RaftLogCompact(rr->log, rr->last_snapshot_idx, rr->last_snapshot_term) != RR_OK) {
+            LOG_ERROR("Failed to compact Raft log: %s\n", strerror(errno));
+            cancelSnapshot(rr, sr);
+            return -1;
+        }
     }
 
     /* Finalize snapshot */
@@ -225,7 +201,7 @@ RRStatus initiateSnapshot(RedisRaftCtx *rr)
        return RR_ERROR;
     }
 
-    if (snapshotSendInProgress(rr) > 0) {
+    if (snapshotSendInProgress(rr) > 0 || rr->snapshot_stream) {
         LOG_DEBUG("Delaying snapshot as snapshot delivery is in progress.\n");
         return RR_ERROR;
     }
@@ -418,33 +394,132 @@ static int loadSnapshot(RedisRaftCtx *rr)
     return 0;
 }
 
-static RRStatus storeSnapshotData(RedisRaftCtx *rr, RedisModuleString *data_str)
+/* RAFT.LOADSNAPSHOT reply status codes */
+#define LOADSNAPSHOT_SKIPPED    0       /* Snapshot not needed */
+#define LOADSNAPSHOT_LOADED     1       /* Snapshot received and loaded */
+#define LOADSNAPSHOT_CONTINUE   2       /* Send next chunk */
+
+static void replyLoadSnapshot(RedisRaftCtx *rr, RaftReq *req, long long status)
+{
+    if (!req->r.loadsnapshot.chunked) {
+        RedisModule_ReplyWithLongLong(req->ctx, status);
+        return;
+    }
+
+    RedisModule_ReplyWithArray(req->ctx, 2);
+    RedisModule_ReplyWithLongLong(req->ctx, status);
+    RedisModule_ReplyWithLongLong(req->ctx, rr->snapshot_recv_offset);
+}
+
+static void getSnapshotRecvFilename(RedisRaftCtx *rr, char *buf, size_t buf_size)
+{
+    snprintf(buf, buf_size - 1, "%s.tmp.recv", rr->config->rdb_filename);
+}
+
+/* Drops a partially received snapshot, if we have one. */
+static void discardSnapshotRecv(RedisRaftCtx *rr)
+{
+    char filename[256];
+
+    if (rr->snapshot_recv_fd == -1) {
+        return;
+    }
+
+    close(rr->snapshot_recv_fd);
+    rr->snapshot_recv_fd = -1;
+    rr->snapshot_recv_offset = 0;
+
+    getSnapshotRecvFilename(rr, filename, sizeof(filename));
+    unlink(filename);
+}
+
+/* Appends a received snapshot chunk to the temporary snapshot file.
+ *
+ * A chunk that belongs to a different snapshot (as identified by the leader's
+ * term, snapshot index and size) starts a new one. A chunk that does not match
+ * our current offset is ignored, and the leader will resume sending from the
+ * offset we reply with.
+ */
+static RRStatus storeSnapshotChunk(RedisRaftCtx *rr, RaftReq *req)
 {
     size_t data_len;
-    const char *data = RedisModule_StringPtrLen(data_str, &data_len);
-    int fd = open(rr->config->rdb_filename, O_CREAT|O_TRUNC|O_RDWR, 0666);
+    const char *data = RedisModule_StringPtrLen(req->r.loadsnapshot.snapshot, &data_len);
+    char filename[256];
+
+    if (rr->snapshot_recv_fd == -1 ||
+        rr->snapshot_recv_term != req->r.loadsnapshot.term ||
+        rr->snapshot_recv_idx != req->r.loadsnapshot.idx ||
+        rr->snapshot_recv_size != req->r.loadsnapshot.size) {
+
+        discardSnapshotRecv(rr);
+
+        getSnapshotRecvFilename(rr, filename, sizeof(filename));
+        rr->snapshot_recv_fd = open(filename, O_CREAT|O_TRUNC|O_WRONLY, 0666);
+        if (rr->snapshot_recv_fd < 0) {
+            LOG_ERROR("Failed to open snapshot file: %s: %s\n",
+                    filename, strerror(errno));
+            rr->snapshot_recv_fd = -1;
+            return RR_ERROR;
+        }
 
-    if (fd < 0) {
-        LOG_ERROR("Failed to open snapshot file: %s: %s\n",
-                rr->config->rdb_filename, strerror(errno));
+        rr->snapshot_recv_term = req->r.loadsnapshot.term;
+        rr->snapshot_recv_idx = req->r.loadsnapshot.idx;
+        rr->snapshot_recv_size = req->r.loadsnapshot.size;
+        rr->snapshot_recv_offset = 0;
+    }
+
+    if (req->r.loadsnapshot.offset != rr->snapshot_recv_offset) {
+        LOG_VERBOSE("Ignoring snapshot chunk at offset %lu, expected offset %lu\n",
+                req->r.loadsnapshot.offset, rr->snapshot_recv_offset);
+        return RR_OK;
+    }
+
+    if (rr->snapshot_recv_offset + data_len > rr->snapshot_recv_size) {
+        LOG_ERROR("Snapshot chunk exceeds snapshot size %lu\n", rr->snapshot_recv_size);
+        discardSnapshotRecv(rr);
         return RR_ERROR;
     }
 
-    int r = write(fd, data, data_len);
-    if (r < data_len) {
+    size_t written = 0;
+    while (written < data_len) {
+        ssize_t r = write(rr->snapshot_recv_fd, data + written, data_len - written);
         if (r < 0) {
-            LOG_ERROR("Failed to write snapshot file: %s: %s\n", rr->config->rdb_filename,
-                    strerror(errno));
-        } else {
-            LOG_ERROR("Short write on snapshot file: %s\n", rr->config->rdb_filename);
+            LOG_ERROR("Failed to write snapshot file: %s\n", strerror(errno));
+            discardSnapshotRecv(rr);
+            return RR_ERROR;
         }
-        close(fd);
+        written += r;
+    }
+
+    rr->snapshot_recv_offset += data_len;
+    return RR_OK;
+}
+
+/* Makes a fully received snapshot the current RDB file. */
+static RRStatus commitSnapshotRecv(RedisRaftCtx *rr)
+{
+    char filename[256];
+    size_t size = rr->snapshot_recv_size;
+
+    getSnapshotRecvFilename(rr, filename, sizeof(filename));
+
+    if (fsync(rr->snapshot_recv_fd) < 0) {
+        LOG_ERROR("Failed to sync snapshot file: %s: %s\n", filename, strerror(errno));
+        discardSnapshotRecv(rr);
+        return RR_ERROR;
+    }
 
+    close(rr->snapshot_recv_fd);
+    rr->snapshot_recv_fd = -1;
+
+    if (rename(filename, rr->config->rdb_filename) < 0) {
+        LOG_ERROR("Failed to rename snapshot file: %s: %s\n", filename, strerror(errno));
+        unlink(filename);
         return RR_ERROR;
     }
 
     LOG_DEBUG("Saved received snapshot to file: %s, %lu bytes\n",
-            rr->config->rdb_filename, data_len);
+            rr->config->rdb_filename, size);
 
     return RR_OK;
 }
@@ -475,7 +550,8 @@ void handleLoadSnapshot(RedisRaftCtx *rr, RaftReq *req)
     if (req->r.loadsnapshot.term < raft_get_current_term(rr->raft)) {
         LOG_VERBOSE("Skipping queued RAFT.LOADSNAPSHOT with old term %d\n",
             req->r.loadsnapshot.term);
-        RedisModule_ReplyWithLongLong(req->ctx, 0);
+        discardSnapshotRecv(rr);
+        replyLoadSnapshot(rr, req, LOADSNAPSHOT_SKIPPED);
         goto exit;
     }
 
@@ -483,14 +559,16 @@ void handleLoadSnapshot(RedisRaftCtx *rr, RaftReq *req)
     if (req->r.loadsnapshot.idx < raft_get_last_applied_idx(rr->raft)) {
         LOG_VERBOSE("Skipping queued RAFT.LOADSNAPSHOT with index %ld, already applied %d\n",
             req->r.loadsnapshot.idx, raft_get_last_applied_idx(rr->raft));
-        RedisModule_ReplyWithLongLong(req->ctx, 0);
+        discardSnapshotRecv(rr);
+        replyLoadSnapshot(rr, req, LOADSNAPSHOT_SKIPPED);
         goto exit;
     }
 
     if (req->r.loadsnapshot.idx < raft_get_current_idx(rr->raft)) {
         LOG_VERBOSE("Skipping queued RAFT.LOADSNAPSHOT with index %ld, current idx is %ld\n",
             req->r.loadsnapshot.idx, raft_get_current_idx(rr->raft));
-        RedisModule_ReplyWithLongLong(req->ctx, 0);
+        discardSnapshotRecv(rr);
+        replyLoadSnapshot(rr, req, LOADSNAPSHOT_SKIPPED);
         goto exit;
     }
 
@@ -499,11 +577,22 @@ void handleLoadSnapshot(RedisRaftCtx *rr, RaftReq *req)
             LOG_VERBOSE("Skipping queued RAFT.LOADSNAPSHOT with identical term %ld index %ld\n",
                 raft_get_snapshot_last_term(rr->raft),
                 raft_get_snapshot_last_idx(rr->raft));
-            RedisModule_ReplyWithLongLong(req->ctx, 0);
+            discardSnapshotRecv(rr);
+            replyLoadSnapshot(rr, req, LOADSNAPSHOT_SKIPPED);
             goto exit;
     }
 
-    if (storeSnapshotData(rr, req->r.loadsnapshot.snapshot) != RR_OK) {
+    if (storeSnapshotChunk(rr, req) != RR_OK) {
+        RedisModule_ReplyWithError(req->ctx, "ERR failed to store snapshot");
+        goto exit;
+    }
+
+    if (rr->snapshot_recv_offset < rr->snapshot_recv_size) {
+        replyLoadSnapshot(rr, req, LOADSNAPSHOT_CONTINUE);
+        goto exit;
+    }
+
+    if (commitSnapshotRecv(rr) != RR_OK) {
         RedisModule_ReplyWithError(req->ctx, "ERR failed to store snapshot");
         goto exit;
     }
@@ -549,7 +638,7 @@ void handleLoadSnapshot(RedisRaftCtx *rr, RaftReq *req)
     initializeSnapshotInfo(rr);
 
     RedisModule_ThreadSafeContextUnlock(rr->ctx);
-    RedisModule_ReplyWithLongLong(req->ctx, 1);
+    replyLoadSnapshot(rr, req, LOADSNAPSHOT_LOADED);
 
     rr->snapshots_loaded++;
 
@@ -667,29 +756,93 @@ RedisModuleTypeMethods RedisRaftTypeMethods = {
     .free = clearSnapshotInfo
 };
 
+/* State of a diskless snapshot delivery, see the diskless delivery section below */
+typedef struct SnapshotStream {
+    int fd;                     /* Pipe connected to the streaming child */
+    bool started;               /* Header received, chunks are being sent */
+    bool reading;               /* A read from the pipe is pending */
+    raft_term_t term;           /* Term in which the snapshot was created */
+    raft_index_t idx;           /* Last index included in the snapshot */
+    size_t size;                /* Size of the RDB */
+    size_t offset;              /* Offset of the current chunk */
+    size_t chunk_len;           /* Length of the current chunk */
+    size_t read_len;            /* Bytes read so far, of header or chunk */
+    char *buf;                  /* Current chunk */
+    SnapshotResult sr;          /* Header written by the child */
+    uv_fs_t req;
+    uv_buf_t uv_buf;
+} SnapshotStream;
+
+/* State of a snapshot file delivery, see the file delivery section below */
+typedef struct SnapshotSource {
+    RedisRaftCtx *rr;
+    int refcount;               /* Nodes the file is delivered to */
+    bool opening;               /* The file is being opened */
+    bool reading;               /* A chunk read is pending */
+    uv_file fd;                 /* Snapshot file, or -1 if not open yet */
+    raft_index_t idx;           /* Last index included in the snapshot */
+    size_t size;                /* Size of the snapshot file */
+    char *buf;                  /* Last chunk read */
+    size_t buf_size;            /* Allocated size of buf */
+    bool chunk_valid;           /* buf holds the chunk at chunk_offset */
+    size_t chunk_offset;        /* Offset of the chunk in buf */
+    size_t chunk_len;           /* Length of the chunk in buf */
+    uv_fs_t req;
+    uv_buf_t uv_buf;
+} SnapshotSource;
+
 /* TODO -- move this to Raft library header file */
 void raft_node_set_next_idx(raft_node_t* me_, raft_index_t nextIdx);
 
+static void cleanSnapshotDelivery(Node *node);
+static void requestSnapshotChunk(Node *node);
+static void checkSnapshotStream(RedisRaftCtx *rr);
+
 static void handleLoadSnapshotResponse(redisAsyncContext *c, void *r, void *privdata)
 {
     Node *node = privdata;
     RedisRaftCtx *rr = node->rr;
+    bool stream = node->snapshot_stream;
 
     redisReply *reply = r;
 
-    node->load_snapshot_in_progress = false;
-
-    NodeDismissPendingResponse(node);
+    node->bulk_request_time = 0;
     if (!reply) {
         NODE_LOG_ERROR(node, "RAFT.LOADSNAPSHOT failure: connection dropped\n");
-        NodeMarkDisconnected(node);
     } else if (reply->type == REDIS_REPLY_ERROR) {
         NODE_LOG_ERROR(node, "RAFT.LOADSNAPSHOT error: %s\n", reply->str);
-    } else if (reply->type != REDIS_REPLY_INTEGER) {
+    } else if (reply->type != REDIS_REPLY_ARRAY || reply->elements != 2 ||
+               reply->element[0]->type != REDIS_REPLY_INTEGER ||
+               reply->element[1]->type != REDIS_REPLY_INTEGER ||
+               reply->element[1]->integer < 0 ||
+               reply->element[1]->integer > (long long) node->snapshot_size) {
         NODE_LOG_ERROR(node, "RAFT.LOADSNAPSHOT invalid response type\n");
+    } else if (reply->element[0]->integer == LOADSNAPSHOT_CONTINUE) {
+        /* Node expects more data, possibly from a different offset if it
+         * already has part of this snapshot.
+         */
+        node->snapshot_offset = reply->element[1]->integer;
+        if (!stream) {
+            requestSnapshotChunk(node);
+            return;
+        }
+
+        /* A stream can't go back or skip ahead, so a node that has part of
+         * the snapshot already gets the snapshot file the next time.
+         */
+        if (node->snapshot_offset == rr->snapshot_stream->offset +
+                                     rr->snapshot_stream->chunk_len) {
+            checkSnapshotStream(rr);
+            return;
+        }
+
+        NODE_LOG_DEBUG(node, "Snapshot stream at offset %lu, node expects %lu\n",
+                rr->snapshot_stream->offset + rr->snapshot_stream->chunk_len,
+                node->snapshot_offset);
+        node->snapshot_use_file = true;
     } else {
         NODE_LOG_DEBUG(node, "RAFT.LOADSNAPSHOT response %lld\n",
-                reply->integer);
+                reply->element[0]->integer);
         raft_node_t *n = raft_get_node(rr->raft, node->id);
         if (n != NULL) {
             raft_node_set_next_idx(n, node->load_snapshot_idx + 1);
@@ -698,11 +851,15 @@ static void handleLoadSnapshotResponse(redisAsyncContext *c, void *r, void *priv
                     node->id);
         }
     }
+
+    cleanSnapshotDelivery(node);
+    if (stream) {
+        checkSnapshotStream(rr);
+    }
 }
 
-static int snapshotSendData(Node *node)
+static int snapshotSendChunk(Node *node, const char *buf, size_t len)
 {
-    RedisRaftCtx *rr = node->rr;
     time_t now = time(NULL);
 
     /* Load snapshot data */
@@ -710,111 +867,645 @@ static int snapshotSendData(Node *node)
     snprintf(target_node_id, sizeof(target_node_id) - 1, "%d", node->id);
 
     char term[30];
-    snprintf(term, sizeof(term) - 1, "%lu", raft_get_current_term(rr->raft));
+    snprintf(term, sizeof(term) - 1, "%lu", node->load_snapshot_term);
 
     char idx[30];
-    snprintf(idx, sizeof(idx) - 1, "%lu", raft_get_snapshot_last_idx(rr->raft));
+    snprintf(idx, sizeof(idx) - 1, "%lu", node->load_snapshot_idx);
 
-    const char *args[5] = {
+    char offset[30];
+    snprintf(offset, sizeof(offset) - 1, "%lu", node->snapshot_offset);
+
+    char size[30];
+    snprintf(size, sizeof(size) - 1, "%lu", node->snapshot_size);
+
+    const char *args[7] = {
         "RAFT.LOADSNAPSHOT",
         target_node_id,
         term,
         idx,
-        node->snapshot_buf
+        offset,
+        size,
+        buf
     };
-    size_t args_len[5] = {
+    size_t args_len[7] = {
         strlen(args[0]),
         strlen(args[1]),
         strlen(args[2]),
         strlen(args[3]),
-        node->snapshot_size
+        strlen(args[4]),
+        strlen(args[5]),
+        len
     };
 
-    node->load_snapshot_idx = raft_get_snapshot_last_idx(rr->raft);
-    node->load_snapshot_in_progress = true;
     node->load_snapshot_last_time = now;
 
-    if (!NODE_IS_CONNECTED(node)) {
-        node->load_snapshot_in_progress = false;
+    if (!NODE_BULK_IS_CONNECTED(node)) {
         return -1;
     }
 
-    if (redisAsyncCommandArgv(node->rc, handleLoadSnapshotResponse, node, 5, args, args_len) != REDIS_OK) {
-        node->load_snapshot_in_progress = false;
+    if (redisAsyncCommandArgv(node->bulk_rc, handleLoadSnapshotResponse, node, 7, args, args_len) != REDIS_OK) {
         return -1;
     }
 
-    NodeAddPendingResponse(node, false);
+    node->bulk_request_time = RedisModule_Milliseconds();
 
-    NODE_LOG_DEBUG(node, "Sent snapshot: %lu bytes, term %ld, index %ld\n",
-                node->snapshot_size, raft_get_snapshot_last_term(rr->raft),
-                raft_get_snapshot_last_idx(rr->raft));
+    NODE_LOG_DEBUG(node, "Sent snapshot chunk: offset %lu, %lu/%lu bytes, term %ld, index %ld\n",
+                node->snapshot_offset, len, node->snapshot_size,
+                node->load_snapshot_term, node->load_snapshot_idx);
     return 0;
 }
 
+/* ------------------------------------ Snapshot file delivery ------------------------------------ */
+
+/* Nodes that need the snapshot file at the same time share a single
+ * SnapshotSource, which keeps the file open and holds the last chunk read.
+ *
+ * Every node acknowledges a chunk before asking for the next one, and a chunk
+ * that was just read is sent to all nodes waiting for it.  Nodes that proceed
+ * at the same pace, e.g. when several of them need a snapshot once a
+ * partition heals, are therefore served by the same reads and buffer; a node
+ * that falls behind simply has its chunk read again.
+ *
+ * The source is refcounted by its nodes, and closed once delivery to all of
+ * them ends.  A node that needs a snapshot after a newer one was created gets
+ * a new source, as the previous one keeps the old file open.
+ */
+
+static void readSnapshotChunk(SnapshotSource *s, size_t offset);
+
+static void freeSnapshotSource(SnapshotSource *s)
+{
+    if (s->rr->snapshot_source == s) {
+        s->rr->snapshot_source = NULL;
+    }
+
+    if (s->fd >= 0) {
+        uv_fs_t close_req;
+        int ret = uv_fs_close(s->rr->loop, &close_req, s->fd, NULL);
+        assert(ret == 0);
+    }
+
+    if (s->buf) {
+        RedisModule_Free(s->buf);
+    }
+    RedisModule_Free(s);
+}
+
+/* Drops a reference to the source. It is freed once it has no references
+ * and no open or read is pending.
+ */
+static void releaseSnapshotSource(SnapshotSource *s)
+{
+    s->refcount--;
+    if (!s->refcount && !s->opening && !s->reading) {
+        freeSnapshotSource(s);
+    }
+}
+
 static void cleanSnapshotDelivery(Node *node)
 {
-    if (node->snapshot_buf != NULL) {
-        RedisModule_Free(node->snapshot_buf);
-        node->snapshot_buf = NULL;
+    node->load_snapshot_in_progress = false;
+    node->snapshot_chunk_wanted = false;
+
+    if (node->snapshot_stream) {
+        node->snapshot_stream = false;
+        return;
+    }
+
+    if (node->snapshot_source != NULL) {
+        releaseSnapshotSource(node->snapshot_source);
+        node->snapshot_source = NULL;
+    }
+
+    node->snapshot_use_file = false;
+}
+
+/* Sends the chunk in the buffer to all nodes waiting for it, and starts
+ * reading the chunk needed by the next waiting node, if any.
+ */
+static void serveSnapshotSource(SnapshotSource *s)
+{
+    RedisRaftCtx *rr = s->rr;
+    Node *next = NULL;
+
+    if (s->opening || s->reading) {
+        return;
     }
 
-    uv_fs_t close_req;
-    int ret = uv_fs_close(node->rr->loop, &close_req, node->uv_snapshot_file, NULL);
-    assert(ret == 0);
+    /* Nodes may release the source while we iterate */
+    s->refcount++;
+
+    for (int i = 0; i < raft_get_num_nodes(rr->raft); i++) {
+        Node *node = raft_node_get_udata(raft_get_node_from_idx(rr->raft, i));
+        if (!node || node->snapshot_source != s || !node->snapshot_chunk_wanted) {
+            continue;
+        }
+
+        if (s->chunk_valid && node->snapshot_offset == s->chunk_offset) {
+            node->snapshot_chunk_wanted = false;
+            if (snapshotSendChunk(node, s->buf, s->chunk_len) < 0) {
+                NODE_LOG_DEBUG(node, "Failed to deliver snapshot: not connected\n");
+                cleanSnapshotDelivery(node);
+            }
+        } else if (!next) {
+            next = node;
+        }
+    }
+
+    if (next) {
+        readSnapshotChunk(s, next->snapshot_offset);
+    }
+
+    releaseSnapshotSource(s);
+}
+
+/* Ends delivery to all nodes waiting for the source, after it failed. Nodes
+ * waiting for a reply will fail once they ask for their next chunk.
+ */
+static void failSnapshotSource(SnapshotSource *s)
+{
+    RedisRaftCtx *rr = s->rr;
+
+    if (rr->snapshot_source == s) {
+        rr->snapshot_source = NULL;
+    }
+
+    s->refcount++;
+
+    for (int i = 0; i < raft_get_num_nodes(rr->raft); i++) {
+        Node *node = raft_node_get_udata(raft_get_node_from_idx(rr->raft, i));
+        if (node && node->snapshot_source == s && node->snapshot_chunk_wanted) {
+            cleanSnapshotDelivery(node);
+        }
+    }
+
+    releaseSnapshotSource(s);
 }
 
 static void snapshotOnRead(uv_fs_t *req)
 {
-    Node *node = uv_req_get_data((uv_req_t *) req);
-    RedisRaftCtx *rr = node->rr;
+    SnapshotSource *s = uv_req_get_data((uv_req_t *) req);
+    size_t len = s->uv_buf.len;
+    ssize_t result = req->result;
 
     uv_fs_req_cleanup(req);
+    s->reading = false;
 
-    if (req->result == node->snapshot_size && snapshotSendData(node) == 0) {
-        NODE_LOG_DEBUG(node, "Loaded snapshot: %s: %lu bytes\n",
-                rr->config->rdb_filename, node->snapshot_size);
+    if (!s->refcount) {
+        freeSnapshotSource(s);
+        return;
     }
 
-    cleanSnapshotDelivery(node);
+    if (result != len) {
+        LOG_DEBUG("Failed to deliver snapshot: read: %s\n",
+                result < 0 ? uv_strerror(result) : "short read");
+        failSnapshotSource(s);
+        return;
+    }
+
+    s->chunk_valid = true;
+    serveSnapshotSource(s);
+}
+
+/* Reads the chunk of the snapshot file starting at offset into the buffer */
+static void readSnapshotChunk(SnapshotSource *s, size_t offset)
+{
+    size_t len = s->size - offset;
+    if (len > s->buf_size) {
+        len = s->buf_size;
+    }
+
+    s->reading = true;
+    s->chunk_valid = false;
+    s->chunk_offset = offset;
+    s->chunk_len = len;
+    s->rr->snapshot_chunk_reads++;
+
+    s->uv_buf = uv_buf_init(s->buf, len);
+    uv_req_set_data((uv_req_t *) &s->req, s);
+    int ret = uv_fs_read(s->rr->loop, &s->req, s->fd, &s->uv_buf, 1, offset, snapshotOnRead);
+    assert(ret == 0);
 }
 
 static void snapshotOnOpen(uv_fs_t *req)
 {
-    Node *node = uv_req_get_data((uv_req_t *) req);
+    SnapshotSource *s = uv_req_get_data((uv_req_t *) req);
+    RedisRaftCtx *rr = s->rr;
     uv_fs_t stat_req;
 
     uv_fs_req_cleanup(req);
+    s->opening = false;
+
+    if (req->result >= 0) {
+        s->fd = req->result;
+    }
+
+    if (!s->refcount) {
+        freeSnapshotSource(s);
+        return;
+    }
 
     if (req->result < 0) {
-        NODE_LOG_DEBUG(node, "Failed to deliver snapshot: open: %s\n",
-                uv_strerror(req->result));
-        node->load_snapshot_in_progress = false;
+        LOG_DEBUG("Failed to deliver snapshot: open: %s\n", uv_strerror(req->result));
+        failSnapshotSource(s);
+        return;
+    }
+
+    int ret = uv_fs_fstat(req->loop, &stat_req, s->fd, NULL);
+    if (ret < 0) {
+        LOG_DEBUG("Failed to deliver snapshot: open: %s\n", uv_strerror(ret));
+        failSnapshotSource(s);
         return;
     }
 
-    node->uv_snapshot_file = req->result;
-    if (uv_fs_fstat(req->loop, (uv_fs_t *) &stat_req, node->uv_snapshot_file, NULL) < 0) {
-        NODE_LOG_DEBUG(node, "Failed to delivery snapshot: open: %s\n",
-                uv_strerror(req->result));
+    /* The file remains open until delivery completes, so chunks are read from
+     * the same snapshot even if a new one is created in the meantime.
+     */
+    s->size = uv_fs_get_statbuf(&stat_req)->st_size;
+    s->idx = raft_get_snapshot_last_idx(rr->raft);
+    uv_fs_req_cleanup(&stat_req);
+
+    s->buf_size = s->size;
+    if (s->buf_size > rr->config->raft_snapshot_chunk_size) {
+        s->buf_size = rr->config->raft_snapshot_chunk_size;
+    }
+    s->buf = RedisModule_Alloc(s->buf_size ? s->buf_size : 1);
+
+    for (int i = 0; i < raft_get_num_nodes(rr->raft); i++) {
+        Node *node = raft_node_get_udata(raft_get_node_from_idx(rr->raft, i));
+        if (node && node->snapshot_source == s) {
+            node->snapshot_size = s->size;
+            node->load_snapshot_idx = s->idx;
+        }
+    }
+
+    serveSnapshotSource(s);
+}
+
+/* Starts delivering the snapshot file to a node, sharing the current source
+ * if it still serves the latest snapshot.
+ */
+static void snapshotInitiateRead(RedisRaftCtx *rr, Node *node, const char *filename)
+{
+    SnapshotSource *s = rr->snapshot_source;
+
+    if (s && !s->opening && s->idx != raft_get_snapshot_last_idx(rr->raft)) {
+        rr->snapshot_source = NULL;
+        s = NULL;
+    }
+
+    if (!s) {
+        s = RedisModule_Calloc(1, sizeof(SnapshotSource));
+        s->rr = rr;
+        s->fd = -1;
+        s->opening = true;
+        rr->snapshot_source = s;
+        rr->snapshot_file_opens++;
+
+        uv_req_set_data((uv_req_t *) &s->req, s);
+        int ret = uv_fs_open(rr->loop, &s->req, filename, 0, O_RDONLY, snapshotOnOpen);
+        assert(ret == 0);
+    }
+
+    s->refcount++;
+    node->snapshot_source = s;
+    node->snapshot_offset = 0;
+    node->snapshot_chunk_wanted = true;
+    node->load_snapshot_term = raft_get_current_term(rr->raft);
+
+    if (!s->opening) {
+        node->snapshot_size = s->size;
+        node->load_snapshot_idx = s->idx;
+        serveSnapshotSource(s);
+    }
+}
+
+/* Asks for the chunk at the node's snapshot_offset, once it acknowledged the
+ * previous one.
+ */
+static void requestSnapshotChunk(Node *node)
+{
+    node->snapshot_chunk_wanted = true;
+    serveSnapshotSource(node->snapshot_source);
+}
+
+/* ------------------------------------ Diskless snapshot delivery ------------------------------------ */
+
+/* With raft-snapshot-diskless, a fresh snapshot is streamed to followers
+ * rather than read back from the snapshot file.
+ *
+ * A child process is forked to save the dataset and writes the RDB into a
+ * pipe, which the Raft thread reads one chunk at a time.  Every chunk is sent
+ * to all nodes that joined the stream before it started, and the next chunk
+ * is read only once they have all acknowledged it, so the pipe also provides
+ * flow control.  Nodes that need a snapshot after the stream started wait for
+ * the next one.
+ *
+ * rdbSave() can only write a file, so the child saves the RDB in
+ * raft-snapshot-diskless-dir (which should be memory backed) and unlinks it
+ * as soon as it is opened for streaming.  Streaming starts only once the RDB
+ * is complete, and it holds its full size in that directory until the child
+ * exits.  rdbSave() also syncs and renames the file it writes, so it can't
+ * write into the pipe directly.
+ */
+
+static int writeAll(int fd, const char *buf, size_t len)
+{
+    while (len > 0) {
+        ssize_t n = write(fd, buf, len);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        buf += n;
+        len -= n;
+    }
+
+    return 0;
+}
+
+/* Runs in the child: saves the RDB and writes it to fd, following a
+ * SnapshotResult header that reports its size.
+ */
+static void streamSnapshotChild(RedisRaftCtx *rr, int fd)
+{
+    SnapshotResult sr = { 0 };
+    int rdb_fd = -1;
+    struct stat st;
+
+    redis_raft_logfile = NULL;
+
+    sr.magic = SNAPSHOT_RESULT_MAGIC;
+    snprintf(sr.rdb_filename, sizeof(sr.rdb_filename) - 1, "redisraft-stream-%d.rdb",
+            getpid());
+
+    /* rdbSave() creates its temporary file in the working directory */
+    if (chdir(rr->config->raft_snapshot_diskless_dir) < 0) {
+        snprintf(sr.err, sizeof(sr.err) - 1, "chdir(%s) failed: %s",
+                rr->config->raft_snapshot_diskless_dir, strerror(errno));
+        goto exit;
+    }
+
+    if (rdbSave(sr.rdb_filename, NULL) != 0) {
+        snprintf(sr.err, sizeof(sr.err) - 1, "%s", "rdbSave() failed");
+        goto exit;
+    }
+
+    rdb_fd = open(sr.rdb_filename, O_RDONLY);
+    unlink(sr.rdb_filename);
+    if (rdb_fd < 0 || fstat(rdb_fd, &st) < 0) {
+        snprintf(sr.err, sizeof(sr.err) - 1, "Failed to open RDB: %s", strerror(errno));
+        goto exit;
+    }
+
+    sr.rdb_size = st.st_size;
+    sr.success = 1;
+
+exit:
+    if (writeAll(fd, (char *) &sr, sizeof(sr)) == 0 && sr.success) {
+        char buf[64 * 1024];
+        ssize_t n;
+
+        /* The parent closing the pipe ends the stream early */
+        while ((n = read(rdb_fd, buf, sizeof(buf))) > 0 &&
+               writeAll(fd, buf, n) == 0) {
+        }
+    }
+
+    RedisModule_ExitFromChild(0);
+}
+
+/* Returns the next node of the stream, starting at index *i */
+static Node *nextStreamNode(RedisRaftCtx *rr, int *i)
+{
+    while (*i < raft_get_num_nodes(rr->raft)) {
+        raft_node_t *rn = raft_get_node_from_idx(rr->raft, (*i)++);
+        Node *n = raft_node_get_udata(rn);
+        if (n && n->snapshot_stream) {
+            return n;
+        }
+    }
+
+    return NULL;
+}
+
+static void readSnapshotStream(RedisRaftCtx *rr);
+
+static void endSnapshotStream(RedisRaftCtx *rr)
+{
+    SnapshotStream *s = rr->snapshot_stream;
+    Node *node;
+    int i = 0;
+
+    assert(!s->reading);
+
+    while ((node = nextStreamNode(rr, &i)) != NULL) {
         cleanSnapshotDelivery(node);
+    }
+
+    /* Closing the pipe also terminates the child, if still streaming */
+    close(s->fd);
+    if (s->buf) {
+        RedisModule_Free(s->buf);
+    }
+    RedisModule_Free(s);
+    rr->snapshot_stream = NULL;
+}
+
+static void sendSnapshotStreamChunk(RedisRaftCtx *rr)
+{
+    SnapshotStream *s = rr->snapshot_stream;
+    Node *node;
+    int i = 0;
+
+    while ((node = nextStreamNode(rr, &i)) != NULL) {
+        node->snapshot_offset = s->offset;
+        if (snapshotSendChunk(node, s->buf, s->chunk_len) < 0) {
+            NODE_LOG_DEBUG(node, "Failed to deliver snapshot: not connected\n");
+            cleanSnapshotDelivery(node);
+        }
+    }
+
+    checkSnapshotStream(rr);
+}
+
+static void snapshotStreamOnRead(uv_fs_t *req)
+{
+    RedisRaftCtx *rr = uv_req_get_data((uv_req_t *) req);
+    SnapshotStream *s = rr->snapshot_stream;
+    ssize_t result = req->result;
+
+    uv_fs_req_cleanup(req);
+    s->reading = false;
+
+    if (result <= 0) {
+        LOG_ERROR("Snapshot stream failed: read: %s\n",
+                result < 0 ? uv_strerror(result) : "unexpected end of stream");
+        endSnapshotStream(rr);
         return;
     }
 
-    /* prepare buffer and read */
-    node->snapshot_size = uv_fs_get_statbuf(&stat_req)->st_size;
-    node->snapshot_buf = RedisModule_Alloc(node->snapshot_size);
-    node->uv_snapshot_buf = uv_buf_init(node->snapshot_buf, node->snapshot_size);
-    int ret = uv_fs_read(node->rr->loop, &node->uv_snapshot_req, node->uv_snapshot_file,
-            &node->uv_snapshot_buf, 1, 0, snapshotOnRead);
-    assert(ret == 0);
+    s->read_len += result;
+    if (s->read_len < (s->started ? s->chunk_len : sizeof(s->sr))) {
+        readSnapshotStream(rr);
+        return;
+    }
+
+    if (s->started) {
+        sendSnapshotStreamChunk(rr);
+        return;
+    }
+
+    if (s->sr.magic != SNAPSHOT_RESULT_MAGIC || !s->sr.success || !s->sr.rdb_size) {
+        LOG_ERROR("Snapshot stream failed: %s\n",
+                s->sr.magic == SNAPSHOT_RESULT_MAGIC ? s->sr.err : "corrupted header");
+        endSnapshotStream(rr);
+        return;
+    }
+
+    Node *node;
+    int i = 0;
+
+    s->started = true;
+    s->size = s->sr.rdb_size;
+    while ((node = nextStreamNode(rr, &i)) != NULL) {
+        node->snapshot_size = s->size;
+    }
+
+    size_t buf_size = s->size;
+    if (buf_size > rr->config->raft_snapshot_chunk_size) {
+        buf_size = rr->config->raft_snapshot_chunk_size;
+    }
+    s->buf = RedisModule_Alloc(buf_size);
+
+    LOG_VERBOSE("Streaming snapshot to nodes: term %ld, index %ld, %lu bytes\n",
+            s->term, s->idx, s->size);
+
+    checkSnapshotStream(rr);
 }
 
-static int snapshotInitiateRead(RedisRaftCtx *rr, Node *node, const char *filename)
+/* Reads the rest of the header or current chunk from the pipe. The read
+ * blocks a libuv worker thread rather than the Raft thread.
+ */
+static void readSnapshotStream(RedisRaftCtx *rr)
 {
-    uv_req_set_data((uv_req_t *) &node->uv_snapshot_req, node);
-    int ret = uv_fs_open(rr->loop, &node->uv_snapshot_req, filename, 0, O_RDONLY, snapshotOnOpen);
+    SnapshotStream *s = rr->snapshot_stream;
+
+    if (s->started) {
+        s->uv_buf = uv_buf_init(s->buf + s->read_len, s->chunk_len - s->read_len);
+    } else {
+        s->uv_buf = uv_buf_init((char *) &s->sr + s->read_len, sizeof(s->sr) - s->read_len);
+    }
+
+    s->reading = true;
+    uv_req_set_data((uv_req_t *) &s->req, rr);
+    int ret = uv_fs_read(rr->loop, &s->req, s->fd, &s->uv_buf, 1, -1, snapshotStreamOnRead);
     assert(ret == 0);
+}
+
+/* Moves the stream forward once all its nodes acknowledged the current
+ * chunk, and ends it once no nodes are left.
+ */
+static void checkSnapshotStream(RedisRaftCtx *rr)
+{
+    SnapshotStream *s = rr->snapshot_stream;
+    Node *node;
+    int i = 0;
+    int nodes = 0;
+
+    if (!s || !s->started || s->reading) {
+        return;
+    }
+
+    while ((node = nextStreamNode(rr, &i)) != NULL) {
+        if (node->snapshot_offset != s->offset + s->chunk_len) {
+            return;
+        }
+        nodes++;
+    }
+
+    s->offset += s->chunk_len;
+    if (!nodes || s->offset >= s->size) {
+        endSnapshotStream(rr);
+        return;
+    }
+
+    s->chunk_len = s->size - s->offset;
+    if (s->chunk_len > rr->config->raft_snapshot_chunk_size) {
+        s->chunk_len = rr->config->raft_snapshot_chunk_size;
+    }
+    s->read_len = 0;
+
+    readSnapshotStream(rr);
+}
+
+static RRStatus startSnapshotStream(RedisRaftCtx *rr)
+{
+    int fds[2];     /* [0] our side, [1] child's side */
+
+    if (pipe(fds) < 0) {
+        LOG_ERROR("Failed to create snapshot stream pipe: %s\n", strerror(errno));
+        return RR_ERROR;
+    }
+
+    /* The child saves the current configuration with the snapshot */
+    freeSnapshotCfgEntryList(rr->snapshot_info.cfg);
+    rr->snapshot_info.cfg = generateSnapshotCfgEntryList(rr);
+
+    /* Flush stdio files to avoid leaks from child */
+    fflush(redis_raft_logfile);
+    if (rr->log) {
+        RaftLogSync(rr->log);
+    }
+
+    pid_t child = RedisModule_Fork(NULL, NULL);
+    if (child < 0) {
+        LOG_ERROR("Failed to fork snapshot stream child: %s\n", strerror(errno));
+        close(fds[0]);
+        close(fds[1]);
+        return RR_ERROR;
+    } else if (!child) {
+        close(fds[0]);
+        streamSnapshotChild(rr, fds[1]);
+    }
+
+    close(fds[1]);
+
+    SnapshotStream *s = RedisModule_Calloc(1, sizeof(SnapshotStream));
+    s->fd = fds[0];
+    s->term = raft_get_current_term(rr->raft);
+    s->idx = rr->snapshot_info.last_applied_idx;
+    rr->snapshot_stream = s;
+    rr->snapshots_streamed++;
+
+    LOG_DEBUG("Started snapshot stream child, index %ld\n", s->idx);
+
+    readSnapshotStream(rr);
+    return RR_OK;
+}
+
+/* Adds a node to the current snapshot stream, starting one if necessary. */
+static int joinSnapshotStream(RedisRaftCtx *rr, Node *node)
+{
+    if (!rr->snapshot_stream && startSnapshotStream(rr) != RR_OK) {
+        return -1;
+    }
+
+    SnapshotStream *s = rr->snapshot_stream;
+    if (s->started) {
+        NODE_LOG_DEBUG(node, "not sending snapshot, waiting for next snapshot stream\n");
+        return -1;
+    }
+
+    node->load_snapshot_in_progress = true;
+    node->snapshot_stream = true;
+    node->load_snapshot_idx = s->idx;
+    node->load_snapshot_term = s->term;
+    node->load_snapshot_last_time = time(NULL);
+    node->snapshot_size = 0;
+    node->snapshot_offset = 0;
 
     return 0;
 }
@@ -849,11 +1540,22 @@ int raftSendSnapshot(raft_server_t *raft, void *user_data, raft_node_t *raft_nod
         return -1;
     }
 
-    /* Initiate loading of snapshot.  We use libuv to handle loading in the background
-     * and avoid blocking the Raft thread.
-     *
-     * TODO: Refactor hiredis so we can actually stream this directly to the socket
-     * instead of buffering the entire file in memory.
+    /* Snapshots are sent over the bulk connection, see NodeBulkConnect(). If
+     * it's not established yet, delivery starts on a later attempt.
+     */
+    if (!NODE_BULK_IS_CONNECTED(node)) {
+        NODE_LOG_DEBUG(node, "not sending snapshot, bulk connection state=%s\n",
+                NodeStateStr[node->bulk_state]);
+        NodeBulkConnect(node);
+        return -1;
+    }
+
+    if (rr->config->raft_snapshot_diskless && !node->snapshot_use_file) {
+        return joinSnapshotStream(rr, node);
+    }
+
+    /* Initiate delivery of snapshot.  We use libuv to read it from disk in the
+     * background, one chunk at a time, and avoid blocking the Raft thread.
      */
     node->load_snapshot_in_progress = true;
     snapshotInitiateRead(rr, node, rr->config->rdb_filename);
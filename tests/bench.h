@@ -0,0 +1,26 @@
+/*
+ * This file is part of RedisRaft.
+ *
+ * Copyright (c) 2020 Redis Labs
+ *
+ * RedisRaft is dual licensed under the GNU Affero General Public License version 3
+ * (AGPLv3) or the Redis Source Available License (RSAL).
+ */
+
+#ifndef REDISRAFT_BENCH_H
+#define REDISRAFT_BENCH_H
+
+/* A benchmark runs its operation the requested number of times, and reports
+ * one or more results using benchReport().  arg is passed as is, to allow
+ * the same function to run different workloads.
+ */
+typedef struct Benchmark {
+    const char *name;
+    void (*func)(const char *name, long iterations, const void *arg);
+    const void *arg;
+} Benchmark;
+
+double benchNow(void);
+void benchReport(const char *name, long iterations, double elapsed, size_t bytes);
+
+#endif /* REDISRAFT_BENCH_H */
@@ -0,0 +1,324 @@
+/*
+ * This file is part of RedisRaft.
+ *
+ * Copyright (c) 2020 Redis Labs
+ *
+ * RedisRaft is dual licensed under the GNU Affero General Public License version 3
+ * (AGPLv3) or the Redis Source Available License (RSAL).
+ */
+
+/* Benchmarks of the Raft log and the entry cache.
+ *
+ * Log reads are benchmarked both directly (RaftLogGet) and through the log
+ * implementation used by the Raft library (get_batch), which fetches entries
+ * from the cache when possible and from the log file otherwise.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../redisraft.h"
+#include "bench.h"
+
+#define LOGNAME "bench.log.db"
+#define DBID "01234567890123456789012345678901"
+
+#define ENTRY_SIZE      128
+#define BATCH_SIZE      32
+#define CACHE_INIT_SIZE 512
+
+/* Appends that fsync are orders of magnitude slower */
+#define FSYNC_ITERATIONS(n)     ((n) / 100 > 10 ? (n) / 100 : 10)
+
+static RedisRaftConfig config = {
+    .id = 1,
+    .raft_log_segment_size = REDIS_RAFT_DEFAULT_LOG_SEGMENT_SIZE,
+    .raft_log_load_threads = REDIS_RAFT_DEFAULT_LOG_LOAD_THREADS,
+};
+
+static RedisRaftCtx bench_rr;
+
+static raft_entry_t *makeEntry(int id)
+{
+    raft_entry_t *e = raft_entry_new(ENTRY_SIZE);
+    e->id = id;
+    e->term = 1;
+    memset(e->data, 'x', ENTRY_SIZE);
+    return e;
+}
+
+static RaftLog *createLog(bool fsync)
+{
+    config.raft_log_fsync = fsync;
+
+    RaftLog *log = RaftLogCreate(LOGNAME, DBID, 1, 0, 1, -1, &config);
+    if (!log) {
+        fprintf(stderr, "Failed to create log\n");
+        exit(1);
+    }
+    return log;
+}
+
+static void removeLog(RaftLog *log)
+{
+    RaftLogClose(log);
+    RaftLogRemoveFiles(LOGNAME);
+}
+
+/* Returns a log holding n entries */
+static RaftLog *populateLog(long n)
+{
+    RaftLog *log = createLog(false);
+
+    RaftLogBeginBatch(log);
+    for (long i = 0; i < n; i++) {
+        raft_entry_t *e = makeEntry(i);
+        if (RaftLogAppend(log, e) != RR_OK) {
+            fprintf(stderr, "Failed to append entry\n");
+            exit(1);
+        }
+        raft_entry_release(e);
+    }
+    RaftLogEndBatch(log);
+
+    return log;
+}
+
+/* Returns n indexes in [1, max], either sequential (wrapping around) or
+ * random.  A fixed seed is used so runs are comparable.
+ */
+static raft_index_t *makeIndexes(long n, long max, bool random)
+{
+    raft_index_t *idx = malloc(sizeof(raft_index_t) * n);
+    unsigned int seed = 1;
+
+    for (long i = 0; i < n; i++) {
+        idx[i] = 1 + (random ? rand_r(&seed) % max : i % max);
+    }
+    return idx;
+}
+
+static void benchLogAppendRun(const char *name, long iterations, bool fsync)
+{
+    RaftLog *log = createLog(fsync);
+    raft_entry_t *e = makeEntry(0);
+
+    double start = benchNow();
+    for (long i = 0; i < iterations; i++) {
+        if (RaftLogAppend(log, e) != RR_OK) {
+            fprintf(stderr, "Failed to append entry\n");
+            exit(1);
+        }
+    }
+    benchReport(name, iterations, benchNow() - start, ENTRY_SIZE);
+
+    raft_entry_release(e);
+    removeLog(log);
+}
+
+static void benchLogAppend(const char *name, long iterations, const void *arg)
+{
+    benchLogAppendRun(name, iterations, false);
+}
+
+static void benchLogAppendFsync(const char *name, long iterations, const void *arg)
+{
+    benchLogAppendRun(name, FSYNC_ITERATIONS(iterations), true);
+}
+
+static void benchLogGetRun(const char *name, long iterations, bool random)
+{
+    RaftLog *log = populateLog(iterations);
+    raft_index_t *idx = makeIndexes(iterations, iterations, random);
+
+    double start = benchNow();
+    for (long i = 0; i < iterations; i++) {
+        raft_entry_t *e = RaftLogGet(log, idx[i]);
+        if (!e) {
+            fprintf(stderr, "Failed to read entry %ld\n", idx[i]);
+            exit(1);
+        }
+        raft_entry_release(e);
+    }
+    benchReport(name, iterations, benchNow() - start, ENTRY_SIZE);
+
+    free(idx);
+    removeLog(log);
+}
+
+static void benchLogGetSequential(const char *name, long iterations, const void *arg)
+{
+    benchLogGetRun(name, iterations, false);
+}
+
+static void benchLogGetRandom(const char *name, long iterations, const void *arg)
+{
+    benchLogGetRun(name, iterations, true);
+}
+
+/* Fetches batches through the log implementation.  If cached is set, all
+ * entries are also in the entry cache; otherwise they are all read from the
+ * log file.
+ */
+static void benchLogGetBatchRun(const char *name, long iterations, bool random, bool cached)
+{
+    long entries = iterations > BATCH_SIZE ? iterations : BATCH_SIZE;
+    raft_entry_t *batch[BATCH_SIZE];
+
+    bench_rr.config = &config;
+    bench_rr.log = populateLog(entries);
+    bench_rr.logcache = EntryCacheNew(CACHE_INIT_SIZE);
+
+    if (cached) {
+        for (long i = 1; i <= entries; i++) {
+            raft_entry_t *e = RaftLogGet(bench_rr.log, i);
+            EntryCacheAppend(bench_rr.logcache, e, i);
+            raft_entry_release(e);
+        }
+    }
+
+    /* Batches start at an index from which a full batch can be read */
+    raft_index_t *idx = makeIndexes(iterations, entries - BATCH_SIZE + 1, random);
+
+    double start = benchNow();
+    for (long i = 0; i < iterations; i++) {
+        int n = RaftLogImpl.get_batch(&bench_rr, idx[i], BATCH_SIZE, batch);
+        if (n != BATCH_SIZE) {
+            fprintf(stderr, "Failed to read batch at %ld\n", idx[i]);
+            exit(1);
+        }
+        raft_entry_release_list(batch, n);
+    }
+    benchReport(name, iterations, benchNow() - start, BATCH_SIZE * ENTRY_SIZE);
+
+    free(idx);
+    EntryCacheFree(bench_rr.logcache);
+    removeLog(bench_rr.log);
+    memset(&bench_rr, 0, sizeof(bench_rr));
+}
+
+static void benchLogGetBatchSequential(const char *name, long iterations, const void *arg)
+{
+    benchLogGetBatchRun(name, iterations, false, false);
+}
+
+static void benchLogGetBatchRandom(const char *name, long iterations, const void *arg)
+{
+    benchLogGetBatchRun(name, iterations, true, false);
+}
+
+static void benchLogGetBatchCached(const char *name, long iterations, const void *arg)
+{
+    benchLogGetBatchRun(name, iterations, true, true);
+}
+
+static raft_entry_t **makeEntries(long n)
+{
+    raft_entry_t **entries = malloc(sizeof(raft_entry_t *) * n);
+
+    for (long i = 0; i < n; i++) {
+        entries[i] = makeEntry(i);
+    }
+    return entries;
+}
+
+/* Returns a cache holding entries as indexes 1..n */
+static EntryCache *populateCache(raft_entry_t **entries, long n)
+{
+    EntryCache *cache = EntryCacheNew(CACHE_INIT_SIZE);
+
+    for (long i = 0; i < n; i++) {
+        EntryCacheAppend(cache, entries[i], i + 1);
+    }
+    return cache;
+}
+
+static void releaseEntries(raft_entry_t **entries, long n)
+{
+    raft_entry_release_list(entries, n);
+    free(entries);
+}
+
+static void benchCacheAppend(const char *name, long iterations, const void *arg)
+{
+    raft_entry_t **entries = makeEntries(iterations);
+    EntryCache *cache = EntryCacheNew(CACHE_INIT_SIZE);
+
+    double start = benchNow();
+    for (long i = 0; i < iterations; i++) {
+        EntryCacheAppend(cache, entries[i], i + 1);
+    }
+    benchReport(name, iterations, benchNow() - start, ENTRY_SIZE);
+
+    EntryCacheFree(cache);
+    releaseEntries(entries, iterations);
+}
+
+static void benchCacheGetRun(const char *name, long iterations, bool random)
+{
+    raft_entry_t **entries = makeEntries(iterations);
+    EntryCache *cache = populateCache(entries, iterations);
+    raft_index_t *idx = makeIndexes(iterations, iterations, random);
+
+    double start = benchNow();
+    for (long i = 0; i < iterations; i++) {
+        raft_entry_t *e = EntryCacheGet(cache, idx[i]);
+        raft_entry_release(e);
+    }
+    benchReport(name, iterations, benchNow() - start, ENTRY_SIZE);
+
+    free(idx);
+    EntryCacheFree(cache);
+    releaseEntries(entries, iterations);
+}
+
+static void benchCacheGetSequential(const char *name, long iterations, const void *arg)
+{
+    benchCacheGetRun(name, iterations, false);
+}
+
+static void benchCacheGetRandom(const char *name, long iterations, const void *arg)
+{
+    benchCacheGetRun(name, iterations, true);
+}
+
+/* Evicts a single entry from the head on every call, which is what happens
+ * when appends keep the cache at its memory limit.
+ */
+static void benchCacheCompact(const char *name, long iterations, const void *arg)
+{
+    raft_entry_t **entries = makeEntries(iterations);
+    EntryCache *cache = populateCache(entries, iterations);
+
+    size_t entry_memsize = sizeof(raft_entry_t) + ENTRY_SIZE;
+    size_t memsize = cache->entries_memsize;
+
+    double start = benchNow();
+    for (long i = 0; i < iterations; i++) {
+        memsize -= entry_memsize;
+        if (EntryCacheCompact(cache, memsize, 1) != 1) {
+            fprintf(stderr, "Failed to compact cache\n");
+            exit(1);
+        }
+    }
+    benchReport(name, iterations, benchNow() - start, ENTRY_SIZE);
+
+    EntryCacheFree(cache);
+    releaseEntries(entries, iterations);
+}
+
+Benchmark log_benchmarks[] = {
+    { "log/append/nofsync",             benchLogAppend },
+    { "log/append/fsync",               benchLogAppendFsync },
+    { "log/get/sequential",             benchLogGetSequential },
+    { "log/get/random",                 benchLogGetRandom },
+    { "log/get_batch/sequential",       benchLogGetBatchSequential },
+    { "log/get_batch/random",           benchLogGetBatchRandom },
+    { "log/get_batch/cached",           benchLogGetBatchCached },
+    { "cache/append",                   benchCacheAppend },
+    { "cache/get/sequential",           benchCacheGetSequential },
+    { "cache/get/random",               benchCacheGetRandom },
+    { "cache/compact",                  benchCacheCompact },
+    { NULL }
+};
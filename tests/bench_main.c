@@ -0,0 +1,96 @@
+/*
+ * This file is part of RedisRaft.
+ *
+ * Copyright (c) 2020 Redis Labs
+ *
+ * RedisRaft is dual licensed under the GNU Affero General Public License version 3
+ * (AGPLv3) or the Redis Source Available License (RSAL).
+ */
+
+/* Microbenchmarks of the log, entry cache and serialization hot paths.
+ *
+ * Every result is printed as a single line JSON object, so results can be
+ * collected and compared across releases:
+ *
+ *   {"name":"log/append/nofsync","iterations":100000,"ns_per_op":812.4,"mb_per_s":78.8}
+ *
+ * Usage: bench_main [-i iterations] [filter]
+ *
+ * Only benchmarks whose name contains filter are run.  Slow benchmarks (e.g.
+ * ones that fsync) scale the number of iterations down.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../redisraft.h"
+#include "bench.h"
+
+extern Benchmark log_benchmarks[];
+extern Benchmark serialization_benchmarks[];
+
+/* Redis symbols to keep linker happy */
+void *rdbLoad;
+void *rdbSave;
+
+double benchNow(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void benchReport(const char *name, long iterations, double elapsed, size_t bytes)
+{
+    printf("{\"name\":\"%s\",\"iterations\":%ld,\"ns_per_op\":%.1f,\"mb_per_s\":%.1f}\n",
+           name, iterations, elapsed * 1e9 / iterations,
+           bytes * iterations / elapsed / 1e6);
+    fflush(stdout);
+}
+
+static void runBenchmarks(Benchmark *benchmarks, const char *filter, long iterations)
+{
+    for (Benchmark *b = benchmarks; b->name; b++) {
+        if (filter && !strstr(b->name, filter)) {
+            continue;
+        }
+        b->func(b->name, iterations, b->arg);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    long iterations = 100000;
+    const char *filter = NULL;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "i:")) != -1) {
+        switch (opt) {
+            case 'i':
+                iterations = atol(optarg);
+                break;
+            default:
+                iterations = 0;
+                break;
+        }
+    }
+    if (optind < argc) {
+        filter = argv[optind];
+    }
+
+    if (iterations <= 0 || optind + 1 < argc) {
+        fprintf(stderr, "Usage: %s [-i iterations] [filter]\n", argv[0]);
+        return 1;
+    }
+
+    redis_raft_logfile = stderr;
+    redis_raft_loglevel = LOGLEVEL_ERROR;
+
+    runBenchmarks(log_benchmarks, filter, iterations);
+    runBenchmarks(serialization_benchmarks, filter, iterations);
+
+    return 0;
+}
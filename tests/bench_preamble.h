@@ -0,0 +1,41 @@
+/*
+ * This file is part of RedisRaft.
+ *
+ * Copyright (c) 2020 Redis Labs
+ *
+ * RedisRaft is dual licensed under the GNU Affero General Public License version 3
+ * (AGPLv3) or the Redis Source Available License (RSAL).
+ */
+
+/* Like dut_premble.h, but maps allocations directly to libc so benchmarks
+ * don't measure cmocka's allocation tracking.
+ */
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define RedisModule_Alloc(size)             malloc(size)
+#define RedisModule_Calloc(nmemb, size)     calloc(nmemb, size)
+#define RedisModule_Realloc(ptr, size)      realloc(ptr, size)
+#define RedisModule_Free(ptr)               free(ptr)
+
+struct RedisModuleString;
+
+static inline const char *bench_StringPtrLen(const struct RedisModuleString *s, size_t *len)
+{
+    *len = strlen((char *)s);
+    return (const char *) s;
+}
+
+static inline struct RedisModuleString *bench_CreateString(const char *s, size_t len)
+{
+    char *buf = malloc(len + 1);
+    memcpy(buf, s, len);
+    buf[len] = '\0';
+    return (struct RedisModuleString *) buf;
+}
+
+#define RedisModule_StringPtrLen(__s, __len)            bench_StringPtrLen(__s, __len)
+#define RedisModule_CreateString(__ctx, __s, __len)     bench_CreateString(__s, __len)
+#define RedisModule_FreeString(__ctx, __s)              free(__s)
@@ -0,0 +1,123 @@
+/*
+ * This file is part of RedisRaft.
+ *
+ * Copyright (c) 2020 Redis Labs
+ *
+ * RedisRaft is dual licensed under the GNU Affero General Public License version 3
+ * (AGPLv3) or the Redis Source Available License (RSAL).
+ */
+
+/* Benchmarks of Raft entry serialization.
+ *
+ * Measures serializing command arrays into entries and deserializing them
+ * back into commands, over a few typical command shapes and payload sizes.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../redisraft.h"
+#include "bench.h"
+
+typedef struct Workload {
+    int argc;               /* Arguments per command */
+    size_t value_len;       /* Length of every value argument */
+    int commands;           /* Commands per entry (MULTI/EXEC) */
+} Workload;
+
+static const Workload set_16 = { 3, 16, 1 };
+static const Workload set_256 = { 3, 256, 1 };
+static const Workload set_4k = { 3, 4096, 1 };
+static const Workload set_64k = { 3, 65536, 1 };
+static const Workload mset_100 = { 201, 32, 1 };
+static const Workload multi_10 = { 3, 64, 10 };
+
+static void setupWorkload(RaftRedisCommandArray *array, const Workload *w)
+{
+    char *value = malloc(w->value_len + 1);
+    memset(value, 'v', w->value_len);
+    value[w->value_len] = '\0';
+
+    for (int i = 0; i < w->commands; i++) {
+        RaftRedisCommand *cmd = RaftRedisCommandArrayExtend(array);
+
+        cmd->argc = w->argc;
+        cmd->argv = malloc(sizeof(RedisModuleString *) * w->argc);
+        for (int j = 0; j < w->argc; j++) {
+            char buf[32];
+            const char *s = buf;
+
+            if (!j) {
+                s = w->argc > 3 ? "MSET" : "SET";
+            } else if (j % 2) {
+                snprintf(buf, sizeof(buf), "key:%d:%d", i, j);
+            } else {
+                s = value;
+            }
+            cmd->argv[j] = (RedisModuleString *) strdup(s);
+        }
+    }
+
+    free(value);
+}
+
+static void report(const char *name, const char *op, double elapsed,
+                   long iterations, size_t bytes)
+{
+    char buf[128];
+
+    snprintf(buf, sizeof(buf), "%s/%s", name, op);
+    benchReport(buf, iterations, elapsed, bytes);
+}
+
+static void benchWorkload(const char *name, long iterations, const void *arg)
+{
+    const Workload *w = arg;
+    RaftRedisCommandArray array = { 0 };
+
+    /* Keep large payloads from dominating the run time */
+    iterations /= 1 + w->value_len / 4096;
+    if (!iterations) {
+        iterations = 1;
+    }
+
+    setupWorkload(&array, w);
+
+    raft_entry_t *ety = RaftRedisCommandArraySerialize(&array);
+    size_t bytes = ety->data_len;
+    raft_entry_release(ety);
+
+    double start = benchNow();
+    for (long i = 0; i < iterations; i++) {
+        ety = RaftRedisCommandArraySerialize(&array);
+        raft_entry_release(ety);
+    }
+    report(name, "serialize", benchNow() - start, iterations, bytes);
+
+    ety = RaftRedisCommandArraySerialize(&array);
+
+    start = benchNow();
+    for (long i = 0; i < iterations; i++) {
+        RaftRedisCommandArray target = { 0 };
+        if (RaftRedisCommandArrayDeserialize(&target, ety->data, ety->data_len) != RR_OK) {
+            fprintf(stderr, "Failed to deserialize entry\n");
+            exit(1);
+        }
+        RaftRedisCommandArrayFree(&target);
+    }
+    report(name, "deserialize", benchNow() - start, iterations, bytes);
+
+    raft_entry_release(ety);
+    RaftRedisCommandArrayFree(&array);
+}
+
+Benchmark serialization_benchmarks[] = {
+    { "serialization/set-16",           benchWorkload,  &set_16 },
+    { "serialization/set-256",          benchWorkload,  &set_256 },
+    { "serialization/set-4k",           benchWorkload,  &set_4k },
+    { "serialization/set-64k",          benchWorkload,  &set_64k },
+    { "serialization/mset-100",         benchWorkload,  &mset_100 },
+    { "serialization/multi-10",         benchWorkload,  &multi_10 },
+    { NULL }
+};
@@ -18,6 +18,7 @@ class RawEntry(object):
     # Log entries
     RAFTLOG = 'RAFTLOG'
     ENTRY = 'ENTRY'
+    SEGMENT = 'SEGMENT'
 
     def __init__(self, args):
         self.args = args.copy()
@@ -51,6 +52,8 @@ class RawEntry(object):
             return LogEntry(args)
         if str(args[0], encoding='ascii') == cls.RAFTLOG:
             return LogHeader(args)
+        if str(args[0], encoding='ascii') == cls.SEGMENT:
+            return LogSegment(args)
         return RawEntry(args)
 
     def __str__(self):
@@ -100,7 +103,18 @@ class LogHeader(RawEntry):
             self.last_term(), self.last_vote(),
             self.snapshot_term(), self.snapshot_index())
 
+class LogSegment(RawEntry):
+    def first_index(self):
+        return int(self.args[1])
+
+    def __repr__(self):
+        return '<LogSegment:first_index=%s>' % self.first_index()
+
+
 class LogEntry(RawEntry):
+    # Version 2 binary entry header: term, id, type, data length, crc
+    BINARY_HEADER = struct.Struct('=QiiII')
+
     class LogType(Enum):
         NORMAL = 0
         ADD_NONVOTING_NODE = 1
@@ -108,6 +122,18 @@ class LogEntry(RawEntry):
         DEMOTE_NODE = 3
         REMOVE_NODE = 4
         NO_OP = 5
+        COMPRESSED = 101
+
+    @classmethod
+    def from_binary_file(cls, _file):
+        hdr = _file.read(cls.BINARY_HEADER.size)
+        if len(hdr) < cls.BINARY_HEADER.size:
+            raise EOFError('End of file reading entry header')
+        term, _id, _type, data_len, _ = cls.BINARY_HEADER.unpack(hdr)
+        data = _file.read(data_len)
+        if len(data) < data_len:
+            raise EOFError('End of file reading entry data')
+        return cls([cls.ENTRY.encode(), term, _id, _type, data])
 
     def term(self):
         return int(self.args[1])
@@ -131,6 +157,36 @@ class LogEntry(RawEntry):
         return '<CfgChange:node_id=%s,port=%s,addr=%s>' % (
             node_id, port, addr.decode('ascii').split('\0', 1)[0])
 
+    @staticmethod
+    def lzf_decompress(data):
+        out = bytearray()
+        i = 0
+        while i < len(data):
+            ctrl = data[i]
+            i += 1
+            if ctrl < 32:
+                out += data[i:i + ctrl + 1]
+                i += ctrl + 1
+                continue
+            length = ctrl >> 5
+            if length == 7:
+                length += data[i]
+                i += 1
+            ref = len(out) - ((ctrl & 0x1f) << 8) - data[i] - 1
+            i += 1
+            for _ in range(length + 2):
+                out.append(out[ref])
+                ref += 1
+        return bytes(out)
+
+    @classmethod
+    def decompress(cls, value):
+        # Compressed payload: $<uncompressed length>\n<LZF data>
+        hdr, data = value.split(b'\n', 1)
+        value = cls.lzf_decompress(data)
+        assert len(value) == int(hdr[1:])
+        return value
+
     @staticmethod
     def parse_cmdlist(data):
         cmds = []
@@ -148,6 +204,8 @@ class LogEntry(RawEntry):
         if self.type_is_cfgchange():
             return self.parse_cfgchange(value)
         else:
+            if self.type() == self.LogType.COMPRESSED:
+                value = self.decompress(value)
             if decode:
                 if not value:
                     return ''
@@ -165,18 +223,57 @@ class LogEntry(RawEntry):
             self.term(), self.id(), self.type().name, self.data(decode=True))
 
 class RaftLog(object):
+    # Log version that stores entries in segment files
+    SEGMENTS_VERSION = 3
+
     def __init__(self, filename):
+        self.filename = filename
         self.logfile = open(filename, 'rb')
         self.entries = []
+        self.segments = []
 
     def reset(self):
         self.entries = []
+        self.segments = []
         self.logfile.seek(0, os.SEEK_SET)
 
+    def segment_filename(self, first_index):
+        return '{}.{:020d}'.format(self.filename, first_index)
+
+    def read_segments(self, header):
+        while True:
+            try:
+                self.segments.append(RawEntry.from_file(self.logfile))
+            except EOFError:
+                break
+
+        # Segments may still hold entries included in the snapshot
+        for segment in self.segments:
+            idx = segment.first_index()
+            with open(self.segment_filename(idx), 'rb') as segfile:
+                while True:
+                    try:
+                        entry = LogEntry.from_binary_file(segfile)
+                    except EOFError:
+                        break
+                    if idx > header.snapshot_index():
+                        self.entries.append(entry)
+                    idx += 1
+
     def read(self):
+        header = RawEntry.from_file(self.logfile)
+        self.entries.append(header)
+        if header.version() >= self.SEGMENTS_VERSION:
+            self.read_segments(header)
+            self.dump()
+            return
+        if header.version() >= 2:
+            read_entry = LogEntry.from_binary_file
+        else:
+            read_entry = RawEntry.from_file
         while True:
             try:
-                entry = RawEntry.from_file(self.logfile)
+                entry = read_entry(self.logfile)
             except EOFError:
                 break
             self.entries.append(entry)
@@ -11,6 +11,7 @@ import sys
 import time
 import os
 import os.path
+import glob
 import subprocess
 import threading
 import random
@@ -267,6 +268,7 @@ class RedisRaft(object):
 
     def cleanup(self):
         files = [self.raftlog, self.raftlogidx, self.dbfilename]
+        files += glob.glob('{}.*'.format(self.raftlog))
         if os.environ.get('SANDBOX_KEEPFILES'):
             savedir = 'keepfiles_{}'.format(uuid.uuid4().hex)
             os.mkdir(savedir)
@@ -407,6 +409,24 @@ class RedisRaft(object):
 
         self._wait_for_condition(check_param, raise_not_matched, timeout)
 
+    def send_snapshot(self, *node_ids, timeout=10):
+        """Starts snapshot delivery to all nodes at once, retrying until
+        their bulk connections are established."""
+        def try_send():
+            try:
+                return self.client.execute_command(
+                    'RAFT.DEBUG', 'SENDSNAPSHOT', *node_ids) == b'OK'
+            except redis.ResponseError as err:
+                if 'bulk connection' not in str(err):
+                    raise
+                return False
+
+        def raise_not_sent():
+            raise RedisRaftTimeout('Snapshot delivery to %s not started' %
+                                   str(node_ids))
+
+        self._wait_for_condition(try_send, raise_not_sent, timeout)
+
     def destroy(self):
         self.terminate()
         self.cleanup()
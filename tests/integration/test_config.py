@@ -40,6 +40,30 @@ def test_config_sanity(cluster):
     assert r1.raft_config_get('loglevel') == {'loglevel': 'debug'}
 
 
+def test_config_async_logging(cluster):
+    """
+    Async logging can be enabled and disabled at runtime.
+    """
+
+    r1 = cluster.add_node()
+    assert r1.raft_info()['async_logging'] == 'no'
+
+    r1.raft_config_set('async-logging', 'yes')
+    assert r1.raft_config_get('async-logging') == {'async-logging': 'yes'}
+    assert r1.raft_info()['async_logging'] == 'yes'
+
+    r1.raft_config_set('loglevel', 'debug')
+    for i in range(100):
+        r1.raft_exec('INCR', 'counter')
+
+    # Sequential commands log far less than the buffer holds between drains
+    assert r1.raft_info()['log_messages_dropped'] == 0
+
+    r1.raft_config_set('async-logging', 'no')
+    assert r1.raft_info()['async_logging'] == 'no'
+    assert r1.raft_exec('GET', 'counter') == b'100'
+
+
 def test_config_startup_only_params(cluster):
     """
     Configuration startup-only params.
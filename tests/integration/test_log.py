@@ -10,7 +10,7 @@ RedisRaft is dual licensed under the GNU Affero General Public License version 3
 import time
 from re import match
 from redis import ResponseError
-from raftlog import RaftLog
+from raftlog import RaftLog, LogEntry
 from fixtures import cluster
 
 
@@ -61,6 +61,81 @@ def test_log_rollback(cluster):
     assert match(r'.*INCRBY.*333', str(log.entries[-1].data()))
 
 
+def test_ae_pipeline_convergence(cluster):
+    """
+    Logs converge with pipelined AppendEntries after a follower rejects
+    entries, reconnects and a new leader is elected.
+    """
+
+    def send_incrs(node, count):
+        conns = [node.client.connection_pool.make_connection()
+                 for _ in range(count)]
+        for conn in conns:
+            conn.send_command('RAFT', 'INCR', 'counter')
+        return conns
+
+    def read_replies(conns):
+        replies = [conn.read_response() for conn in conns]
+        for conn in conns:
+            conn.disconnect()
+        return replies
+
+    def log_entries(node):
+        log = RaftLog(node.raftlog)
+        log.read()
+        return [(e.term(), e.id(), e.type(), e.data())
+                for e in log.entries if isinstance(e, LogEntry)]
+
+    cluster.create(3, raft_args={'raft-ae-pipeline-depth': '8'})
+    assert cluster.leader == 1
+    assert sorted(read_replies(send_incrs(cluster.node(1), 20))) == \
+        list(range(1, 21))
+
+    # Reconnect: node 3 stops responding until the leader drops the
+    # connection, while entries keep being pipelined to node 2.
+    cluster.node(3).pause()
+    conns = send_incrs(cluster.node(1), 20)
+    time.sleep(2)
+    cluster.node(3).resume()
+    assert sorted(read_replies(conns)) == list(range(21, 41))
+    cluster.wait_for_unanimity()
+
+    # Rejection: node 1 appends entries that are never committed, and the
+    # new leader's entries conflict with them.
+    cluster.node(2).terminate()
+    cluster.node(3).terminate()
+    uncommitted = send_incrs(cluster.node(1), 10)
+    cluster.node(1).wait_for_current_index(
+        cluster.node(1).commit_index() + 10)
+    cluster.node(1).terminate()
+    for conn in uncommitted:
+        conn.disconnect()
+
+    # Leader change
+    cluster.node(2).start()
+    cluster.node(3).start()
+    cluster.node(2).wait_for_election()
+    cluster.leader = cluster.node(2).raft_info()['leader_id']
+    assert cluster.leader in (2, 3)
+    assert sorted(read_replies(send_incrs(cluster.leader_node(), 20))) == \
+        list(range(41, 61))
+
+    # Node 1 rejects the new leader's entries until its log is truncated
+    cluster.node(1).start()
+    assert sorted(read_replies(send_incrs(cluster.leader_node(), 20))) == \
+        list(range(61, 81))
+    cluster.wait_for_unanimity()
+    cluster.wait_for_replication()
+
+    for node_id in (1, 2, 3):
+        assert cluster.node(node_id).client.get('counter') == b'80'
+
+    logs = [log_entries(cluster.node(node_id)) for node_id in (1, 2, 3)]
+    tail = min(len(log) for log in logs)
+    assert logs[0][-tail:] == logs[1][-tail:] == logs[2][-tail:]
+    assert match(r'.*INCR.*counter', str(logs[0][-1][3]))
+
+
 def test_raft_log_max_file_size(cluster):
     """
     Raft log size configuration affects compaction.
@@ -75,6 +150,96 @@ def test_raft_log_max_file_size(cluster):
     assert r1.raft_info()['log_entries'] < 10
 
 
+def test_raft_log_segments(cluster):
+    """
+    Raft log is written to segments, and compaction removes old segments.
+    """
+
+    r1 = cluster.add_node(raft_args={'raft-log-segment-size': '1kb'})
+    for _ in range(10):
+        assert r1.raft_exec('SET', 'testkey', 'x'*500)
+    assert r1.raft_info()['log_segments'] > 1
+
+    log = RaftLog(r1.raftlog)
+    log.read()
+    assert log.entry_count() == 11
+
+    assert r1.client.execute_command('RAFT.DEBUG', 'COMPACT') == b'OK'
+    assert r1.raft_info()['log_entries'] == 0
+    assert r1.raft_info()['log_segments'] == 1
+
+    # Log is loaded from the remaining segment
+    assert r1.raft_exec('SET', 'testkey', 'y')
+    r1.restart()
+    r1.wait_for_info_param('state', 'up')
+    assert r1.raft_info()['log_entries'] >= 1
+    assert r1.client.get('testkey') == b'y'
+
+
+def test_entry_compression(cluster):
+    """
+    Large entries are compressed, replicated and reapplied from the log.
+    """
+
+    cluster.create(3)
+    cluster.node(1).raft_config_set('raft-entry-compress-threshold', '1kb')
+
+    value = '{"name":"value","tags":["a","b"]}' * 100
+    assert cluster.raft_exec('SET', 'key', value)
+    assert cluster.raft_exec('SET', 'small', 'value')
+    cluster.wait_for_unanimity()
+
+    info = cluster.node(1).raft_info()
+    assert info['compressed_entries'] == 1
+    assert info['compression_saved_bytes'] > len(value) / 2
+    assert cluster.node(2).client.get('key') == value.encode()
+
+    log = RaftLog(cluster.node(2).raftlog)
+    log.read()
+    assert log.entries[-2].type() == LogEntry.LogType.COMPRESSED
+    assert match(r'.*SET key .*tags', log.entries[-2].data(decode=True))
+
+    cluster.node(2).restart()
+    cluster.node(2).wait_for_info_param('state', 'up')
+    cluster.node(2).wait_for_log_applied()
+    assert cluster.node(2).client.get('key') == value.encode()
+
+
+def test_entry_compression_mixed_versions(cluster):
+    """
+    Nodes that don't support compressed entries get them decompressed.
+    """
+
+    cluster.create(3)
+
+    # Make node 3 look like an older version to the leader: it can't answer
+    # the RAFT.CONFIG lookup the leader checks support with on connect.
+    cluster.node(3).client.execute_command(
+        'ACL', 'SETUSER', 'default', '-raft.config')
+    cluster.node(3).client.execute_command('CLIENT', 'KILL', 'TYPE', 'normal')
+
+    cluster.node(1).raft_config_set('raft-entry-compress-threshold', '1kb')
+    value = '{"name":"value","tags":["a","b"]}' * 100
+    assert cluster.raft_exec('SET', 'key', value)
+    cluster.wait_for_unanimity()
+
+    assert cluster.node(1).raft_info()['compressed_entries'] == 1
+    assert cluster.node(2).client.get('key') == value.encode()
+    assert cluster.node(3).client.get('key') == value.encode()
+
+    def entry_type(node):
+        log = RaftLog(node.raftlog)
+        log.read()
+        entries = [e for e in log.entries
+                   if not e.type_is_cfgchange() and
+                   match(r'SET key ', e.data(decode=True))]
+        assert len(entries) == 1
+        return entries[0].type()
+
+    assert entry_type(cluster.node(2)) == LogEntry.LogType.COMPRESSED
+    assert entry_type(cluster.node(3)) == LogEntry.LogType.NORMAL
+
+
 def test_raft_log_max_cache_size(cluster):
     """
     Raft log cache configuration in effect.
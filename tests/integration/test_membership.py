@@ -187,6 +187,6 @@ def test_update_self_voting_state_from_snapshot(cluster):
     assert cluster.node(2).raft_info()['is_voting'] == 'yes'
     assert cluster.node(1).client.execute_command('RAFT.DEBUG', 'COMPACT') == b'OK'
 
-    cluster.node(1).client.execute_command('RAFT.DEBUG', 'SENDSNAPSHOT', '2')
+    cluster.node(1).send_snapshot(2)
     cluster.node(2).wait_for_info_param('snapshots_loaded', 1)
     assert cluster.node(2).raft_info()['is_voting'] == 'no'
@@ -93,6 +93,82 @@ def test_proxying(cluster):
         cluster.node(2).raft_exec('INCR', 'myset')
 
 
+def test_proxying_batch(cluster):
+    """
+    Commands proxied together reply individually, and transactions or errors
+    don't affect the other commands of the batch.
+    """
+    cluster.create(3)
+    assert cluster.leader == 1
+    assert cluster.node(2).client.execute_command(
+        'RAFT.CONFIG', 'SET', 'follower-proxy', 'yes') == b'OK'
+    assert cluster.node(2).raft_exec('SADD', 'myset', 'a') == 1
+
+    n2 = cluster.node(2)
+    multi = n2.client.connection_pool.make_connection()
+    empty = n2.client.connection_pool.make_connection()
+    for conn in (multi, empty):
+        conn.send_command('RAFT', 'MULTI')
+        assert conn.read_response() == b'OK'
+    multi.send_command('RAFT', 'INCR', 'tx')
+    assert multi.read_response() == b'QUEUED'
+    multi.send_command('RAFT', 'INCR', 'tx')
+    assert multi.read_response() == b'QUEUED'
+
+    conns = [n2.client.connection_pool.make_connection() for _ in range(10)]
+    wrongtype = n2.client.connection_pool.make_connection()
+    marker = n2.client.connection_pool.make_connection()
+    for conn in conns[:5]:
+        conn.send_command('RAFT', 'INCR', 'counter')
+    multi.send_command('RAFT', 'EXEC')
+    wrongtype.send_command('RAFT', 'INCR', 'myset')
+    empty.send_command('RAFT', 'EXEC')
+    marker.send_command('RAFT', 'RAFT.BATCH')
+    for conn in conns[5:]:
+        conn.send_command('RAFT', 'INCR', 'counter')
+
+    replies = [conn.read_response() for conn in conns]
+    assert sorted(replies) == list(range(1, 11))
+    assert multi.read_response() == [1, 2]
+    assert empty.read_response() == []
+    with raises(ResponseError, match='WRONGTYPE'):
+        wrongtype.read_response()
+    with raises(ResponseError):
+        marker.read_response()
+    for conn in conns + [multi, empty, wrongtype, marker]:
+        conn.disconnect()
+
+    cluster.wait_for_unanimity()
+    for node_id in (1, 2, 3):
+        assert cluster.node(node_id).client.get('counter') == b'10'
+        assert cluster.node(node_id).client.get('tx') == b'2'
+
+
+def test_follower_reads(cluster):
+    """
+    Followers execute reads locally, after applying the leader's read index.
+    """
+    cluster.create(3)
+    assert cluster.leader == 1
+    assert cluster.node(2).client.execute_command(
+        'RAFT.CONFIG', 'SET', 'follower-proxy', 'yes') == b'OK'
+    assert cluster.node(2).client.execute_command(
+        'RAFT.CONFIG', 'SET', 'follower-reads', 'yes') == b'OK'
+
+    # Writes are still proxied, reads must see them
+    for i in range(10):
+        assert cluster.node(2).raft_exec('SET', 'key', str(i)) == b'OK'
+        assert cluster.node(2).raft_exec('GET', 'key') == str(i).encode()
+    assert cluster.node(1).raft_exec('INCR', 'key') == 10
+    assert cluster.node(2).raft_exec('GET', 'key') == b'10'
+
+    # Read index is available from the leader only
+    assert cluster.node(1).client.execute_command('RAFT.READINDEX') >= \
+        cluster.node(1).commit_index()
+    with raises(ResponseError, match='MOVED'):
+        cluster.node(2).client.execute_command('RAFT.READINDEX')
+
+
 def test_readonly_commands(cluster):
     """
     Test read-only command execution, which does not go through the Raft
@@ -123,6 +199,176 @@ def test_readonly_commands(cluster):
     assert cluster.node(1).raft_exec('GET', 'key') == b'value'
 
 
+def test_lease_reads(cluster):
+    """
+    Lease reads are served locally, but not once the lease has expired.
+    """
+    # The lease lasts 90% of the election timeout since the last ack
+    cluster.create(3, raft_args={'election-timeout': '5000'})
+    assert cluster.leader == 1
+    cluster.node(1).raft_config_set('lease-reads', 'yes')
+
+    assert cluster.node(1).raft_exec('SET', 'key', 'value') == b'OK'
+    assert cluster.node(1).raft_exec('GET', 'key') == b'value'
+
+    # Tear down cluster, reads are served from the lease while it's valid
+    cluster.node(2).terminate()
+    cluster.node(3).terminate()
+    start = time.time()
+    conn = cluster.node(1).client.connection_pool.get_connection(
+        'RAFT', socket_timeout=1)
+    conn.send_command('RAFT', 'GET', 'key')
+    assert conn.can_read(timeout=1)
+    assert conn.read_response() == b'value'
+    assert time.time() - start < 4
+
+    # Reads hang once the lease expires
+    time.sleep(5 - (time.time() - start))
+    conn.send_command('RAFT', 'GET', 'key')
+    assert not conn.can_read(timeout=1)
+
+
+def test_write_batching(cluster):
+    """
+    Batched writes are appended together and reply individually.
+    """
+    cluster.create(3)
+    assert cluster.leader == 1
+    cluster.node(1).raft_config_set('raft-write-batching', 'yes')
+
+    idx = cluster.node(1).current_index()
+    conns = [cluster.node(1).client.connection_pool.make_connection()
+             for _ in range(20)]
+    for conn in conns:
+        conn.send_command('RAFT', 'INCR', 'counter')
+    replies = [conn.read_response() for conn in conns]
+    for conn in conns:
+        conn.disconnect()
+
+    assert sorted(replies) == list(range(1, 21))
+    assert cluster.node(1).current_index() <= idx + 20
+    cluster.wait_for_unanimity()
+    assert cluster.node(2).client.get('counter') == b'20'
+
+
+def test_write_batching_with_multi(cluster):
+    """
+    Transactions, including empty ones, are not batched with other writes and
+    are replayed the same way on followers.
+    """
+    cluster.create(3)
+    assert cluster.leader == 1
+    cluster.node(1).raft_config_set('raft-write-batching', 'yes')
+
+    empty = cluster.node(1).client.connection_pool.make_connection()
+    multi = cluster.node(1).client.connection_pool.make_connection()
+    empty.send_command('RAFT', 'MULTI')
+    assert empty.read_response() == b'OK'
+    multi.send_command('RAFT', 'MULTI')
+    assert multi.read_response() == b'OK'
+    multi.send_command('RAFT', 'INCR', 'tx')
+    assert multi.read_response() == b'QUEUED'
+    multi.send_command('RAFT', 'INCR', 'tx')
+    assert multi.read_response() == b'QUEUED'
+
+    conns = [cluster.node(1).client.connection_pool.make_connection()
+             for _ in range(10)]
+    for conn in conns[:5]:
+        conn.send_command('RAFT', 'INCR', 'counter')
+    empty.send_command('RAFT', 'EXEC')
+    multi.send_command('RAFT', 'EXEC')
+    for conn in conns[5:]:
+        conn.send_command('RAFT', 'INCR', 'counter')
+
+    replies = [conn.read_response() for conn in conns]
+    assert empty.read_response() == []
+    assert multi.read_response() == [1, 2]
+    for conn in conns + [empty, multi]:
+        conn.disconnect()
+
+    assert sorted(replies) == list(range(1, 11))
+    cluster.wait_for_unanimity()
+    for node_id in (2, 3):
+        assert cluster.node(node_id).client.get('counter') == b'10'
+        assert cluster.node(node_id).client.get('tx') == b'2'
+
+    # Followers applied the same commands, so they can take over
+    cluster.node(1).terminate()
+    assert cluster.raft_exec('INCR', 'counter') == 11
+    assert cluster.raft_exec('INCR', 'tx') == 3
+
+
+def test_log_async_fsync(cluster):
+    """
+    Test writes are acknowledged and replicated with asynchronous log sync.
+    """
+    cluster.create(3)
+    assert cluster.leader == 1
+    for node in cluster.nodes.values():
+        node.raft_config_set('raft-log-async-fsync', 'yes')
+
+    conns = [cluster.node(1).client.connection_pool.make_connection()
+             for _ in range(20)]
+    for conn in conns:
+        conn.send_command('RAFT', 'INCR', 'counter')
+    replies = [conn.read_response() for conn in conns]
+    for conn in conns:
+        conn.disconnect()
+
+    assert sorted(replies) == list(range(1, 21))
+    cluster.wait_for_unanimity()
+    assert cluster.node(2).client.get('counter') == b'20'
+    assert cluster.node(1).raft_info()['synced_index'] == \
+        cluster.node(1).current_index()
+
+
+def test_followers_apply_without_periodic_tick(cluster):
+    """
+    Test followers apply committed entries without waiting for a heartbeat
+    or a periodic tick.
+    """
+    cluster.create(3, raft_args={'raft-interval': '1000',
+                                 'request-timeout': '3000',
+                                 'election-timeout': '6000'})
+    assert cluster.leader == 1
+    cluster.wait_for_unanimity()
+
+    cluster.node(1).raft_exec('SET', 'key', 'value')
+    idx = cluster.node(1).current_index()
+
+    start = time.time()
+    while cluster.node(2).raft_info()['last_applied_index'] < idx:
+        assert time.time() - start < 0.5
+        time.sleep(0.01)
+    assert cluster.node(2).client.get('key') == b'value'
+
+
+def test_write_ack_levels(cluster):
+    """
+    Test RAFT.ACK replies with the entry index, and writes are applied.
+    """
+    cluster.create(3)
+    assert cluster.leader == 1
+    n1 = cluster.node(1)
+
+    idx = n1.client.execute_command('RAFT.ACK', 'COMMITTED', 'INCR', 'counter')
+    assert idx == n1.current_index()
+    idx = n1.client.execute_command('RAFT.ACK', 'DURABLE', 'INCR', 'counter')
+    assert idx == n1.current_index()
+    assert n1.client.execute_command('RAFT.ACK', 'APPLIED', 'INCR', 'counter') == 3
+
+    # Read-only commands get their usual reply
+    assert n1.client.execute_command('RAFT.ACK', 'DURABLE', 'GET', 'counter') == b'3'
+
+    with raises(ResponseError, match='invalid acknowledgment level'):
+        n1.client.execute_command('RAFT.ACK', 'NONE', 'INCR', 'counter')
+    with raises(ResponseError, match='MOVED'):
+        cluster.node(2).client.execute_command('RAFT.ACK', 'COMMITTED', 'INCR', 'counter')
+
+    cluster.wait_for_unanimity()
+    assert cluster.node(2).client.get('counter') == b'3'
+
+
 def test_auto_ids(cluster):
     """
     Test automatic assignment of ids.
@@ -345,3 +591,38 @@ def test_rolled_back_read_only_multi_reply(cluster):
 
     with raises(ResponseError, match='TIMEOUT'):
         assert conn.read_response() == None
+
+
+def test_memory_pools_reuse(cluster):
+    """
+    Requests and log entries are served from memory pools once released.
+    """
+
+    cluster.create(3)
+    for i in range(100):
+        cluster.node(1).raft_exec('SET', 'key', 'value%d' % i)
+
+    info = cluster.node(1).raft_info()
+    assert info['req_pool_hits'] > 0
+    assert info['entry_pool_hits'] > 0
+
+
+def test_latency_stats(cluster):
+    """
+    Write path latency histograms are reported by RAFT.INFO and can be reset.
+    """
+
+    cluster.create(3)
+    for i in range(100):
+        cluster.node(1).raft_exec('SET', 'key', 'value%d' % i)
+
+    info = cluster.node(1).raft_info()
+    for stage in ['rqueue_wait', 'log_append', 'replication_rtt',
+                  'commit_to_apply', 'apply_lock_hold']:
+        stats = info['latency_%s_usec' % stage]
+        assert stats['count'] > 0
+        assert stats['p50'] <= stats['p99'] <= stats['p999'] <= stats['max']
+
+    cluster.node(1).client.execute_command('RAFT.INFO', 'RESETLATENCY')
+    info = cluster.node(1).raft_info()
+    assert info['latency_log_append_usec']['count'] == 0
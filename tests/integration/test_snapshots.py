@@ -7,6 +7,8 @@ RedisRaft is dual licensed under the GNU Affero General Public License version 3
 (AGPLv3) or the Redis Source Available License (RSAL).
 """
 
+import os
+
 from fixtures import cluster
 from raftlog import RaftLog, LogEntry
 
@@ -32,6 +34,58 @@ def test_snapshot_delivery_to_new_node(cluster):
     assert r2.client.get('testkey') == b'4'
 
 
+def test_snapshot_delivery_in_chunks(cluster):
+    """
+    Snapshots larger than raft-snapshot-chunk-size are delivered in chunks.
+    """
+
+    r1 = cluster.add_node()
+    r1.client.execute_command('RAFT.CONFIG', 'SET',
+                              'raft-snapshot-chunk-size', '1000')
+    for i in range(100):
+        r1.raft_exec('SET', 'key-%s' % i, 'x' * 100)
+    r1.raft_exec('INCR', 'testkey')
+
+    assert r1.client.execute_command('RAFT.DEBUG', 'COMPACT') == b'OK'
+    assert r1.raft_info()['log_entries'] == 0
+
+    r2 = cluster.add_node()
+    cluster.wait_for_unanimity()
+    assert r2.raft_info()['snapshots_loaded'] == 1
+    assert r2.client.get('testkey') == b'1'
+    assert r2.client.get('key-99') == b'x' * 100
+
+
+def test_snapshot_delivery_diskless(cluster):
+    """
+    With raft-snapshot-diskless, a new snapshot is streamed to nodes rather
+    than the snapshot file.
+    """
+
+    r1 = cluster.add_node()
+    r1.client.execute_command('RAFT.CONFIG', 'SET',
+                              'raft-snapshot-chunk-size', '1000')
+    r1.client.execute_command('RAFT.CONFIG', 'SET',
+                              'raft-snapshot-diskless-dir', '/tmp')
+    r1.client.execute_command('RAFT.CONFIG', 'SET',
+                              'raft-snapshot-diskless', 'yes')
+    for i in range(100):
+        r1.raft_exec('SET', 'key-%s' % i, 'x' * 100)
+
+    assert r1.client.execute_command('RAFT.DEBUG', 'COMPACT') == b'OK'
+    assert r1.raft_info()['log_entries'] == 0
+
+    # Not part of the snapshot file, but included in the stream
+    r1.raft_exec('INCR', 'testkey')
+
+    r2 = cluster.add_node()
+    cluster.wait_for_unanimity()
+    assert r1.raft_info()['snapshots_streamed'] == 1
+    assert r2.raft_info()['snapshots_loaded'] == 1
+    assert r2.client.get('testkey') == b'1'
+    assert r2.client.get('key-99') == b'x' * 100
+
+
 def test_snapshot_delivery(cluster):
     """
     Ability to properly deliver and load a snapshot.
@@ -67,6 +121,40 @@ def test_snapshot_delivery(cluster):
                               'raftize-all-commands', 'no')
     assert n3.client.get('testkey') == b'5'
 
+    # Snapshot was delivered over a bulk connection
+    nodes = [v for v in n1.raft_info().values() if isinstance(v, dict)]
+    assert [n['bulk_state'] for n in nodes if n['id'] == 3] == ['connected']
+
+
+def test_snapshot_delivery_to_multiple_nodes(cluster):
+    """
+    Snapshot delivered to several nodes at once shares one file source.
+    """
+
+    cluster.create(5)
+    n1 = cluster.node(1)
+    n1.raft_config_set('raft-snapshot-chunk-size', '4096')
+    for i in range(100):
+        n1.raft_exec('SET', 'key-%s' % i, 'x' * 1000)
+    cluster.wait_for_replication()
+    assert n1.client.execute_command('RAFT.DEBUG', 'COMPACT') == b'OK'
+
+    chunks = (os.path.getsize(n1.dbfilename) + 4095) // 4096
+    assert chunks > 1
+    before = n1.raft_info()
+
+    # Both deliveries start before the file is opened, so they attach to
+    # the same source and are both waiting for the first chunk.
+    n1.send_snapshot(4, 5)
+    for node_id in (4, 5):
+        cluster.node(node_id).wait_for_info_param('snapshots_loaded', 1)
+        assert cluster.node(node_id).client.get('key-99') == b'x' * 1000
+
+    info = n1.raft_info()
+    assert info['snapshot_file_opens'] - before['snapshot_file_opens'] == 1
+    reads = info['snapshot_chunk_reads'] - before['snapshot_chunk_reads']
+    assert chunks <= reads < 2 * chunks
+
 
 def test_log_fixup_after_snapshot_delivery(cluster):
     """
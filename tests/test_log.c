@@ -22,10 +22,14 @@
 #define LOGNAME "test.log.db"
 #define DBID "01234567890123456789012345678901"
 
+/* First segment of a log created with no snapshot */
+#define SEGNAME LOGNAME ".00000000000000000001"
+
 static int setup_create_log(void **state)
 {
     RedisRaftConfig cfg = {
-        .id = 1
+        .id = 1,
+        .raft_log_segment_size = REDIS_RAFT_DEFAULT_LOG_SEGMENT_SIZE
     };
 
     *state = RaftLogCreate(LOGNAME, DBID, 1, 0, 1, -1, &cfg);
@@ -36,8 +40,10 @@ static int setup_create_log(void **state)
 static int teardown_log(void **state)
 {
     RaftLog *log = (RaftLog *) *state;
-    RaftLogClose(log);
-    unlink(LOGNAME);
+    if (log) {
+        RaftLogClose(log);
+    }
+    RaftLogRemoveFiles(LOGNAME);
     return 0;
 }
 
@@ -123,6 +129,35 @@ static void test_log_random_access_with_snapshot(void **state)
     raft_entry_release(e);
 }
 
+static void test_log_get_batch(void **state)
+{
+    RaftLog *log = (RaftLog *) *state;
+    raft_entry_t *entries[10];
+    int i;
+
+    RaftLogReset(log, 100, 1);
+    for (i = 1; i <= 10; i++) {
+        __append_entry(log, i);
+    }
+
+    /* Out of bounds */
+    assert_int_equal(RaftLogGetBatch(log, 100, 5, entries), 0);
+    assert_int_equal(RaftLogGetBatch(log, 111, 5, entries), 0);
+
+    assert_int_equal(RaftLogGetBatch(log, 103, 5, entries), 5);
+    for (i = 0; i < 5; i++) {
+        assert_int_equal(entries[i]->id, i + 3);
+        raft_entry_release(entries[i]);
+    }
+
+    /* Truncated at the end of the log */
+    assert_int_equal(RaftLogGetBatch(log, 108, 10, entries), 3);
+    for (i = 0; i < 3; i++) {
+        assert_int_equal(entries[i]->id, i + 8);
+        raft_entry_release(entries[i]);
+    }
+}
+
 static void test_log_load_entries(void **state)
 {
     RaftLog *log = (RaftLog *) *state;
@@ -150,7 +185,7 @@ static void test_log_index_rebuild(void **state)
     __append_entry(log, 30);
 
     /* Delete index file */
-    unlink(LOGNAME ".idx");
+    unlink(LOGNAME ".00000000000000000101.idx");
 
     /* Reopen the log */
     RaftLog *log2 = RaftLogOpen(LOGNAME, NULL, 0);
@@ -173,6 +208,33 @@ static void test_log_index_rebuild(void **state)
     RaftLogClose(log2);
 }
 
+static void test_log_index_grow(void **state)
+{
+    RaftLog *log = (RaftLog *) *state;
+    int i;
+
+    /* Enough entries to grow the index map a few times */
+    for (i = 1; i <= 20000; i++) {
+        __append_entry(log, i);
+    }
+
+    raft_entry_t *e = RaftLogGet(log, 1);
+    assert_int_equal(e->id, 1);
+    raft_entry_release(e);
+
+    e = RaftLogGet(log, 20000);
+    assert_int_equal(e->id, 20000);
+    raft_entry_release(e);
+
+    /* Use the index as written */
+    RaftLog *log2 = RaftLogOpen(LOGNAME, NULL, RAFTLOG_KEEP_INDEX);
+    log2->num_entries = 20000;
+    e = RaftLogGet(log2, 12345);
+    assert_int_equal(e->id, 12345);
+    raft_entry_release(e);
+    RaftLogClose(log2);
+}
+
 static void test_log_write_after_read(void **state)
 {
     RaftLog *log = (RaftLog *) *state;
@@ -190,6 +252,270 @@ static void test_log_write_after_read(void **state)
     raft_entry_release(e);
 }
 
+static void test_log_group_commit(void **state)
+{
+    RaftLog *log = (RaftLog *) *state;
+
+    RaftLogBeginBatch(log);
+    __append_entry(log, 1);
+    __append_entry(log, 2);
+    __append_entry(log, 3);
+    assert_int_equal(log->unsynced_entries, 3);
+
+    /* Unsynced entries are readable */
+    raft_entry_t *e = RaftLogGet(log, 2);
+    assert_int_equal(e->id, 2);
+    raft_entry_release(e);
+
+    assert_int_equal(RaftLogSyncBatch(log), RR_OK);
+    assert_int_equal(log->unsynced_entries, 0);
+    assert_true(log->batch);
+
+    __append_entry(log, 4);
+    assert_int_equal(RaftLogEndBatch(log), RR_OK);
+    assert_int_equal(log->unsynced_entries, 0);
+    assert_false(log->batch);
+
+    /* Not batched */
+    __append_entry(log, 5);
+    assert_int_equal(log->unsynced_entries, 0);
+
+    /* Reopen the log */
+    RaftLog *log2 = RaftLogOpen(LOGNAME, NULL, 0);
+    assert_int_equal(RaftLogLoadEntries(log2, NULL, NULL), 5);
+    RaftLogClose(log2);
+}
+
+static void __count_syncs(void *arg, uint64_t sync_usec)
+{
+    (*(int *) arg)++;
+}
+
+static void test_log_async_sync(void **state)
+{
+    RaftLog *log = (RaftLog *) *state;
+    uv_loop_t loop;
+    int syncs = 0;
+
+    uv_loop_init(&loop);
+    log->fsync = true;
+
+    /* Nothing to sync */
+    assert_false(RaftLogSyncAsync(log, &loop, __count_syncs, &syncs));
+
+    RaftLogBeginBatch(log);
+    __append_entry(log, 1);
+    __append_entry(log, 2);
+    RaftLogEndBatch(log);
+    assert_int_equal(log->synced_idx, 2);
+
+    /* Batches are left open, so appends are not synced */
+    log->batch = true;
+    __append_entry(log, 3);
+    __append_entry(log, 4);
+    assert_true(RaftLogSyncAsync(log, &loop, __count_syncs, &syncs));
+    assert_int_equal(log->synced_idx, 2);
+
+    /* Entries appended while a sync is in progress are synced next */
+    __append_entry(log, 5);
+    assert_true(RaftLogSyncAsync(log, &loop, __count_syncs, &syncs));
+
+    uv_run(&loop, UV_RUN_DEFAULT);
+    assert_int_equal(syncs, 2);
+    assert_int_equal(log->synced_idx, 5);
+    assert_null(log->sync_req);
+
+    /* Removing entries discards the sync in progress, which may not cover
+     * the entries that replace them.
+     */
+    __append_entry(log, 6);
+    assert_true(RaftLogSyncAsync(log, &loop, __count_syncs, &syncs));
+    assert_int_equal(RaftLogDelete(log, 6, NULL, NULL), RR_OK);
+    assert_int_equal(log->synced_idx, 5);
+    __append_entry(log, 7);
+
+    syncs = 0;
+    uv_run(&loop, UV_RUN_DEFAULT);
+    assert_int_equal(syncs, 2);
+    assert_int_equal(log->synced_idx, 6);
+
+    /* A sync may outlive the log */
+    __append_entry(log, 8);
+    assert_true(RaftLogSyncAsync(log, &loop, __count_syncs, &syncs));
+    RaftLogClose(log);
+    *state = NULL;
+
+    syncs = 0;
+    uv_run(&loop, UV_RUN_DEFAULT);
+    assert_int_equal(syncs, 0);
+    uv_loop_close(&loop);
+}
+
+static void test_log_async_sync_segments(void **state)
+{
+    RaftLog *log = (RaftLog *) *state;
+    uv_loop_t loop;
+    int syncs = 0;
+    int i = 1;
+
+    uv_loop_init(&loop);
+    log->fsync = true;
+    log->segment_size = 200;
+    log->batch = true;
+
+    /* A segment sealed while a sync is in progress is synced after it */
+    __append_entry(log, i++);
+    assert_true(RaftLogSyncAsync(log, &loop, __count_syncs, &syncs));
+    while (log->num_segments < 2) {
+        __append_entry(log, i++);
+    }
+    assert_non_null(log->sealed_sync);
+    assert_int_equal(log->synced_idx, 0);
+
+    uv_run(&loop, UV_RUN_DEFAULT);
+    assert_int_equal(syncs, 3);
+    assert_int_equal(log->synced_idx, log->index);
+    assert_null(log->sealed_sync);
+    assert_null(log->sync_req);
+
+    /* Otherwise the sealed segment is synced right away, in the background */
+    while (log->num_segments < 3) {
+        __append_entry(log, i++);
+    }
+    assert_non_null(log->sync_req);
+    assert_null(log->sealed_sync);
+    assert_true(log->synced_idx < log->index);
+    assert_true(RaftLogSyncAsync(log, &loop, __count_syncs, &syncs));
+
+    syncs = 0;
+    uv_run(&loop, UV_RUN_DEFAULT);
+    assert_int_equal(syncs, 2);
+    assert_int_equal(log->synced_idx, log->index);
+
+    /* A sealed segment still waiting is synced when the log is closed */
+    __append_entry(log, i++);
+    assert_true(RaftLogSyncAsync(log, &loop, __count_syncs, &syncs));
+    while (log->num_segments < 4) {
+        __append_entry(log, i++);
+    }
+    assert_non_null(log->sealed_sync);
+    RaftLogClose(log);
+    *state = NULL;
+
+    uv_run(&loop, UV_RUN_DEFAULT);
+    uv_loop_close(&loop);
+}
+
+static void __write_v1_log(const char *filename)
+{
+    FILE *f = fopen(filename, "w");
+    assert_non_null(f);
+
+    fprintf(f, "*8\r\n$7\r\nRAFTLOG\r\n$4\r\n0001\r\n$32\r\n%s\r\n", DBID);
+    fprintf(f, "$20\r\n%020d\r\n$20\r\n%020d\r\n$20\r\n%020d\r\n", 1, 1, 0);
+    fprintf(f, "$20\r\n%020d\r\n$11\r\n%011d\r\n", 1, -1);
+
+    fprintf(f, "*5\r\n$5\r\nENTRY\r\n$1\r\n1\r\n$1\r\n3\r\n$1\r\n0\r\n$6\r\nvalue3\r\n");
+    fprintf(f, "*5\r\n$5\r\nENTRY\r\n$1\r\n1\r\n$2\r\n30\r\n$1\r\n0\r\n$7\r\nvalue30\r\n");
+
+    fclose(f);
+}
+
+static void test_log_v1_compat(void **state)
+{
+    __write_v1_log(LOGNAME);
+
+    RaftLog *log = RaftLogOpen(LOGNAME, NULL, 0);
+    assert_non_null(log);
+    assert_int_equal(log->version, 1);
+    assert_int_equal(log->vote, -1);
+
+    /* Loading entries converts the log */
+    assert_int_equal(RaftLogLoadEntries(log, NULL, NULL), 2);
+    assert_int_equal(log->version, RAFTLOG_VERSION);
+    assert_int_equal(log->num_segments, 1);
+
+    raft_entry_t *e = RaftLogGet(log, 2);
+    assert_non_null(e);
+    assert_int_equal(e->id, 30);
+    assert_memory_equal(e->data, "value30", 7);
+    raft_entry_release(e);
+
+    __append_entry(log, 300);
+    RaftLogClose(log);
+
+    log = RaftLogOpen(LOGNAME, NULL, 0);
+    assert_int_equal(log->version, RAFTLOG_VERSION);
+    assert_int_equal(RaftLogLoadEntries(log, NULL, NULL), 3);
+
+    e = RaftLogGet(log, 3);
+    assert_non_null(e);
+    assert_int_equal(e->id, 300);
+    raft_entry_release(e);
+
+    assert_int_equal(RaftLogReset(log, 10, 1), RR_OK);
+    assert_int_equal(log->version, RAFTLOG_VERSION);
+    __append_entry(log, 4);
+    RaftLogClose(log);
+
+    log = RaftLogOpen(LOGNAME, NULL, 0);
+    assert_int_equal(log->version, RAFTLOG_VERSION);
+    assert_int_equal(RaftLogLoadEntries(log, NULL, NULL), 1);
+    RaftLogClose(log);
+
+    RaftLogRemoveFiles(LOGNAME);
+}
+
+static void test_log_incomplete_entry(void **state)
+{
+    RaftLog *log = (RaftLog *) *state;
+
+    __append_entry(log, 1);
+    __append_entry(log, 2);
+    size_t file_size = log->file_size;
+    __append_entry(log, 3);
+
+    /* Simulate a crash in the middle of writing the last entry */
+    assert_int_equal(truncate(SEGNAME, log->file_size - 5), 0);
+
+    RaftLog *log2 = RaftLogOpen(LOGNAME, NULL, 0);
+    assert_int_equal(RaftLogLoadEntries(log2, NULL, NULL), 2);
+    assert_int_equal(log2->file_size, file_size);
+
+    /* New entries follow the last complete one */
+    __append_entry(log2, 30);
+    raft_entry_t *e = RaftLogGet(log2, 3);
+    assert_non_null(e);
+    assert_int_equal(e->id, 30);
+    raft_entry_release(e);
+    RaftLogClose(log2);
+
+    log2 = RaftLogOpen(LOGNAME, NULL, 0);
+    assert_int_equal(RaftLogLoadEntries(log2, NULL, NULL), 3);
+    RaftLogClose(log2);
+}
+
+static void test_log_corrupted_entry(void **state)
+{
+    RaftLog *log = (RaftLog *) *state;
+
+    __append_entry(log, 1);
+    __append_entry(log, 2);
+
+    /* Flip a byte of the last entry's data */
+    FILE *f = fopen(SEGNAME, "r+");
+    assert_non_null(f);
+    fseek(f, -10, SEEK_END);
+    int c = fgetc(f);
+    fseek(f, -10, SEEK_END);
+    fputc(c ^ 0xff, f);
+    fclose(f);
+
+    RaftLog *log2 = RaftLogOpen(LOGNAME, NULL, 0);
+    assert_int_equal(RaftLogLoadEntries(log2, NULL, NULL), -1);
+    RaftLogClose(log2);
+}
+
 static void test_log_fuzzer(void **state)
 {
     RaftLog *log = (RaftLog *) *state;
@@ -316,6 +642,162 @@ static void test_log_delete(void **state)
     raft_entry_release(entry3);
 }
 
+static void test_log_segments(void **state)
+{
+    RaftLog *log = (RaftLog *) *state;
+    raft_entry_t *entries[100];
+    int i;
+
+    /* Every segment holds a few entries */
+    log->segment_size = 200;
+    for (i = 1; i <= 100; i++) {
+        __append_entry(log, i);
+    }
+    assert_true(log->num_segments > 10);
+    assert_int_equal(log->segments[0].first_idx, 1);
+
+    /* Batches span segments */
+    assert_int_equal(RaftLogGetBatch(log, 5, 100, entries), 96);
+    for (i = 0; i < 96; i++) {
+        assert_int_equal(entries[i]->id, i + 5);
+        raft_entry_release(entries[i]);
+    }
+
+    /* Delete entries held by the last few segments */
+    int num_segments = log->num_segments;
+    assert_int_equal(RaftLogDelete(log, 50, NULL, NULL), RR_OK);
+    assert_int_equal(RaftLogCount(log), 49);
+    assert_true(log->num_segments < num_segments);
+    assert_null(RaftLogGet(log, 50));
+
+    __append_entry(log, 500);
+    raft_entry_t *e = RaftLogGet(log, 50);
+    assert_non_null(e);
+    assert_int_equal(e->id, 500);
+    raft_entry_release(e);
+
+    /* Reopen the log */
+    RaftLog *log2 = RaftLogOpen(LOGNAME, NULL, 0);
+    assert_non_null(log2);
+    assert_int_equal(log2->num_segments, log->num_segments);
+    assert_int_equal(RaftLogLoadEntries(log2, NULL, NULL), 50);
+    assert_int_equal(log2->file_size, log->file_size);
+
+    e = RaftLogGet(log2, 25);
+    assert_non_null(e);
+    assert_int_equal(e->id, 25);
+    raft_entry_release(e);
+    RaftLogClose(log2);
+}
+
+static int count_entries_callback(void *arg, raft_entry_t *entry, raft_index_t idx)
+{
+    raft_index_t *next_idx = arg;
+
+    assert_int_equal(idx, *next_idx);
+    assert_int_equal(entry->id, idx);
+    (*next_idx)++;
+
+    return 0;
+}
+
+static void test_log_parallel_load(void **state)
+{
+    RaftLog *log = (RaftLog *) *state;
+    int i;
+
+    log->segment_size = 500;
+    for (i = 1; i <= 1000; i++) {
+        __append_entry(log, i);
+    }
+    assert_true(log->num_segments > 50);
+
+    /* Entries are passed on in order, whatever the number of threads */
+    int threads[] = { 1, 3, 16 };
+    for (i = 0; i < 3; i++) {
+        RaftLog *log2 = RaftLogOpen(LOGNAME, NULL, 0);
+        raft_index_t next_idx = 1;
+
+        log2->load_threads = threads[i];
+        assert_int_equal(RaftLogLoadEntries(log2, count_entries_callback, &next_idx), 1000);
+        assert_int_equal(next_idx, 1001);
+        assert_int_equal(RaftLogCurrentIdx(log2), 1000);
+
+        raft_entry_t *e = RaftLogGet(log2, 777);
+        assert_non_null(e);
+        assert_int_equal(e->id, 777);
+        raft_entry_release(e);
+        RaftLogClose(log2);
+    }
+
+    /* A corrupted segment fails the load */
+    char *filename = log->segments[log->num_segments / 2].filename;
+    FILE *f = fopen(filename, "r+");
+    assert_non_null(f);
+    fseek(f, -10, SEEK_END);
+    int c = fgetc(f);
+    fseek(f, -10, SEEK_END);
+    fputc(c ^ 0xff, f);
+    fclose(f);
+
+    RaftLog *log2 = RaftLogOpen(LOGNAME, NULL, 0);
+    assert_int_equal(RaftLogLoadEntries(log2, NULL, NULL), -1);
+    RaftLogClose(log2);
+}
+
+static void test_log_compact(void **state)
+{
+    RaftLog *log = (RaftLog *) *state;
+    int i;
+
+    log->segment_size = 200;
+    for (i = 1; i <= 100; i++) {
+        __append_entry(log, i);
+    }
+    int num_segments = log->num_segments;
+    size_t file_size = log->file_size;
+
+    /* Can't compact past the end of the log */
+    assert_int_equal(RaftLogCompact(log, 101, 1), RR_ERROR);
+
+    assert_int_equal(RaftLogCompact(log, 60, 1), RR_OK);
+    assert_int_equal(RaftLogFirstIdx(log), 60);
+    assert_int_equal(RaftLogCount(log), 40);
+    assert_true(log->num_segments < num_segments);
+    assert_true(log->segments[0].first_idx <= 61);
+    assert_true(log->file_size < file_size);
+
+    assert_null(RaftLogGet(log, 60));
+    raft_entry_t *e = RaftLogGet(log, 61);
+    assert_non_null(e);
+    assert_int_equal(e->id, 61);
+    raft_entry_release(e);
+
+    /* Removed segments */
+    assert_int_equal(access(SEGNAME, F_OK), -1);
+
+    /* Entries included in the snapshot are skipped on load */
+    RaftLog *log2 = RaftLogOpen(LOGNAME, NULL, 0);
+    assert_non_null(log2);
+    assert_int_equal(log2->snapshot_last_idx, 60);
+    assert_int_equal(RaftLogLoadEntries(log2, NULL, NULL), 40);
+    assert_int_equal(RaftLogCurrentIdx(log2), 100);
+    assert_int_equal(log2->file_size, log->file_size);
+    RaftLogClose(log2);
+
+    /* Compacting everything keeps the last segment */
+    assert_int_equal(RaftLogCompact(log, 100, 1), RR_OK);
+    assert_int_equal(RaftLogCount(log), 0);
+    assert_int_equal(log->num_segments, 1);
+    assert_int_equal(log->file_size, 0);
+
+    __append_entry(log, 101);
+    e = RaftLogGet(log, 101);
+    assert_non_null(e);
+    assert_int_equal(e->id, 101);
+    raft_entry_release(e);
+}
+
 static void test_entry_cache_sanity(void **state)
 {
     EntryCache *cache = EntryCacheNew(8);
@@ -493,6 +975,83 @@ static void test_entry_cache_delete_tail(void **state)
     EntryCacheFree(cache);
 }
 
+static void test_entry_cache_prepend(void **state)
+{
+    EntryCache *cache = EntryCacheNew(4);
+    raft_entry_t *ety;
+    int i;
+
+    for (i = 100; i <= 103; i++) {
+        ety = raft_entry_new(0);
+        ety->id = i;
+        EntryCacheAppend(cache, ety, i);
+        raft_entry_release(ety);
+    }
+
+    /* Prepend entries, wrapping around and growing the cache */
+    assert_int_equal(EntryCacheDeleteHead(cache, 102), 2);
+    for (i = 101; i >= 98; i--) {
+        ety = raft_entry_new(0);
+        ety->id = i;
+        EntryCachePrepend(cache, ety, i);
+        raft_entry_release(ety);
+    }
+
+    assert_int_equal(cache->size, 8);
+    assert_int_equal(cache->len, 6);
+    assert_int_equal(cache->start_idx, 98);
+
+    for (i = 98; i <= 103; i++) {
+        ety = EntryCacheGet(cache, i);
+        assert_non_null(ety);
+        assert_int_equal(ety->id, i);
+        raft_entry_release(ety);
+    }
+
+    /* Append still works */
+    ety = raft_entry_new(0);
+    ety->id = 104;
+    EntryCacheAppend(cache, ety, 104);
+    raft_entry_release(ety);
+    ety = EntryCacheGet(cache, 104);
+    assert_int_equal(ety->id, 104);
+    raft_entry_release(ety);
+
+    EntryCacheFree(cache);
+}
+
+static void test_entry_cache_compact(void **state)
+{
+    EntryCache *cache = EntryCacheNew(4);
+    raft_entry_t *ety;
+    int i;
+
+    for (i = 1; i <= 10; i++) {
+        ety = raft_entry_new(100);
+        ety->id = i;
+        EntryCacheAppend(cache, ety, i);
+        raft_entry_release(ety);
+    }
+
+    size_t ety_size = sizeof(raft_entry_t) + 100;
+
+    /* Nothing to do when within budget */
+    assert_int_equal(EntryCacheCompact(cache, 10 * ety_size, 5), 0);
+    assert_int_equal(cache->keep_idx, 5);
+
+    /* Entries before keep_idx are not needed */
+    assert_int_equal(EntryCacheCompact(cache, 6 * ety_size, 5), 4);
+    assert_int_equal(cache->start_idx, 5);
+    assert_int_equal(cache->needed_evictions, 0);
+
+    /* Evict entries that are still needed */
+    assert_int_equal(EntryCacheCompact(cache, 4 * ety_size, 5), 2);
+    assert_int_equal(cache->start_idx, 7);
+    assert_int_equal(cache->needed_evictions, 2);
+
+    EntryCacheFree(cache);
+}
+
 static void test_entry_cache_fuzzer(void **state)
 {
     EntryCache *cache = EntryCacheNew(4);
@@ -551,14 +1110,36 @@ const struct CMUnitTest log_tests[] = {
             test_log_random_access, setup_create_log, teardown_log),
     cmocka_unit_test_setup_teardown(
             test_log_random_access_with_snapshot, setup_create_log, teardown_log),
+    cmocka_unit_test_setup_teardown(
+            test_log_get_batch, setup_create_log, teardown_log),
     cmocka_unit_test_setup_teardown(
             test_log_write_after_read, setup_create_log, teardown_log),
     cmocka_unit_test_setup_teardown(
             test_log_index_rebuild, setup_create_log, teardown_log),
+    cmocka_unit_test_setup_teardown(
+            test_log_index_grow, setup_create_log, teardown_log),
     cmocka_unit_test_setup_teardown(
             test_log_delete, setup_create_log, teardown_log),
+    cmocka_unit_test_setup_teardown(
+            test_log_segments, setup_create_log, teardown_log),
+    cmocka_unit_test_setup_teardown(
+            test_log_compact, setup_create_log, teardown_log),
+    cmocka_unit_test_setup_teardown(
+            test_log_parallel_load, setup_create_log, teardown_log),
     cmocka_unit_test_setup_teardown(
             test_log_voting_persistence, setup_create_log, teardown_log),
+    cmocka_unit_test_setup_teardown(
+            test_log_group_commit, setup_create_log, teardown_log),
+    cmocka_unit_test_setup_teardown(
+            test_log_async_sync, setup_create_log, teardown_log),
+    cmocka_unit_test_setup_teardown(
+            test_log_async_sync_segments, setup_create_log, teardown_log),
+    cmocka_unit_test_setup_teardown(
+            test_log_v1_compat, NULL, NULL),
+    cmocka_unit_test_setup_teardown(
+            test_log_incomplete_entry, setup_create_log, teardown_log),
+    cmocka_unit_test_setup_teardown(
+            test_log_corrupted_entry, setup_create_log, teardown_log),
     cmocka_unit_test_setup_teardown(
             test_log_fuzzer, setup_create_log, teardown_log),
     cmocka_unit_test_setup_teardown(
@@ -569,6 +1150,10 @@ const struct CMUnitTest log_tests[] = {
             test_entry_cache_delete_head, NULL, NULL),
     cmocka_unit_test_setup_teardown(
             test_entry_cache_delete_tail, NULL, NULL),
+    cmocka_unit_test_setup_teardown(
+            test_entry_cache_prepend, NULL, NULL),
+    cmocka_unit_test_setup_teardown(
+            test_entry_cache_compact, NULL, NULL),
     cmocka_unit_test_setup_teardown(
             test_entry_cache_fuzzer, NULL, NULL),
     { .test_func = NULL }
@@ -77,6 +77,32 @@ static void test_deserialize_redis_command_array(void **state)
     RaftRedisCommandArrayFree(&cmd_array);
 }
 
+static void test_command_array_batch(void **state)
+{
+    const char *batch = "*3\n*1\n$10\nRAFT.BATCH\n*2\n$4\nINCR\n$1\na\n*1\n$5\nMULTI\n";
+    const char *multi = "*2\n*1\n$5\nmulti\n*2\n$4\nINCR\n$1\na\n";
+    const char *single = "*1\n*1\n$10\nRAFT.BATCH\n";
+    const char *with_args = "*2\n*2\n$10\nRAFT.BATCH\n$1\na\n*2\n$4\nINCR\n$1\na\n";
+
+    RaftRedisCommandArray cmd_array = { 0 };
+    assert_int_equal(RaftRedisCommandArrayDeserialize(&cmd_array, batch, strlen(batch)), RR_OK);
+    assert_true(RaftRedisCommandArrayIsBatch(&cmd_array));
+    assert_false(RaftRedisCommandIsMulti(cmd_array.commands[0]));
+    assert_true(RaftRedisCommandIsMulti(cmd_array.commands[2]));
+
+    assert_int_equal(RaftRedisCommandArrayDeserialize(&cmd_array, multi, strlen(multi)), RR_OK);
+    assert_false(RaftRedisCommandArrayIsBatch(&cmd_array));
+    assert_true(RaftRedisCommandIsMulti(cmd_array.commands[0]));
+
+    /* The marker is only a marker when it's alone, followed by commands */
+    assert_int_equal(RaftRedisCommandArrayDeserialize(&cmd_array, single, strlen(single)), RR_OK);
+    assert_false(RaftRedisCommandArrayIsBatch(&cmd_array));
+    assert_int_equal(RaftRedisCommandArrayDeserialize(&cmd_array, with_args, strlen(with_args)), RR_OK);
+    assert_false(RaftRedisCommandArrayIsBatch(&cmd_array));
+
+    RaftRedisCommandArrayFree(&cmd_array);
+}
+
 static void test_deserialize_corrupted_data(void **state)
 {
     RaftRedisCommand target = { 0 };
@@ -139,10 +165,245 @@ static void test_deserialize_corrupted_data(void **state)
                 d_array_empty_command, strlen(d_array_empty_command)), RR_ERROR);
 }
 
+static void test_lzf_compress(void **state)
+{
+    char in[10000], out[10000], dec[10000];
+    size_t i;
+
+    /* Repetitive data */
+    const char *pattern = "{\"name\":\"value\",\"count\":12}";
+    for (i = 0; i < sizeof(in); i++) {
+        in[i] = pattern[i % strlen(pattern)];
+    }
+
+    size_t len = LZFCompress(in, sizeof(in), out, sizeof(out));
+    assert_true(len > 0);
+    assert_true(len < sizeof(in) / 4);
+    assert_int_equal(LZFDecompress(out, len, dec, sizeof(dec)), sizeof(in));
+    assert_memory_equal(in, dec, sizeof(in));
+
+    /* Output buffer too small */
+    assert_int_equal(LZFDecompress(out, len, dec, sizeof(in) - 1), 0);
+    assert_int_equal(LZFCompress(in, sizeof(in), out, 10), 0);
+
+    /* Random data doesn't compress */
+    srandom(1);
+    for (i = 0; i < sizeof(in); i++) {
+        in[i] = random();
+    }
+    assert_int_equal(LZFCompress(in, sizeof(in), out, sizeof(in) - sizeof(in) / 8), 0);
+
+    len = LZFCompress(in, 100, out, sizeof(out));
+    assert_true(len > 0);
+    assert_int_equal(LZFDecompress(out, len, dec, sizeof(dec)), 100);
+    assert_memory_equal(in, dec, 100);
+
+    /* Back reference beyond the start of the data */
+    const char bad_ref[] = { 0x00, 'a', 0x20, 0x05 };
+    assert_int_equal(LZFDecompress(bad_ref, sizeof(bad_ref), dec, sizeof(dec)), 0);
+}
+
+static void test_compress_entry(void **state)
+{
+    char value[2000];
+    int i;
+
+    const char *pattern = "{\"id\":1234,\"tags\":[\"a\",\"b\"]}";
+    for (i = 0; i < sizeof(value) - 1; i++) {
+        value[i] = pattern[i % strlen(pattern)];
+    }
+    value[sizeof(value) - 1] = '\0';
+
+    const char *argv[] = { "SET", "key", value };
+    RaftRedisCommandArray cmd_array = { 0 };
+    setupRedisCommand(RaftRedisCommandArrayExtend(&cmd_array), argv, 3);
+
+    raft_entry_t *e = RaftRedisCommandArraySerialize(&cmd_array);
+    size_t data_len = e->data_len;
+
+    /* Below threshold, or disabled */
+    e = RaftEntryCompress(e, data_len + 1);
+    assert_false(RaftEntryIsCompressed(e));
+    e = RaftEntryCompress(e, 0);
+    assert_false(RaftEntryIsCompressed(e));
+
+    e->id = 1234;
+    e->type = RAFT_LOGTYPE_NORMAL;
+    e = RaftEntryCompress(e, 1024);
+    assert_true(RaftEntryIsCompressed(e));
+    assert_int_equal(e->type, RAFT_LOGTYPE_COMPRESSED);
+    assert_true(e->data_len < data_len / 4);
+    assert_int_equal(e->id, 1234);
+
+    /* Compressed entries are never compressed again */
+    raft_entry_t *same = RaftEntryCompress(e, 1);
+    assert_true(same == e);
+
+    raft_entry_t *d = RaftEntryDecompress(e);
+    assert_non_null(d);
+    assert_int_equal(d->type, RAFT_LOGTYPE_NORMAL);
+    assert_int_equal(d->id, 1234);
+    assert_int_equal(d->data_len, data_len);
+
+    RaftRedisCommandArray target = { 0 };
+    assert_int_equal(RaftRedisCommandArrayDeserialize(&target, d->data, d->data_len), RR_OK);
+    raft_entry_release(d);
+    assert_int_equal(target.len, 1);
+    assert_int_equal(target.commands[0]->argc, 3);
+
+    size_t len;
+    const char *p = RedisModule_StringPtrLen(target.commands[0]->argv[2], &len);
+    assert_int_equal(len, strlen(value));
+    assert_memory_equal(p, value, len);
+    RaftRedisCommandArrayFree(&target);
+
+    /* Compressed data is not a command array */
+    assert_int_equal(RaftRedisCommandArrayDeserialize(&target, e->data, e->data_len), RR_ERROR);
+
+    /* Corrupted compressed data */
+    e->data[e->data_len / 2] ^= 0xff;
+    e->data_len -= 10;
+    assert_null(RaftEntryDecompress(e));
+    raft_entry_release(e);
+
+    const char bad_len[] = "$99999999999\n" "\x00" "a";
+    e = raft_entry_new(sizeof(bad_len) - 1);
+    memcpy(e->data, bad_len, sizeof(bad_len) - 1);
+    e->type = RAFT_LOGTYPE_COMPRESSED;
+    assert_null(RaftEntryDecompress(e));
+    raft_entry_release(e);
+    RaftRedisCommandArrayFree(&cmd_array);
+}
+
+static void test_serialize_lengths(void **state)
+{
+    static const size_t lengths[] = { 0, 9, 10, 99, 100, 999, 1000, 12345, 100000 };
+    char *value = test_malloc(100001);
+    int i;
+
+    memset(value, 'x', 100000);
+    for (i = 0; i < sizeof(lengths) / sizeof(lengths[0]); i++) {
+        value[lengths[i]] = '\0';
+
+        const char *argv[] = { "SET", value };
+        RaftRedisCommandArray cmd_array = { 0 };
+        setupRedisCommand(RaftRedisCommandArrayExtend(&cmd_array), argv, 2);
+
+        /* Entry is sized exactly */
+        char hdr[32];
+        int hdr_len = snprintf(hdr, sizeof(hdr), "*1\n*2\n$3\nSET\n$%zu\n", lengths[i]);
+        raft_entry_t *e = RaftRedisCommandArraySerialize(&cmd_array);
+        assert_int_equal(e->data_len, hdr_len + lengths[i] + 1);
+        assert_memory_equal(e->data, hdr, hdr_len);
+
+        RaftRedisCommandArray target = { 0 };
+        assert_int_equal(RaftRedisCommandArrayDeserialize(&target, e->data, e->data_len), RR_OK);
+        size_t len;
+        RedisModule_StringPtrLen(target.commands[0]->argv[1], &len);
+        assert_int_equal(len, lengths[i]);
+
+        RaftRedisCommandArrayFree(&target);
+        raft_entry_release(e);
+        RaftRedisCommandArrayFree(&cmd_array);
+        value[lengths[i]] = 'x';
+    }
+
+    test_free(value);
+
+    /* Integers that overflow */
+    RaftRedisCommand cmd = { 0 };
+    const char *d_overflow = "*99999999999999999999\n";
+    assert_int_equal(RaftRedisCommandDeserialize(&cmd, d_overflow, strlen(d_overflow)), 0);
+}
+
+static raft_entry_t *makeEntry(raft_term_t term, int id, int type, const char *data)
+{
+    raft_entry_t *e = raft_entry_new(strlen(data));
+    e->term = term;
+    e->id = id;
+    e->type = type;
+    memcpy(e->data, data, strlen(data));
+    return e;
+}
+
+static void test_serialize_append_entries(void **state)
+{
+    raft_entry_t *entries[] = {
+        makeEntry(3, 100, RAFT_LOGTYPE_NORMAL, "*1\n*1\n$4\nPING\n"),
+        makeEntry(4, -1, RAFT_LOGTYPE_ADD_NODE, ""),
+        makeEntry(0xffffffffff, INT32_MAX, RAFT_LOGTYPE_NORMAL, "data")
+    };
+    msg_appendentries_t msg = {
+        .term = 4,
+        .prev_log_idx = 0x100000000,
+        .prev_log_term = 2,
+        .leader_commit = 10,
+        .msg_id = 12345,
+        .n_entries = 3,
+        .entries = entries
+    };
+
+    size_t len;
+    char *buf = RaftAppendEntriesSerialize(&msg, &len);
+    assert_non_null(buf);
+
+    msg_appendentries_t target;
+    assert_int_equal(RaftAppendEntriesDeserialize(&target, buf, len), RR_OK);
+    assert_int_equal(target.term, msg.term);
+    assert_int_equal(target.prev_log_idx, msg.prev_log_idx);
+    assert_int_equal(target.prev_log_term, msg.prev_log_term);
+    assert_int_equal(target.leader_commit, msg.leader_commit);
+    assert_int_equal(target.msg_id, msg.msg_id);
+    assert_int_equal(target.n_entries, 3);
+
+    int i;
+    for (i = 0; i < 3; i++) {
+        assert_int_equal(target.entries[i]->term, entries[i]->term);
+        assert_int_equal(target.entries[i]->id, entries[i]->id);
+        assert_int_equal(target.entries[i]->type, entries[i]->type);
+        assert_int_equal(target.entries[i]->data_len, entries[i]->data_len);
+        assert_memory_equal(target.entries[i]->data, entries[i]->data, entries[i]->data_len);
+        assert_int_equal((uintptr_t) target.entries[i] % 8, 0);
+    }
+
+    /* Entries are sliced from one block, which outlives any single entry */
+    assert_true((char *) target.entries[1] > (char *) target.entries[0]);
+    assert_true((char *) target.entries[2] > (char *) target.entries[1]);
+    raft_entry_hold(target.entries[2]);
+    raft_entry_release(target.entries[0]);
+    raft_entry_release(target.entries[2]);
+    raft_entry_release(target.entries[1]);
+    assert_memory_equal(target.entries[2]->data, "data", 4);
+    raft_entry_release(target.entries[2]);
+    test_free(target.entries);
+
+    /* Truncated */
+    assert_int_equal(RaftAppendEntriesDeserialize(&target, buf, len - 1), RR_ERROR);
+    assert_int_equal(RaftAppendEntriesDeserialize(&target, buf, 10), RR_ERROR);
+    test_free(buf);
+
+    /* No entries */
+    msg.n_entries = 0;
+    buf = RaftAppendEntriesSerialize(&msg, &len);
+    assert_int_equal(RaftAppendEntriesDeserialize(&target, buf, len), RR_OK);
+    assert_int_equal(target.n_entries, 0);
+    assert_null(target.entries);
+    test_free(buf);
+
+    for (i = 0; i < 3; i++) {
+        raft_entry_release(entries[i]);
+    }
+}
+
 const struct CMUnitTest serialization_tests[] = {
     cmocka_unit_test(test_serialize_redis_command),
     cmocka_unit_test(test_deserialize_redis_command),
     cmocka_unit_test(test_deserialize_redis_command_array),
+    cmocka_unit_test(test_command_array_batch),
     cmocka_unit_test(test_deserialize_corrupted_data),
+    cmocka_unit_test(test_lzf_compress),
+    cmocka_unit_test(test_compress_entry),
+    cmocka_unit_test(test_serialize_lengths),
+    cmocka_unit_test(test_serialize_append_entries),
     { .test_func = NULL }
 };
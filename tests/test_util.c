@@ -124,8 +124,235 @@ static void test_redis_info_iterate(void **state)
     assert_int_equal(RedisInfoIterate(&p, &info_len, &key, &keylen, &val, &vallen), -1);
 }
 
+static void test_crc32c(void **state)
+{
+    const char data[] = "123456789";
+
+    assert_int_equal(crc32c(0, "", 0), 0);
+    assert_int_equal(crc32c(0, data, 9), 0xe3069283);
+
+    /* Incremental */
+    assert_int_equal(crc32c(crc32c(0, data, 4), data + 4, 5), 0xe3069283);
+}
+
+static void test_mem_pool(void **state)
+{
+    MemPool pool;
+    MemPoolStats stats;
+
+    MemPoolInit(&pool, "test", 100, 2);
+
+    void *p1 = MemPoolAlloc(&pool);
+    void *p2 = MemPoolAlloc(&pool);
+    void *p3 = MemPoolAlloc(&pool);
+
+    /* Only two objects are cached */
+    MemPoolFree(&pool, p1);
+    MemPoolFree(&pool, p2);
+    MemPoolFree(&pool, p3);
+
+    MemPoolGetStats(&pool, &stats);
+    assert_int_equal(stats.num_free, 2);
+    assert_int_equal(stats.free_bytes, 200);
+
+    /* Released objects are reused */
+    void *p4 = MemPoolAlloc(&pool);
+    assert_true(p4 == p2);
+    void *p5 = MemPoolAlloc(&pool);
+    assert_true(p5 == p1);
+    void *p6 = MemPoolAlloc(&pool);
+
+    MemPoolGetStats(&pool, &stats);
+    assert_int_equal(stats.allocs, 6);
+    assert_int_equal(stats.hits, 2);
+    assert_int_equal(stats.frees, 3);
+    assert_int_equal(stats.num_free, 0);
+
+    MemPoolFree(&pool, p4);
+    MemPoolFree(&pool, p5);
+    MemPoolFree(&pool, p6);
+    MemPoolTerm(&pool);
+}
+
+static void test_pool_heap(void **state)
+{
+    MemPoolStats stats;
+
+    PoolHeapInit();
+
+    /* Memory of the same size class is reused */
+    char *p1 = PoolHeapAlloc(10);
+    PoolHeapFree(p1);
+    char *p2 = PoolHeapCalloc(2, 20);
+    assert_true(p1 == p2);
+    for (int i = 0; i < 40; i++) {
+        assert_int_equal(p2[i], 0);
+    }
+
+    /* Realloc within the same class keeps the pointer */
+    memset(p2, 'x', 40);
+    assert_true(PoolHeapRealloc(p2, 48) == p2);
+
+    /* Realloc to a larger class and to an oversized allocation */
+    char *p3 = PoolHeapRealloc(p2, 1000);
+    assert_memory_equal(p3, "xxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxx", 40);
+    char *p4 = PoolHeapRealloc(p3, 100000);
+    assert_memory_equal(p4, "xxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxx", 40);
+    p4[99999] = 'y';
+    char *p5 = PoolHeapRealloc(p4, 200000);
+    assert_int_equal(p5[99999], 'y');
+
+    /* Back to a pooled allocation */
+    char *p6 = PoolHeapRealloc(p5, 20);
+    assert_memory_equal(p6, "xxxxxxxxxxxxxxxxxxxx", 20);
+    PoolHeapFree(p6);
+
+    /* Overflowing calloc sizes fail */
+    assert_null(PoolHeapCalloc(SIZE_MAX / 2 + 1, 2));
+    assert_null(PoolHeapCalloc(2, SIZE_MAX));
+
+    PoolHeapGetStats(&stats);
+    assert_int_equal(stats.hits, 2);
+    assert_int_equal(stats.num_free, 2);
+
+    PoolHeapTerm();
+}
+
+static void test_histogram(void **state)
+{
+    Histogram h;
+    int i;
+
+    HistogramReset(&h);
+    assert_int_equal(HistogramPercentile(&h, 50), 0);
+    assert_int_equal(HistogramMean(&h), 0);
+
+    /* Small values are exact */
+    for (i = 1; i <= 10; i++) {
+        HistogramRecord(&h, i);
+    }
+    assert_int_equal(h.count, 10);
+    assert_int_equal(h.min, 1);
+    assert_int_equal(h.max, 10);
+    assert_int_equal(HistogramMean(&h), 5);
+    assert_int_equal(HistogramPercentile(&h, 50), 5);
+    assert_int_equal(HistogramPercentile(&h, 100), 10);
+    assert_int_equal(HistogramPercentile(&h, 95), 10);
+    assert_int_equal(HistogramPercentile(&h, 90), 9);
+    assert_int_equal(HistogramPercentile(&h, 51), 6);
+
+    /* Large values are within 1/16 */
+    HistogramReset(&h);
+    for (i = 1; i <= 1000; i++) {
+        HistogramRecord(&h, i * 1000);
+    }
+    uint64_t p50 = HistogramPercentile(&h, 50);
+    uint64_t p99 = HistogramPercentile(&h, 99);
+    uint64_t p999 = HistogramPercentile(&h, 99.9);
+    assert_true(p50 >= 500000 && p50 <= 500000 + 500000 / 16);
+    assert_true(p99 >= 990000 && p99 <= 990000 + 990000 / 16);
+    assert_true(p999 >= 999000 && p999 <= 1000000);
+    assert_int_equal(HistogramPercentile(&h, 100), 1000000);
+
+    /* Out of range values are counted in the last bucket */
+    HistogramRecord(&h, UINT64_MAX);
+    assert_int_equal(h.buckets[HISTOGRAM_BUCKETS - 1], 1);
+    assert_int_equal(HistogramPercentile(&h, 100), UINT64_MAX);
+}
+
+static bool loggerWrite(const char *fmt, ...)
+{
+    va_list ap;
+    bool ret;
+
+    va_start(ap, fmt);
+    ret = LoggerWrite(fmt, ap);
+    va_end(ap);
+
+    return ret;
+}
+
+static void test_logger(void **state)
+{
+    FILE *saved_logfile = redis_raft_logfile;
+    char line[2048];
+    int i;
+
+    redis_raft_logfile = tmpfile();
+    assert_non_null(redis_raft_logfile);
+
+    /* Not started, caller writes the log */
+    assert_false(LoggerIsAsync());
+    assert_false(loggerWrite("message\n"));
+
+    /* Messages are written out in order */
+    assert_int_equal(LoggerStart(), RR_OK);
+    assert_true(LoggerIsAsync());
+    for (i = 0; i < 100; i++) {
+        assert_true(loggerWrite("message %d\n", i));
+    }
+    LoggerFlush();
+
+    rewind(redis_raft_logfile);
+    for (i = 0; i < 100; i++) {
+        char expected[32];
+
+        assert_non_null(fgets(line, sizeof(line), redis_raft_logfile));
+        snprintf(expected, sizeof(expected), " message %d\n", i);
+        assert_non_null(strstr(line, expected));
+        assert_string_equal(line + strlen(line) - strlen(expected), expected);
+    }
+    assert_null(fgets(line, sizeof(line), redis_raft_logfile));
+    fseek(redis_raft_logfile, 0, SEEK_END);
+
+    /* Overflowing messages are dropped and counted, not lost silently */
+    unsigned long long dropped = LoggerGetDropped();
+    int total = 10 * 1024;
+    for (i = 0; i < total; i++) {
+        assert_true(loggerWrite("burst %d\n", i));
+    }
+    LoggerStop();
+    assert_false(LoggerIsAsync());
+
+    rewind(redis_raft_logfile);
+    int written = 0;
+    while (fgets(line, sizeof(line), redis_raft_logfile) != NULL) {
+        if (strstr(line, " burst ")) {
+            written++;
+        }
+    }
+    assert_int_equal(written + (LoggerGetDropped() - dropped), total);
+
+    /* Long messages are truncated */
+    fseek(redis_raft_logfile, 0, SEEK_END);
+    long pos = ftell(redis_raft_logfile);
+    assert_int_equal(LoggerStart(), RR_OK);
+    memset(line, 'x', sizeof(line) - 2);
+    line[sizeof(line) - 2] = '\n';
+    line[sizeof(line) - 1] = '\0';
+    assert_true(loggerWrite("%s", line));
+    LoggerStop();
+
+    fseek(redis_raft_logfile, pos, SEEK_SET);
+    memset(line, 0, sizeof(line));
+    assert_true(fread(line, 1, sizeof(line) - 1, redis_raft_logfile) > 0);
+    char *msg = strchr(line, 'x');
+    assert_non_null(msg);
+    assert_int_equal(strlen(msg), 1023);
+    assert_int_equal(msg[1022], '\n');
+    assert_int_equal(msg[1021], 'x');
+
+    fclose(redis_raft_logfile);
+    redis_raft_logfile = saved_logfile;
+}
+
 const struct CMUnitTest util_tests[] = {
     cmocka_unit_test(test_redis_info_iterate),
     cmocka_unit_test(test_memory_conversion),
+    cmocka_unit_test(test_crc32c),
+    cmocka_unit_test(test_mem_pool),
+    cmocka_unit_test(test_pool_heap),
+    cmocka_unit_test(test_histogram),
+    cmocka_unit_test(test_logger),
     { .test_func = NULL }
 };